@@ -0,0 +1,106 @@
+/*
+ * Multi-threaded hit-path benchmark for the buffer manager.
+ * Every page fits in the pool, so after warm-up all fetches are hits. Each thread fetches random pages
+ * with read guards, and we report the aggregate throughput for an increasing number of threads.
+ * A second run has all threads read a few hot pages, with read guards and with optimistic readers.
+ *
+ * Usage: buffer_manager_bench [num_pages] [ops_per_thread] [max_threads]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+#include "buffer_manager.h"
+#include "common.h"
+#include "disk_manager.h"
+#include "page_guard.h"
+
+std::filesystem::path db_path(DB_PATH);
+
+double RunHitPath(BufferManager &bpm, const std::vector<page_id_t> &pages, size_t num_threads, size_t ops) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t=0; t<num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<size_t> dist(0, pages.size() - 1);
+            volatile char sink = 0;
+            for (size_t i=0; i<ops; i++) {
+                auto guard = bpm.GetGuardedPageReader(pages[dist(rng)]);
+                sink = guard.GetData()[0];
+            }
+            (void)sink;
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (num_threads * ops) / elapsed.count();
+}
+
+/* Each thread keeps an optimistic reader per hot page, and restarts it for every read. */
+double RunOptimistic(BufferManager &bpm, const std::vector<page_id_t> &pages, size_t num_threads, size_t ops) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t=0; t<num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            std::vector<std::optional<OptimisticPageReader>> readers(pages.size());
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<size_t> dist(0, pages.size() - 1);
+            volatile char sink = 0;
+            for (size_t i=0; i<ops; i++) {
+                size_t idx = dist(rng);
+                auto &reader = readers[idx];
+                while (!reader.has_value() || !reader->Restart())
+                    reader = bpm.GetOptimisticPageReader(pages[idx]);
+                do {
+                    sink = reader->GetData()[0];
+                } while (!reader->Validate() && reader->Restart());
+            }
+            (void)sink;
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (num_threads * ops) / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+    size_t num_pages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1024;
+    size_t ops = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+    size_t max_threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+
+    std::filesystem::remove(db_path);
+    auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+
+    std::cout << "threads\tshards=1 (ops/s)\tshards=" << NUM_PAGE_TABLE_SHARDS << " (ops/s)" << std::endl;
+    for (size_t num_threads=1; num_threads<=max_threads; num_threads*=2) {
+        std::cout << num_threads;
+        for (size_t num_shards : {size_t(1), size_t(NUM_PAGE_TABLE_SHARDS)}) {
+            BufferManager bpm(num_pages, disk_manager.get(), K_DIST, num_shards);
+            std::vector<page_id_t> pages;
+            for (size_t i=0; i<num_pages; i++)
+                pages.push_back(bpm.NewPage());
+            std::cout << "\t" << static_cast<size_t>(RunHitPath(bpm, pages, num_threads, ops));
+        }
+        std::cout << std::endl;
+    }
+
+    const size_t num_hot_pages = 4;
+    std::cout << std::endl << "threads\tguarded, " << num_hot_pages << " hot pages (ops/s)\toptimistic (ops/s)" << std::endl;
+    for (size_t num_threads=1; num_threads<=max_threads; num_threads*=2) {
+        BufferManager bpm(num_pages, disk_manager.get(), K_DIST);
+        std::vector<page_id_t> pages;
+        for (size_t i=0; i<num_hot_pages; i++)
+            pages.push_back(bpm.NewPage());
+        std::cout << num_threads << "\t" << static_cast<size_t>(RunHitPath(bpm, pages, num_threads, ops))
+            << "\t" << static_cast<size_t>(RunOptimistic(bpm, pages, num_threads, ops)) << std::endl;
+    }
+
+    std::filesystem::remove(db_path);
+    return 0;
+}
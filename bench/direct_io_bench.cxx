@@ -0,0 +1,105 @@
+/*
+ * Buffered against direct I/O under a buffer pool smaller than the database. Each mode writes num_pages pages,
+ * drops them from the OS page cache, then has every thread fetch random pages through the buffer manager.
+ * We report the throughput, the memory held by the pool, and how much of the file the OS page cache holds
+ * afterwards. Buffered I/O caches every page it reads a second time, in the page cache; direct I/O does not.
+ * With the file on a fast device, or in memory, buffered reads are cheaper: misses hit the page cache.
+ *
+ * Usage: direct_io_bench [num_pages] [pool_frames] [reads_per_thread] [num_threads]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "buffer_manager.h"
+#include "common.h"
+#include "disk_manager.h"
+#include "page_guard.h"
+
+std::filesystem::path db_path(DB_PATH);
+
+/* Writes back and evicts the file's pages from the OS page cache. */
+void DropPageCache() {
+    int fd = open(db_path.c_str(), O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/* Bytes of the file resident in the OS page cache. */
+size_t PageCacheBytes() {
+    int fd = open(db_path.c_str(), O_RDONLY);
+    size_t size = std::filesystem::file_size(db_path);
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return 0;
+
+    size_t os_page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> resident((size + os_page - 1) / os_page);
+    size_t bytes = 0;
+    if (mincore(addr, size, resident.data()) == 0) {
+        for (unsigned char r : resident)
+            bytes += (r & 1) * os_page;
+    }
+    munmap(addr, size);
+    return bytes;
+}
+
+double RunReads(BufferManager &bpm, size_t num_pages, size_t num_threads, size_t reads) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t=0; t<num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<page_id_t> dist(0, num_pages - 1);
+            volatile char sink = 0;
+            for (size_t i=0; i<reads; i++) {
+                auto guard = bpm.GetGuardedPageReader(dist(rng));
+                sink = guard.GetData()[0];
+            }
+            (void)sink;
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (num_threads * reads) / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+    size_t num_pages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32768;
+    size_t pool_frames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8192;
+    size_t reads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100000;
+    size_t num_threads = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 4;
+
+    std::cout << "mode\treads/s\tpool (MiB)\tpage cache (MiB)" << std::endl;
+    for (bool direct_io : {false, true}) {
+        std::filesystem::remove(db_path);
+        DiskManager disk_manager(db_path, PAGE_SIZE, direct_io);
+        std::vector<char> page(PAGE_SIZE);
+        for (page_id_t page_id=0; page_id<static_cast<page_id_t>(num_pages); page_id++) {
+            snprintf(page.data(), PAGE_SIZE, "%d", page_id);
+            disk_manager.WritePage(page_id, page.data());
+        }
+        DropPageCache();
+
+        double throughput;
+        {
+            BufferManager bpm(pool_frames, &disk_manager, K_DIST);
+            throughput = RunReads(bpm, num_pages, num_threads, reads);
+        }
+        std::cout << (disk_manager.IsDirectIO() ? "direct" : direct_io ? "direct (unsupported, buffered)" : "buffered")
+            << "\t" << static_cast<size_t>(throughput) << "\t" << pool_frames * PAGE_SIZE / (1 << 20)
+            << "\t" << PageCacheBytes() / (1 << 20) << std::endl;
+    }
+
+    std::filesystem::remove(db_path);
+    return 0;
+}
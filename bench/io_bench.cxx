@@ -0,0 +1,112 @@
+/*
+ * Throughput of the background scheduler's I/O backends. The database file is filled with num_pages pages,
+ * then every client thread reads random pages, keeping queue_depth requests outstanding at once. A second run
+ * reads consecutive pages, as a scan would, which the scheduler merges into vectored reads.
+ * Reads mostly hit the OS page cache, so this measures the per-request cost of the backend rather than the device.
+ * Last, every thread makes single page writes durable, with an fdatasync of its own per write, or through sync
+ * barriers, which batch the writes of all threads into shared fdatasyncs.
+ *
+ * Usage: io_bench [num_pages] [reads_per_thread] [num_threads] [queue_depth]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include "background_scheduler.h"
+#include "common.h"
+#include "disk_manager.h"
+
+std::filesystem::path db_path(DB_PATH);
+
+double RunReads(Background_Scheduler &scheduler, size_t num_pages, size_t num_threads, size_t reads,
+    size_t queue_depth, bool sequential) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t=0; t<num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<page_id_t> dist(0, num_pages - 1);
+            std::vector<char> bufs(queue_depth * PAGE_SIZE);
+            std::vector<std::shared_ptr<Request>> reqs(queue_depth);
+            page_id_t next = dist(rng);
+            for (size_t i=0; i<reads; i+=queue_depth) {
+                for (size_t d=0; d<queue_depth; d++) {
+                    page_id_t page_id = sequential ? next++ % num_pages : dist(rng);
+                    reqs[d] = std::make_shared<Request>(true, page_id, bufs.data() + d * PAGE_SIZE);
+                    scheduler.Schedule(reqs[d]);
+                }
+                for (auto &req : reqs)
+                    req->promise_->get_future().get();
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (num_threads * reads) / elapsed.count();
+}
+
+/* Each thread writes a page and waits until it is durable, commits times. */
+double RunCommits(Background_Scheduler &scheduler, DiskManager &disk_manager, size_t num_threads, size_t commits,
+    bool group_commit) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t=0; t<num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            std::vector<char> page(PAGE_SIZE, 'c');
+            for (size_t i=0; i<commits; i++) {
+                auto req = std::make_shared<Request>(false, static_cast<page_id_t>(t), (const char*)page.data());
+                scheduler.Schedule(req);
+                req->promise_->get_future().get();
+                if (group_commit)
+                    scheduler.SyncBarrier().get();
+                else
+                    disk_manager.Sync();
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (num_threads * commits) / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+    size_t num_pages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16384;
+    size_t reads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 50000;
+    size_t num_threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 4;
+    size_t queue_depth = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 16;
+
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    std::vector<char> page(PAGE_SIZE, 'x');
+    for (page_id_t page_id=0; page_id<static_cast<page_id_t>(num_pages); page_id++)
+        disk_manager.WritePage(page_id, page.data());
+
+    std::cout << "backend\trandom (reads/s)\tsequential (reads/s)" << std::endl;
+    for (IOBackend backend : {IOBackend::THREAD_POOL, IOBackend::IO_URING}) {
+        Background_Scheduler scheduler(&disk_manager, nullptr, NUM_BACKGROUND_THREADS, IO_QUEUE_CAPACITY, backend);
+        const char* name = scheduler.GetBackend() == IOBackend::IO_URING ? "io_uring" : "thread pool";
+        std::cout << name;
+        for (bool sequential : {false, true})
+            std::cout << "\t" << static_cast<size_t>(RunReads(scheduler, num_pages, num_threads, reads, queue_depth,
+                sequential));
+        std::cout << std::endl;
+    }
+
+    const size_t commits = 200;
+    Background_Scheduler scheduler(&disk_manager);
+    std::cout << std::endl << "threads\tfdatasync per write (commits/s)\tsync barrier (commits/s)" << std::endl;
+    for (size_t threads : {size_t(1), num_threads, 4 * num_threads}) {
+        std::cout << threads;
+        for (bool group_commit : {false, true})
+            std::cout << "\t" << static_cast<size_t>(RunCommits(scheduler, disk_manager, threads, commits, group_commit));
+        std::cout << std::endl;
+    }
+
+    std::filesystem::remove(db_path);
+    return 0;
+}
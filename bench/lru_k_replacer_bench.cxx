@@ -0,0 +1,37 @@
+/*
+ * Single-threaded benchmark for the LRU-K replacer on a large pool.
+ * Every frame is given a page, then we time a loop that evicts a frame, publishes it for a new page and
+ * records the access, as the buffer manager does on every miss.
+ *
+ * Usage: lru_k_replacer_bench [num_frames] [ops]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "common.h"
+#include "frame_state.h"
+#include "lru_k_replacer.h"
+
+int main(int argc, char **argv) {
+    size_t num_frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1 << 20;
+    size_t ops = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+
+    FrameStateArray frames(num_frames);
+    LRUKReplacer replacer(num_frames, K_DIST, &frames);
+    for (size_t i=0; i<num_frames; i++) {
+        frames.Publish(i);
+        replacer.RecordAccess(i, i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<ops; i++) {
+        frame_id_t frame_id = replacer.Evict().value();
+        frames.Publish(frame_id);
+        replacer.RecordAccess(frame_id, num_frames + i);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "frames\tevictions/s" << std::endl;
+    std::cout << num_frames << "\t" << static_cast<size_t>(ops / elapsed.count()) << std::endl;
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Replays page access traces against every replacement policy, and reports the hit rate of each.
+ * Replay simulates the buffer manager's page table on top of the replacer: a hit pins and unpins the
+ * page's frame, setting its reference bit, and a miss takes a free frame or evicts one. No pages are read or written.
+ *
+ * A trace file lists page ids, separated by whitespace, in access order. Without one, synthetic traces are
+ * replayed: skewed (zipfian) accesses, a hot set mixed with long scans, and a loop slightly larger than the pool.
+ *
+ * Usage: replacer_trace_bench [num_frames] [trace_file]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "common.h"
+#include "frame_state.h"
+#include "replacer.h"
+
+struct ReplayResult {
+    double hit_ratio;
+    double ops_per_sec;
+};
+
+ReplayResult Replay(ReplacerType type, size_t num_frames, const std::vector<page_id_t>& trace) {
+    FrameStateArray frames(num_frames);
+    std::shared_ptr<Replacer> replacer = MakeReplacer(type, num_frames, K_DIST, &frames);
+    std::unordered_map<page_id_t, frame_id_t> page_table;
+    std::vector<page_id_t> frame_pages(num_frames, INVALID_PAGE_ID);
+    size_t next_free = 0;
+    size_t hits = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (page_id_t page_id : trace) {
+        frame_id_t frame_id;
+        auto it = page_table.find(page_id);
+        if (it != page_table.end()) {
+            frame_id = it->second;
+            hits++;
+            frames.Pin(frame_id, true);
+            frames.Unpin(frame_id);
+        } else {
+            if (next_free < num_frames) {
+                frame_id = next_free++;
+            } else {
+                frame_id = replacer->Evict().value();
+                page_table.erase(frame_pages[frame_id]);
+            }
+            page_table[page_id] = frame_id;
+            frame_pages[frame_id] = page_id;
+            frames.Publish(frame_id);
+            replacer->RecordAccess(frame_id, page_id);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return ReplayResult{static_cast<double>(hits) / trace.size(), trace.size() / elapsed.count()};
+}
+
+/* Zipfian accesses (s = 1) over num_pages pages, hottest first. */
+std::vector<page_id_t> ZipfTrace(size_t num_pages, size_t length, std::mt19937& rng) {
+    std::vector<double> cdf(num_pages);
+    double sum = 0;
+    for (size_t i=0; i<num_pages; i++) {
+        sum += 1.0 / (i + 1);
+        cdf[i] = sum;
+    }
+    std::uniform_real_distribution<double> dist(0, sum);
+    std::vector<page_id_t> trace;
+    trace.reserve(length);
+    for (size_t i=0; i<length; i++)
+        trace.push_back(std::lower_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin());
+    return trace;
+}
+
+/* Uniform accesses to a hot set of hot_pages pages, interrupted by sequential scans of new pages. */
+std::vector<page_id_t> ScanTrace(size_t hot_pages, size_t scan_length, size_t length, std::mt19937& rng) {
+    std::uniform_int_distribution<page_id_t> hot(0, hot_pages - 1);
+    std::vector<page_id_t> trace;
+    trace.reserve(length);
+    page_id_t next_scan_page = hot_pages;
+    while (trace.size() < length) {
+        for (size_t i=0; i<4 * hot_pages && trace.size() < length; i++)
+            trace.push_back(hot(rng));
+        for (size_t i=0; i<scan_length && trace.size() < length; i++)
+            trace.push_back(next_scan_page++);
+    }
+    return trace;
+}
+
+/* Repeated sequential passes over num_pages pages. */
+std::vector<page_id_t> LoopTrace(size_t num_pages, size_t length) {
+    std::vector<page_id_t> trace;
+    trace.reserve(length);
+    for (size_t i=0; i<length; i++)
+        trace.push_back(i % num_pages);
+    return trace;
+}
+
+int main(int argc, char **argv) {
+    size_t num_frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+
+    std::vector<std::pair<std::string, std::vector<page_id_t>>> traces;
+    if (argc > 2) {
+        std::ifstream file(argv[2]);
+        if (!file) {
+            std::cerr << "[main] cannot open trace " << argv[2] << std::endl;
+            return 1;
+        }
+        std::vector<page_id_t> trace;
+        page_id_t page_id;
+        while (file >> page_id)
+            trace.push_back(page_id);
+        traces.emplace_back(argv[2], std::move(trace));
+    } else {
+        std::mt19937 rng(42);
+        size_t length = 200 * num_frames;
+        traces.emplace_back("zipf", ZipfTrace(10 * num_frames, length, rng));
+        traces.emplace_back("hot+scan", ScanTrace(num_frames / 2, 2 * num_frames, length, rng));
+        traces.emplace_back("loop", LoopTrace(num_frames + num_frames / 10, length));
+    }
+
+    const std::pair<std::string, ReplacerType> policies[] = {
+        {"lru-k", ReplacerType::LRU_K}, {"clock", ReplacerType::CLOCK}, {"2q", ReplacerType::TWO_Q},
+        {"arc", ReplacerType::ARC}
+    };
+    std::cout << "trace\tpolicy\thit_ratio\tops/s" << std::endl;
+    for (const auto& [name, trace] : traces) {
+        if (trace.empty())
+            continue;
+        for (const auto& [policy, type] : policies) {
+            ReplayResult result = Replay(type, num_frames, trace);
+            std::cout << name << "\t" << policy << "\t" << result.hit_ratio << "\t"
+                << static_cast<size_t>(result.ops_per_sec) << std::endl;
+        }
+    }
+    return 0;
+}
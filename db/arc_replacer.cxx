@@ -0,0 +1,109 @@
+#include <algorithm>
+#include "arc_replacer.h"
+#include "common.h"
+
+ARCReplacer::ARCReplacer(size_t num_frames, FrameStateTable* frames, Metrics* metrics):
+Replacer(num_frames, frames, metrics), num_frames_(num_frames), target_t1_size_(0), page_ids_(num_frames, INVALID_PAGE_ID),
+queues_(num_frames, Queue::NONE), cold_(num_frames, false), prev_(num_frames, INVALID_FRAME_ID),
+next_(num_frames, INVALID_FRAME_ID), t1_(prev_, next_), t2_(prev_, next_) {}
+
+void ARCReplacer::Hit(frame_id_t frame_id) {
+    /* The page has now been seen at least twice, or once if it was only scanned so far. */
+    Unlink(frame_id);
+    (cold_[frame_id] ? t1_ : t2_).PushFront(frame_id);
+    queues_[frame_id] = cold_[frame_id] ? Queue::T1 : Queue::T2;
+    cold_[frame_id] = false;
+}
+
+void ARCReplacer::Unlink(frame_id_t frame_id) {
+    if (queues_[frame_id] == Queue::T1)
+        t1_.Erase(frame_id);
+    else if (queues_[frame_id] == Queue::T2)
+        t2_.Erase(frame_id);
+    queues_[frame_id] = Queue::NONE;
+}
+
+std::optional<frame_id_t> ARCReplacer::EvictLocked() {
+    /*
+     * The page being read in is not known yet, so unlike the paper a tie (|T1| == p) goes to T2.
+     * If the preferred list only has pinned frames, take from the other. Pages only scanned go first.
+     */
+    auto hit = [this](frame_id_t frame_id) { Hit(frame_id); };
+    frame_id_t frame_id = INVALID_FRAME_ID;
+    frame_id_t oldest = t1_.Back();
+    if (oldest != INVALID_FRAME_ID && (cold_[oldest] || t1_.Size() > std::min(target_t1_size_, capacity_)))
+        frame_id = ClaimFromBack(t1_, hit);
+    if (frame_id == INVALID_FRAME_ID)
+        frame_id = ClaimFromBack(t2_, hit);
+    if (frame_id == INVALID_FRAME_ID)
+        frame_id = ClaimFromBack(t1_, hit);
+    if (frame_id == INVALID_FRAME_ID)
+        return std::nullopt;
+
+    page_id_t page_id = page_ids_[frame_id];
+    if (page_id != INVALID_PAGE_ID && !cold_[frame_id]) {
+        GhostList& ghosts = queues_[frame_id] == Queue::T1 ? b1_ : b2_;
+        b1_.Erase(page_id);
+        b2_.Erase(page_id);
+        ghosts.PushFront(page_id);
+    }
+    Unlink(frame_id);
+    page_ids_[frame_id] = INVALID_PAGE_ID;
+
+    /* Keep |T1| + |B1| <= c, and the whole directory within 2c pages. */
+    while (b1_.Size() > 0 && t1_.Size() + b1_.Size() > capacity_)
+        b1_.PopBack();
+    while (b2_.Size() > 0 && t1_.Size() + t2_.Size() + b1_.Size() + b2_.Size() > 2 * capacity_)
+        b2_.PopBack();
+    return frame_id;
+}
+
+void ARCReplacer::RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) {
+    if (queues_[frame_id] != Queue::NONE && page_ids_[frame_id] == page_id) {
+        if (hint == AccessHint::POINT)
+            Hit(frame_id);
+        return;
+    }
+
+    /* The frame holds a new page. Adapt p if the page was evicted recently. */
+    Unlink(frame_id);
+    page_ids_[frame_id] = page_id;
+    cold_[frame_id] = hint != AccessHint::POINT;
+    if (cold_[frame_id]) {
+        b1_.Erase(page_id);
+        b2_.Erase(page_id);
+        t1_.PushBack(frame_id);
+        queues_[frame_id] = Queue::T1;
+    } else if (b1_.Contains(page_id)) {
+        size_t delta = std::max(b2_.Size() / b1_.Size(), size_t(1));
+        target_t1_size_ = std::min(target_t1_size_ + delta, capacity_);
+        b1_.Erase(page_id);
+        t2_.PushFront(frame_id);
+        queues_[frame_id] = Queue::T2;
+    } else if (b2_.Contains(page_id)) {
+        size_t delta = std::max(b1_.Size() / b2_.Size(), size_t(1));
+        target_t1_size_ = target_t1_size_ > delta ? target_t1_size_ - delta : 0;
+        b2_.Erase(page_id);
+        t2_.PushFront(frame_id);
+        queues_[frame_id] = Queue::T2;
+    } else {
+        t1_.PushFront(frame_id);
+        queues_[frame_id] = Queue::T1;
+    }
+}
+
+void ARCReplacer::RemoveLocked(frame_id_t frame_id) {
+    Unlink(frame_id);
+    page_ids_[frame_id] = INVALID_PAGE_ID;
+}
+
+void ARCReplacer::ResizeLocked(size_t num_frames) {
+    if (num_frames <= num_frames_)
+        return;
+    page_ids_.resize(num_frames, INVALID_PAGE_ID);
+    queues_.resize(num_frames, Queue::NONE);
+    cold_.resize(num_frames, false);
+    prev_.resize(num_frames, INVALID_FRAME_ID);
+    next_.resize(num_frames, INVALID_FRAME_ID);
+    num_frames_ = num_frames;
+}
@@ -1,48 +1,399 @@
 #include "background_scheduler.h"
 #include "common.h"
 #include "disk_manager.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
 #include <exception>
+#include <iostream>
+#include <stdexcept>
 
-/* TODO: support multiple background threads */
-Background_Scheduler::Background_Scheduler(DiskManager* disk_manager): disk_manager_(disk_manager) {
-    for (int i=0; i<NUM_BACKGROUND_THREADS; i++) {
-        /* TODO: Learn about lamdba functions */
-        background_threads_.emplace_back([this] {
-            while (true) {
-                if (stop_) {
-                    return;
+Background_Scheduler::Background_Scheduler(DiskManager* disk_manager, Metrics* metrics, size_t num_threads,
+    size_t queue_capacity, IOBackend backend):
+request_queue_(queue_capacity, ClassDelays()), disk_manager_(disk_manager), metrics_(metrics), backend_(backend),
+stop_syncer_(false) {
+    assert(num_threads > 0 && queue_capacity > 0);
+    syncer_thread_ = std::thread([this] { RunSyncer(); });
+    if (backend_ == IOBackend::IO_URING) {
+        ring_ = std::make_unique<IOUring>(IO_URING_DEPTH);
+        if (!ring_->IsOpen() || disk_manager_->GetFd() < 0) {
+            std::cerr << "[Background_Scheduler] io_uring is unavailable, using the thread pool!" << std::endl;
+            ring_.reset();
+            backend_ = IOBackend::THREAD_POOL;
+        }
+    }
+
+    if (backend_ == IOBackend::IO_URING) {
+        background_threads_.emplace_back([this] { RunRing(); });
+        return;
+    }
+    for (size_t i=0; i<num_threads; i++)
+        background_threads_.emplace_back([this] { RunWorker(); });
+}
+
+std::vector<uint64_t> Background_Scheduler::ClassDelays() {
+    std::vector<uint64_t> delays;
+    for (size_t c=0; c<NUM_IO_PRIORITIES; c++)
+        delays.push_back(c * IO_AGING_MS * 1000000ULL);
+    return delays;
+}
+
+Background_Scheduler::~Background_Scheduler() {
+    request_queue_.Close();
+    for (std::thread& thread : background_threads_)
+        thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(sync_latch_);
+        stop_syncer_ = true;
+    }
+    sync_cv_.notify_one();
+    syncer_thread_.join();
+}
+
+std::shared_future<bool> Background_Scheduler::SyncBarrier() {
+    if (metrics_ != nullptr)
+        metrics_->Add(Metric::SYNC_BARRIERS);
+    std::lock_guard<std::mutex> lock(sync_latch_);
+    if (!next_sync_.has_value()) {
+        next_sync_.emplace();
+        next_sync_future_ = next_sync_->get_future().share();
+        sync_cv_.notify_one();
+    }
+    return next_sync_future_;
+}
+
+void Background_Scheduler::RunSyncer() {
+    std::unique_lock<std::mutex> lock(sync_latch_);
+    while (true) {
+        sync_cv_.wait(lock, [this] { return stop_syncer_ || next_sync_.has_value(); });
+        if (!next_sync_.has_value())
+            return;
+
+        /* Barriers arriving from now on may follow writes this sync misses, so they start the next group. */
+        std::promise<bool> group = std::move(next_sync_.value());
+        next_sync_.reset();
+        lock.unlock();
+        if (metrics_ != nullptr)
+            metrics_->Add(Metric::SYNCS);
+        group.set_value(disk_manager_->Sync());
+        lock.lock();
+    }
+}
+
+void Background_Scheduler::RunWorker() {
+    /*
+     * Pop sleeps while there is nothing to do, and fails once the queue is closed and drained. Queued requests
+     * for the pages on either side of the batch, of the popped one's priority class and direction, are served
+     * along with it, so they can be merged into one I/O. Consecutive page ids of a size class are usually
+     * adjacent in the file, and ServeBatch merges only those that are. Requests for other pages stay queued for
+     * the other workers, and requests of other classes are never held up by a batch.
+     */
+    std::vector<std::shared_ptr<Request>> batch;
+    while (std::optional<std::shared_ptr<Request>> req = request_queue_.Pop()) {
+        batch.clear();
+        batch.push_back(std::move(req.value()));
+        bool read = batch[0]->read_;
+        size_t priority_class = static_cast<size_t>(batch[0]->priority_);
+        size_class_t size_class = GetPageSizeClass(batch[0]->page_id_);
+        page_id_t low = batch[0]->page_id_, high = batch[0]->page_id_;
+        while (batch.size() < IO_COALESCE_MAX_PAGES) {
+            std::optional<std::shared_ptr<Request>> more = request_queue_.TryPopIf(priority_class,
+                [&](const std::shared_ptr<Request>& r) {
+                    return r->read_ == read && GetPageSizeClass(r->page_id_) == size_class &&
+                        (r->page_id_ == low - 1 || r->page_id_ == high + 1);
+                });
+            if (!more.has_value())
+                break;
+            low = std::min(low, more.value()->page_id_);
+            high = std::max(high, more.value()->page_id_);
+            batch.push_back(std::move(more.value()));
+        }
+        if (batch.size() == 1)
+            Serve(*batch[0]);
+        else
+            ServeBatch(batch);
+    }
+}
+
+void Background_Scheduler::ServeBatch(const std::vector<std::shared_ptr<Request>>& batch) {
+    /* A batch is all reads or all writes, of one priority class. */
+    std::vector<page_id_t> page_ids;
+    std::vector<char*> read_data;
+    std::vector<const char*> write_data;
+    for (const std::shared_ptr<Request>& r : batch) {
+        page_ids.push_back(r->page_id_);
+        if (r->read_)
+            read_data.push_back(r->read_data_);
+        else
+            write_data.push_back(r->write_data_);
+    }
+
+    uint64_t start = metrics_ != nullptr ? Metrics::NowNs() : 0;
+    std::exception_ptr error;
+    size_t num_ios = batch.size();
+    try {
+        num_ios = batch[0]->read_ ? disk_manager_->ReadPages(page_ids, read_data) :
+            disk_manager_->WritePages(page_ids, write_data);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (metrics_ != nullptr && num_ios < batch.size())
+        metrics_->Add(Metric::COALESCED_PAGES, batch.size() - num_ios);
+
+    for (const std::shared_ptr<Request>& r : batch)
+        Complete(*r, error, start);
+}
+
+void Background_Scheduler::Serve(Request& r) {
+    /* Check if page_id is still valid as page could have been deleted. */
+    uint64_t start = metrics_ != nullptr ? Metrics::NowNs() : 0;
+    try {
+        if (r.read_) {
+            disk_manager_->ReadPage(r.page_id_, r.read_data_);
+        } else {
+            disk_manager_->WritePage(r.page_id_, r.write_data_);
+        }
+    } catch (...) {
+        Complete(r, std::current_exception(), start);
+        return;
+    }
+    Complete(r, nullptr, start);
+}
+
+void Background_Scheduler::Complete(Request& r, std::exception_ptr error, uint64_t start) {
+    if (error == nullptr && metrics_ != nullptr) {
+        metrics_->Record(r.read_ ? LatencyHistogram::DISK_READ : LatencyHistogram::DISK_WRITE,
+            Metrics::NowNs() - start);
+    }
+    if (r.promise_.has_value()) {
+        if (error == nullptr)
+            r.promise_->set_value(true);
+        else
+            r.promise_->set_exception(error);
+    }
+
+    /* The callback may free the request. */
+    std::function<void(bool)> on_complete = std::move(r.on_complete_);
+    if (on_complete)
+        on_complete(error == nullptr);
+}
+
+void Background_Scheduler::RunRing() {
+    /*
+     * A request handed to the kernel. A short read or write is resubmitted for the rest of the page.
+     * Requests for adjacent pages are merged into one vectored I/O, submitted by the first slot of the run.
+     */
+    struct InFlight {
+        std::shared_ptr<Request> req_;
+        PinnedPage pin_;  /* Keeps the page from being deleted, and its blocks reused, until the I/O is reaped. */
+        uint64_t offset_;
+        uint32_t len_;
+        uint32_t done_;
+        uint64_t start_;
+        std::vector<size_t> run_;  /* Slots merged into this slot's I/O, itself included. Empty if not merged. */
+        std::vector<iovec> iovs_;
+    };
+    std::vector<InFlight> slots(IO_URING_DEPTH);
+    std::vector<size_t> free_slots;
+    for (size_t i=IO_URING_DEPTH; i>0; i--)
+        free_slots.push_back(i - 1);
+    std::vector<size_t> to_submit;
+    std::vector<IOUring::Completion> completions(IO_URING_DEPTH);
+    int fd = disk_manager_->GetFd();
+
+    /* Pins the page's offset, as ReadPage/WritePage latch it, and takes a slot for the request. */
+    auto start_request = [&](std::shared_ptr<Request> req) {
+        uint64_t start = metrics_ != nullptr ? Metrics::NowNs() : 0;
+        std::optional<PinnedPage> pin = disk_manager_->PinPage(req->page_id_);
+        if (!pin.has_value()) {
+            /* A write finds no page if the page was deleted meanwhile. */
+            if (req->read_)
+                std::cerr << "[ReadPage] reading from unallocated page!" << std::endl;
+            Complete(*req, nullptr, start);
+            return;
+        }
+        size_t slot = free_slots.back();
+        free_slots.pop_back();
+        uint32_t len = ::GetPageSize(req->page_id_);
+        slots[slot].req_ = std::move(req);
+        slots[slot].offset_ = pin->GetOffset();
+        slots[slot].pin_ = std::move(pin.value());
+        slots[slot].len_ = len;
+        slots[slot].done_ = 0;
+        slots[slot].start_ = start;
+        to_submit.push_back(slot);
+    };
+
+    /* Sorts the slots to submit by direction and offset. Slots resubmitted after a short transfer are not merged. */
+    auto mergeable = [&](size_t prev, size_t next) {
+        const InFlight& p = slots[prev];
+        const InFlight& n = slots[next];
+        return p.done_ == 0 && n.done_ == 0 && p.req_->read_ == n.req_->read_ && p.offset_ + p.len_ == n.offset_;
+    };
+    auto by_offset = [&](size_t a, size_t b) {
+        if (slots[a].req_->read_ != slots[b].req_->read_)
+            return slots[a].req_->read_ < slots[b].req_->read_;
+        return slots[a].offset_ < slots[b].offset_;
+    };
+
+    size_t in_flight = 0;
+    while (true) {
+        /* Sleep on the queue only while the ring is idle. Otherwise sleep on the ring, below. */
+        std::optional<std::shared_ptr<Request>> first;
+        if (in_flight == 0 && to_submit.empty()) {
+            first = request_queue_.Pop();
+            if (!first.has_value())
+                break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(ring_latch_);
+            if (first.has_value())
+                start_request(std::move(first.value()));
+            while (!free_slots.empty()) {
+                std::optional<std::shared_ptr<Request>> req = request_queue_.TryPop();
+                if (!req.has_value())
+                    break;
+                start_request(std::move(req.value()));
+            }
+
+            std::sort(to_submit.begin(), to_submit.end(), by_offset);
+            for (size_t begin=0; begin<to_submit.size(); ) {
+                size_t end = begin + 1;
+                while (end < to_submit.size() && end - begin < IO_COALESCE_MAX_PAGES &&
+                    mergeable(to_submit[end - 1], to_submit[end]))
+                    end++;
+
+                /* There are as many submission entries as slots, so preparing never fails. */
+                size_t slot = to_submit[begin];
+                InFlight& f = slots[slot];
+                bool queued;
+                if (end - begin == 1) {
+                    const char* data = f.req_->read_ ? f.req_->read_data_ : f.req_->write_data_;
+                    int buf_index = FindRegisteredBuffer(data, f.len_);
+                    queued = f.req_->read_ ?
+                        ring_->PrepareRead(fd, f.req_->read_data_ + f.done_, f.len_ - f.done_, f.offset_ + f.done_,
+                            buf_index, slot) :
+                        ring_->PrepareWrite(fd, f.req_->write_data_ + f.done_, f.len_ - f.done_, f.offset_ + f.done_,
+                            buf_index, slot);
+                } else {
+                    f.run_.assign(to_submit.begin() + begin, to_submit.begin() + end);
+                    f.iovs_.clear();
+                    for (size_t member : f.run_) {
+                        Request& r = *slots[member].req_;
+                        f.iovs_.push_back(iovec{r.read_ ? r.read_data_ : const_cast<char*>(r.write_data_),
+                            slots[member].len_});
+                    }
+                    queued = f.req_->read_ ?
+                        ring_->PrepareReadv(fd, f.iovs_.data(), f.iovs_.size(), f.offset_, slot) :
+                        ring_->PrepareWritev(fd, f.iovs_.data(), f.iovs_.size(), f.offset_, slot);
+                    if (metrics_ != nullptr)
+                        metrics_->Add(Metric::COALESCED_PAGES, end - begin - 1);
                 }
-                if (request_queue_.empty())
-                    continue;
-
-                std::shared_ptr<Request> req = std::move(request_queue_.front());
-                request_queue_.pop();
-                Request& r = *req;
-                /* Check if page_id is still valid as page could have been deleted. */
-                try {
-                    if (r.read_) {
-                        disk_manager_->ReadPage(r.page_id_, r.read_data_);
-                    } else {
-                        disk_manager_->WritePage(r.page_id_, r.write_data_);
+                assert(queued);
+                (void)queued;
+                in_flight++;
+                begin = end;
+            }
+            to_submit.clear();
+
+            int ret;
+            while ((ret = ring_->Submit()) < 0) {
+                if (ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+                    std::cerr << "[RunRing] failed to submit: " << strerror(-ret) << std::endl;
+                    std::abort();
+                }
+                std::this_thread::yield();
+            }
+        }
+        if (in_flight == 0)
+            continue;
+
+        int ret = ring_->WaitCompletion();
+        if (ret < 0 && ret != -EINTR) {
+            std::cerr << "[RunRing] failed to wait for completions: " << strerror(-ret) << std::endl;
+            std::abort();
+        }
+        size_t n = ring_->PopCompletions(completions.data(), completions.size());
+        for (size_t i=0; i<n; i++) {
+            size_t slot = completions[i].user_data_;
+            int32_t res = completions[i].res_;
+            in_flight--;
+
+            /* Fan a merged I/O's result out to its slots, in file order. Each gets the bytes of its own page. */
+            std::vector<size_t> run = std::move(slots[slot].run_);
+            slots[slot].run_.clear();
+            if (run.empty())
+                run.push_back(slot);
+            uint32_t remaining = res > 0 ? res : 0;
+            for (size_t member : run) {
+                InFlight& f = slots[member];
+                std::exception_ptr error;
+                if (res < 0) {
+                    std::cerr << "[RunRing] " << (f.req_->read_ ? "read" : "write") << " of page " << f.req_->page_id_
+                        << " failed: " << strerror(-res) << std::endl;
+                    error = std::make_exception_ptr(std::runtime_error(strerror(-res)));
+                } else {
+                    uint32_t transferred = std::min(remaining, f.len_ - f.done_);
+                    remaining -= transferred;
+                    if (res > 0 && f.done_ + transferred < f.len_) {
+                        f.done_ += transferred;
+                        to_submit.push_back(member);
+                        continue;
                     }
-                    r.promise_.set_value(true);
-                } catch (...) {
-                    r.promise_.set_exception(std::current_exception());
+
+                    /* Should never happen: encounter EOF in middle of page. Fails like ReadPage does. */
+                    if (f.done_ + transferred < f.len_)
+                        error = std::make_exception_ptr(std::runtime_error("[RunRing] transferred less than a full page"));
                 }
+
+                /* Unpin first: the completion may delete the page. */
+                f.pin_.Release();
+                Complete(*f.req_, error, f.start_);
+                f.req_ = nullptr;
+                free_slots.push_back(member);
             }
-        });
+        }
     }
 }
 
-Background_Scheduler::~Background_Scheduler() {
-    stop_ = true;
-    for (int i=0; i<NUM_BACKGROUND_THREADS; i++) {
-        background_threads_[i].join();
+int Background_Scheduler::FindRegisteredBuffer(const char* data, size_t len) {
+    for (size_t i=0; i<registered_buffers_.size(); i++) {
+        const char* base = static_cast<const char*>(registered_buffers_[i].iov_base);
+        if (data >= base && data + len <= base + registered_buffers_[i].iov_len)
+            return i;
     }
+    return -1;
+}
+
+bool Background_Scheduler::RegisterBuffers(const std::vector<iovec>& buffers) {
+    if (backend_ != IOBackend::IO_URING)
+        return false;
+
+    std::lock_guard<std::mutex> lock(ring_latch_);
+    bool ok = ring_->RegisterBuffers(buffers);
+    registered_buffers_ = ok ? buffers : std::vector<iovec>();
+    return ok;
 }
 
 void Background_Scheduler::Schedule(std::shared_ptr<Request> req) {
-    request_queue_.push(std::move(req));
+    /* The ring thread only submits and reaps I/O. A write to a page not yet on disk allocates it here. */
+    if (backend_ == IOBackend::IO_URING && !req->read_ && !disk_manager_->CheckPageExists(req->page_id_))
+        disk_manager_->AllocatePage(req->page_id_);
+
+    /* Page table shards schedule requests concurrently. */
+    std::shared_ptr<Request> r = req;
+    if (request_queue_.Push(std::move(req), static_cast<size_t>(r->priority_), r->deadline_ns_))
+        return;
+
+    std::cerr << "[Schedule] scheduler is stopping!" << std::endl;
+    if (r->promise_.has_value())
+        r->promise_->set_exception(std::make_exception_ptr(std::runtime_error("scheduler is stopping")));
+    std::function<void(bool)> on_complete = std::move(r->on_complete_);
+    if (on_complete)
+        on_complete(false);
 }
 
 void Background_Scheduler::DeletePage(page_id_t page_id) {
@@ -51,4 +402,12 @@ void Background_Scheduler::DeletePage(page_id_t page_id) {
 
 bool Background_Scheduler::CheckPageExists(page_id_t page_id) {
     return disk_manager_->CheckPageExists(page_id);
-}
\ No newline at end of file
+}
+
+bool Background_Scheduler::AllocatePages(page_id_t first_page_id, size_t num_pages) {
+    return disk_manager_->AllocatePages(first_page_id, num_pages);
+}
+
+const char* Background_Scheduler::MapPage(page_id_t page_id) {
+    return disk_manager_->MapPage(page_id);
+}
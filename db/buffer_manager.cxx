@@ -9,249 +9,1042 @@
 #include <iostream>
 #include "page_guard.h"
 #include <cassert>
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
 
-Frame::Frame(frame_id_t frame_id): frame_id_(frame_id), dirty_(false), pincount_(0) {
-    data_ = new char[PAGE_SIZE];
-    std::memset(data_, 0, PAGE_SIZE);
+Frame::Frame(frame_id_t frame_id, size_class_t size_class, char* data, std::atomic<size_t>* num_dirty):
+frame_id_(frame_id), size_class_(size_class),
+num_dirty_(num_dirty), page_id_(INVALID_PAGE_ID), data_(data), state_(FrameState::READY), version_(0) {}
+
+void Frame::SetDirty(bool dirty) {
+    /* Writers set the dirty bit on every access, so avoid the read-modify-write when nothing changes. */
+    if (state_word_.IsDirty() == dirty || state_word_.SetDirty(dirty) == dirty)
+        return;
+    if (dirty)
+        num_dirty_->fetch_add(1);
+    else
+        num_dirty_->fetch_sub(1);
+}
+
+void Frame::FinishLoading() {
+    std::vector<std::function<void()>> waiters;
+    {
+        std::lock_guard<std::mutex> lock(state_latch_);
+        state_.store(FrameState::READY);
+        waiters.swap(load_waiters_);
+    }
+    state_cv_.notify_all();
+    for (std::function<void()>& waiter : waiters)
+        waiter();
+}
+
+void Frame::WaitUntilLoaded() {
+    /* Fast path for hits on resident pages. */
+    if (state_.load() == FrameState::READY)
+        return;
+
+    std::unique_lock<std::mutex> lock(state_latch_);
+    state_cv_.wait(lock, [this] { return state_.load() == FrameState::READY; });
+}
+
+bool Frame::WhenLoaded(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(state_latch_);
+    if (state_.load() == FrameState::READY)
+        return false;
+    load_waiters_.push_back(std::move(callback));
+    return true;
+}
+
+void Frame::BeginWrite() {
+    /* Make the version odd before any of the data changes. */
+    version_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Frame::EndWrite() {
+    version_.fetch_add(1, std::memory_order_release);
 }
 
-Frame::~Frame() {
-    delete[] data_;
+bool Frame::ValidateVersion(uint64_t version) {
+    /* Order the reader's data loads before the version check. */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == version;
 }
 
-BufferManager::BufferManager(size_t num_buffer_frames, DiskManager* disk_manager, size_t k)
-:background_scheduler_(std::make_shared<Background_Scheduler>(disk_manager)),
-lru_k_replacer_(std::make_shared<LRUKReplacer>(num_buffer_frames, k)),
-bpm_latch_(std::make_shared<std::mutex>()),
-next_page_id_(0) {
-    /* Allocate frames in buffer_. */
-    buffer_.reserve(num_buffer_frames);
-    for (int i=0; i<num_buffer_frames; i++) {
-        buffer_.emplace_back(std::make_shared<Frame>(i));
-        free_frames_.push_back(i);
+BufferManager::BufferManager(size_t num_buffer_frames, DiskManager* disk_manager, size_t k, size_t num_shards,
+    bool use_huge_pages, ReplacerType replacer_type, size_t num_io_threads, IOBackend io_backend)
+:BufferManager(std::vector<size_t>{num_buffer_frames}, disk_manager, k, num_shards, use_huge_pages, replacer_type,
+    num_io_threads, io_backend) {}
+
+BufferManager::BufferManager(const std::vector<size_t>& num_frames_per_class, DiskManager* disk_manager, size_t k,
+    size_t num_shards, bool use_huge_pages, ReplacerType replacer_type, size_t num_io_threads, IOBackend io_backend)
+:num_frames_(0),
+metrics_(std::make_shared<Metrics>()),
+shards_(num_shards),
+background_scheduler_(std::make_shared<Background_Scheduler>(disk_manager, metrics_.get(), num_io_threads,
+    IO_QUEUE_CAPACITY, io_backend)),
+num_dirty_(0), low_watermark_(FLUSHER_LOW_WATERMARK), high_watermark_(FLUSHER_HIGH_WATERMARK),
+stop_flusher_(false), flusher_hand_(0), io_pins_(0),
+readahead_streams_(READAHEAD_STREAMS), readahead_victim_(0), readahead_max_pages_(0) {
+    assert(num_shards > 0);
+    assert(num_frames_per_class.size() <= NUM_PAGE_SIZE_CLASSES);
+
+    for (size_class_t c=0; c<NUM_PAGE_SIZE_CLASSES; c++) {
+        /* Number new pages after those already in the database. */
+        next_page_ids_[c].store(disk_manager->GetNextPageId(c));
+        num_class_frames_[c].store(0);
+
+        /*
+         * Replacers are indexed by frame_id_t, so each one covers the whole pool but only sees frames of its class.
+         * Their capacity is the number of frames of the class.
+         */
+        replacers_.push_back(MakeReplacer(replacer_type, 0, k, this, metrics_.get()));
+    }
+
+    /*
+     * Reserve address space for the largest pool Resize may grow to, so frames never move and guards stay valid.
+     * Back all frames with one anonymous mapping, aligned to PAGE_SIZE (or HUGE_PAGE_SIZE so transparent huge
+     * pages can be used). The mapping is zero-filled, and memory is only committed when a frame is first touched.
+     * Every size class is a multiple of PAGE_SIZE, so all frames stay page aligned.
+     */
+    size_t alignment = use_huge_pages ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    arena_size_ = MAX_BUFFER_POOL_BYTES + alignment;
+    arena_base_ = mmap(nullptr, arena_size_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena_base_ == MAP_FAILED) {
+        std::cerr << "[BufferManager] failed to map frame arena!" << std::endl;
+        std::abort();
     }
+    uintptr_t base = reinterpret_cast<uintptr_t>(arena_base_);
+    arena_ = reinterpret_cast<char*>((base + alignment - 1) / alignment * alignment);
+    arena_used_ = 0;
+    if (use_huge_pages)
+        madvise(arena_, MAX_BUFFER_POOL_BYTES, MADV_HUGEPAGE);
+
+    /* Frame metadata lives in a dense array indexed by frame_id_t, reserved the same way. */
+    frames_size_ = (MAX_BUFFER_FRAMES * sizeof(Frame) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    void* frames = mmap(nullptr, frames_size_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (frames == MAP_FAILED) {
+        std::cerr << "[BufferManager] failed to map frame table!" << std::endl;
+        std::abort();
+    }
+    frames_ = static_cast<Frame*>(frames);
+
+    for (size_class_t c=0; c<num_frames_per_class.size(); c++) {
+        if (!AddFrames(c, num_frames_per_class[c])) {
+            std::cerr << "[BufferManager] buffer pool too large!" << std::endl;
+            std::abort();
+        }
+    }
+
+    flusher_thread_ = std::thread([this] { RunFlusher(); });
+}
+
+BufferManager::~BufferManager() {
+    {
+        std::lock_guard<std::mutex> lock(flusher_latch_);
+        stop_flusher_ = true;
+    }
+    flusher_cv_.notify_all();
+    flusher_thread_.join();
+
+    /* Prefetches may still be reading into the arena. */
+    WaitForIOPins();
+
+    for (size_t i=0; i<num_frames_.load(); i++)
+        frames_[i].~Frame();
+    munmap(frames_, frames_size_);
+    munmap(arena_base_, arena_size_);
 }
 
-/* 
- * Returns the frame_id corresponding to page_id. Also updates in-memory frame<->page and page<->frame mappings.
- * If required, it assigns a free frame to the page, and potentially evicts a different page in the process.
+/*
+ * Returns a frame that is not mapped to any page. The free list of the requesting shard is tried first,
+ * then the free lists of the other shards, and only then is a page evicted.
+ * Shard latches are taken one at a time, so no two shard latches are ever held together.
  */
-std::optional<frame_id_t> BufferManager::GetFreeFrame() {
+std::optional<frame_id_t> BufferManager::GetFreeFrame(PageTableShard& shard, size_class_t size_class) {
     /* If free frame exists, return it. */
-    std::optional<frame_id_t> frame_id_opt = std::nullopt;
-    if (!free_frames_.empty()) {
-        frame_id_opt = free_frames_.front();
-        free_frames_.pop_front();
-        return frame_id_opt;
-    } 
-    
-    /* If no free frames, try to evict a page. */
-    frame_id_opt = lru_k_replacer_->Evict();
-
-    /* If still no evictable frames, return nullopt. */
-    if (!frame_id_opt.has_value())
-        return frame_id_opt;
-    frame_id_t frame_id = frame_id_opt.value();
+    size_t start = &shard - shards_.data();
+    for (size_t i=0; i<shards_.size(); i++) {
+        PageTableShard& s = shards_[(start + i) % shards_.size()];
+        std::unique_lock<std::mutex> lock = LockShard(s);
+        std::list<frame_id_t>& free_frames = s.free_frames_[size_class];
+        if (!free_frames.empty()) {
+            frame_id_t frame_id = free_frames.front();
+            free_frames.pop_front();
+            return frame_id;
+        }
+    }
 
-    assert(buffer_[frame_id]->GetPinCount() == 0);
+    /* If no free frames, try to evict a page. Give up once the disk keeps failing the victims' write-backs. */
+    std::optional<frame_id_t> frame_id_opt;
+    size_t failed_writes = 0;
+    size_t max_failed_writes = std::min<size_t>(num_class_frames_[size_class].load(), EVICTION_WRITE_RETRIES);
+    while (true) {
+        frame_id_opt = replacers_[size_class]->Evict();
 
-    std::shared_ptr<Frame> frame = buffer_[frame_id];
-    page_id_t prev_page_id = reverse_page_table_[frame_id];
+        /*
+         * If still no evictable frames, return nullopt. Frames pinned for write-back or prefetch are only
+         * briefly unevictable, so wait for that I/O and retry rather than failing.
+         */
+        if (!frame_id_opt.has_value()) {
+            if (!WaitForIOPins())
+                return std::nullopt;
+            continue;
+        }
 
-    /* Flush previous page to disk if required. */
-    if (frame->GetDirty()) {
-        /* Schedules a flush. */
-        std::shared_ptr<Request> write_req = std::make_shared<Request>(false, prev_page_id, frame->GetData());
-        background_scheduler_->Schedule(write_req);
-        try {
-            write_req.get()->promise_.get_future().get();
-        } catch (const std::exception &e) {
-            std::cerr << "[GetFreeFrame] " << e.what();
+        frame_id_t frame_id = frame_id_opt.value();
+        Frame* frame = &frames_[frame_id];
+
+        /*
+         * The replacer claimed the frame, so it cannot be pinned, and no guard holds its page latch. Its page
+         * stays mapped until written back, and fetches of the page wait on the shard's loads_cv_ meanwhile.
+         * If the page is dirty, the flusher fell behind, so wake it up.
+         */
+        page_id_t prev_page_id = frame->GetPageId();
+        PageTableShard& victim_shard = GetShard(prev_page_id);
+        bool dirty = frame->GetDirty();
+        if (dirty) {
+            metrics_->Add(Metric::SYNC_FLUSHES);
+            flusher_cv_.notify_one();
+
+            uint64_t start = Metrics::NowNs();
+            bool written = WriteBack(frame, prev_page_id, IOPriority::EVICTION_WRITE);
+            metrics_->Add(Metric::SYNC_FLUSH_WAIT_NS, Metrics::NowNs() - start);
+
+            /* The write failed. Give the frame back, as recently used so other victims are tried first. */
+            if (!written) {
+                {
+                    std::unique_lock<std::mutex> lock = LockShard(victim_shard);
+                    frame->GetStateWord().Unclaim();
+                    GetReplacer(frame_id).RecordAccess(frame_id, prev_page_id, AccessHint::POINT);
+                }
+                victim_shard.loads_cv_.notify_all();
+                if (++failed_writes >= max_failed_writes)
+                    return std::nullopt;
+                continue;
+            }
+        }
+
+        /* Reset frame state. Optimistic readers of the old page see the version change. */
+        {
+            std::unique_lock<std::mutex> lock = LockShard(victim_shard);
+            frame->BeginWrite();
+            char* data = frame->GetDataMut();
+            std::memset(data, 0, frame->GetPageSize());
+            victim_shard.page_table_.erase(prev_page_id);
+            frame->SetPageId(INVALID_PAGE_ID);
+            frame->EndWrite();
         }
-        frame->SetDirty(false);
+        victim_shard.loads_cv_.notify_all();
+
+        metrics_->Add(dirty ? Metric::DIRTY_EVICTIONS : Metric::CLEAN_EVICTIONS);
+        return frame_id;
     }
+}
 
-    /* Reset frame state. */
-    char* data = frame->GetDataMut();
-    std::memset(data, 0, PAGE_SIZE);
-    page_table_.erase(prev_page_id);
-    reverse_page_table_.erase(frame_id);
+bool BufferManager::PinForIO(frame_id_t frame_id) {
+    /* Write-back and prefetch are not accesses, and must not keep pages in the pool. */
+    if (!frames_[frame_id].TryPin(false))
+        return false;
+    AddIOPin();
+    return true;
+}
 
-    return frame_id_opt;
+void BufferManager::AddIOPin() {
+    std::lock_guard<std::mutex> lock(io_pins_latch_);
+    io_pins_++;
 }
 
-page_id_t BufferManager::NewPage() {
-    bpm_latch_->lock();
-    std::optional<frame_id_t> frame_id_opt = GetFreeFrame();
-    if (!frame_id_opt.has_value()) {
-        bpm_latch_->unlock();
-        return INVALID_PAGE_ID;
-    }
-    frame_id_t frame_id = frame_id_opt.value();
-    
-    /* Set page dirty. Page will be flushed if required. */
-    buffer_[frame_id]->SetDirty(true);
+void BufferManager::UnpinForIO(frame_id_t frame_id) {
+    frames_[frame_id].Unpin();
 
-    /* Map assigned frame to page. */
-    page_table_[next_page_id_] = frame_id;
-    reverse_page_table_[frame_id] = next_page_id_;
+    /* Notify under the latch: once io_pins_ drops to 0, the destructor may tear down the buffer manager. */
+    std::lock_guard<std::mutex> lock(io_pins_latch_);
+    io_pins_--;
+    io_pins_cv_.notify_all();
+}
 
-    next_page_id_++;
-    bpm_latch_->unlock();
-    return next_page_id_-1;
+bool BufferManager::WaitForIOPins() {
+    std::unique_lock<std::mutex> lock(io_pins_latch_);
+    if (io_pins_ == 0)
+        return false;
+    io_pins_cv_.wait(lock, [this] { return io_pins_ == 0; });
+    return true;
 }
 
-/* Disk manager simply invalidates page_id so that future (racy) read/writes throw error. */
-bool BufferManager::DeletePage(page_id_t page_id) {
-    bpm_latch_->lock();
+bool BufferManager::WriteBack(Frame* frame, page_id_t page_id, IOPriority priority) {
+    /*
+     * Hold off writers while the page is written. Anyone dirtying it afterwards sets the dirty bit again.
+     * If a writer got to the page first, leave it be: the caller may hold page latches the writer is waiting for.
+     */
+    std::shared_lock<std::shared_mutex> rlock(frame->GetMutex(), std::try_to_lock);
+    if (!rlock.owns_lock())
+        return false;
+    return FinishWriteBack(frame, StartWriteBack(frame, page_id, priority));
+}
 
-    frame_id_t frame_id = page_table_[page_id];
-    std::shared_ptr<Frame> frame = buffer_[frame_id];
+std::shared_ptr<Request> BufferManager::StartWriteBack(Frame* frame, page_id_t page_id, IOPriority priority) {
+    std::shared_ptr<Request> write_req = std::make_shared<Request>(false, page_id, frame->GetData(), priority);
+    background_scheduler_->Schedule(write_req);
+    return write_req;
+}
 
-    if (frame->GetPinCount() > 0) {
-        bpm_latch_->unlock();
+bool BufferManager::FinishWriteBack(Frame* frame, const std::shared_ptr<Request>& write_req) {
+    /* Until the write completes, the page stays dirty: a checkpoint seeing it clean must find it written. */
+    try {
+        write_req.get()->promise_->get_future().get();
+    } catch (const std::exception &e) {
+        std::cerr << "[WriteBack] " << e.what() << std::endl;
         return false;
     }
-
-    /* No need to flush. We simply reset frame state. */
     frame->SetDirty(false);
-    char* data = frame->GetDataMut();
-    std::memset(data, 0, PAGE_SIZE);
+    return true;
+}
 
-    page_table_.erase(page_id);
-    reverse_page_table_.erase(frame_id);
-    free_frames_.push_back(frame_id);
+void BufferManager::RunFlusher() {
+    std::unique_lock<std::mutex> lock(flusher_latch_);
+    while (!stop_flusher_) {
+        flusher_cv_.wait_for(lock, std::chrono::milliseconds(FLUSHER_INTERVAL_MS));
+        size_t num_frames = GetNumFrames();
+        if (stop_flusher_ || num_dirty_.load() <= high_watermark_.load() * num_frames)
+            continue;
+        lock.unlock();
 
-    lru_k_replacer_->Remove(frame_id);
+        /* Sweep the frames like a clock hand, so successive rounds spread writes over the whole pool. */
+        size_t target = low_watermark_.load() * num_frames;
+        size_t num_frame_ids = num_frames_.load();
+        for (size_t i=0; i<num_frame_ids && num_dirty_.load() > target; i++) {
+            flusher_hand_ = flusher_hand_ % num_frame_ids;
+            FlushInBackground(flusher_hand_);
+            flusher_hand_ = (flusher_hand_ + 1) % num_frame_ids;
+        }
 
-    background_scheduler_->DeletePage(page_id);
+        lock.lock();
+    }
+}
 
-    bpm_latch_->unlock();
-    return true;
+bool BufferManager::FlushInBackground(frame_id_t frame_id) {
+    /* Only unpinned pages are flushed. Pinned pages are in use, and likely to be dirtied again. */
+    Frame* frame = &frames_[frame_id];
+    page_id_t page_id = frame->GetPageId();
+    if (page_id == INVALID_PAGE_ID || frame->GetPinCount() > 0 || !frame->GetDirty())
+        return false;
+
+    /* Our pin keeps the frame from being evicted. It may have been remapped before we took it, so check the page. */
+    if (!PinForIO(frame_id))
+        return false;
+    bool flushed = frame->GetPageId() == page_id && frame->GetDirty();
+    if (flushed && WriteBack(frame, page_id, IOPriority::BACKGROUND_FLUSH))
+        metrics_->Add(Metric::BACKGROUND_FLUSHES);
+    UnpinForIO(frame_id);
+    return flushed;
 }
 
-std::optional<GuardedPageReader> BufferManager::GetGuardedPageReaderNoCheck(page_id_t page_id) {
-    bpm_latch_->lock();
+std::shared_future<bool> BufferManager::Checkpoint() {
+    /*
+     * Start the write-backs of all dirty pages at once, latching only frames whose latch is free, so we never
+     * wait for a latch while holding another. Frames being written to, or evicted, are retried one at a time.
+     */
+    struct PendingWrite {
+        frame_id_t frame_id_;
+        std::shared_lock<std::shared_mutex> lock_;
+        std::shared_ptr<Request> req_;
+    };
+    std::vector<PendingWrite> writes;
+    std::vector<std::pair<frame_id_t, page_id_t>> retry;
+    size_t num_frame_ids = num_frames_.load();
+    for (size_t frame_id=0; frame_id<num_frame_ids; frame_id++) {
+        Frame* frame = &frames_[frame_id];
+        page_id_t page_id = frame->GetPageId();
+        if (page_id == INVALID_PAGE_ID || !frame->GetDirty())
+            continue;
+        if (!PinForIO(frame_id)) {
+            retry.emplace_back(frame_id, page_id);
+            continue;
+        }
+        std::shared_lock<std::shared_mutex> rlock(frame->GetMutex(), std::try_to_lock);
+        if (!rlock.owns_lock()) {
+            UnpinForIO(frame_id);
+            retry.emplace_back(frame_id, page_id);
+            continue;
+        }
+        page_id = frame->GetPageId();
+        if (!frame->GetDirty()) {
+            rlock.unlock();
+            UnpinForIO(frame_id);
+            continue;
+        }
+        std::shared_ptr<Request> req = StartWriteBack(frame, page_id, IOPriority::BACKGROUND_FLUSH);
+        writes.push_back(PendingWrite{frame_id_t(frame_id), std::move(rlock), std::move(req)});
+    }
 
-    /* If page not in memory and not on disk i.e. INVALID_PAGE_ID, return nullopt. */
-    if ((page_table_.find(page_id) == page_table_.end()) && (!background_scheduler_->CheckPageExists(page_id))) {
-        bpm_latch_->unlock();
-        return std::nullopt;
+    bool ok = true;
+    for (PendingWrite& write : writes) {
+        ok &= FinishWriteBack(&frames_[write.frame_id_], write.req_);
+        write.lock_.unlock();
+        UnpinForIO(write.frame_id_);
     }
 
-    /* If page already in memory, a frame is already assigned. */
-    frame_id_t frame_id;
-    if ((page_table_.find(page_id) != page_table_.end())) {
-        frame_id = page_table_[page_id];
-        auto guard = GuardedPageReader{
-            page_id, buffer_[frame_id], bpm_latch_, 
-            lru_k_replacer_, background_scheduler_ 
-        };
-        bpm_latch_->unlock();
-        return std::optional<GuardedPageReader>(std::move(guard));
+    /*
+     * A frame claimed for eviction is written back by the evicting thread, and remapped only once its page is
+     * on disk. If that write fails, the frame is given back and we can pin it and write the page ourselves.
+     * A frame latched by a writer is retried once the writer is done. We never wait for its latch holding an
+     * I/O pin: the writer may be waiting for I/O pins itself, to evict a page.
+     */
+    while (!retry.empty()) {
+        std::vector<std::pair<frame_id_t, page_id_t>> remaining;
+        for (auto [frame_id, page_id] : retry) {
+            Frame* frame = &frames_[frame_id];
+            if (frame->GetPageId() != page_id || !frame->GetDirty())
+                continue;
+            if (!PinForIO(frame_id)) {
+                remaining.emplace_back(frame_id, page_id);
+                continue;
+            }
+            {
+                std::shared_lock<std::shared_mutex> rlock(frame->GetMutex(), std::try_to_lock);
+                if (!rlock.owns_lock())
+                    remaining.emplace_back(frame_id, page_id);
+                else if (frame->GetPageId() == page_id && frame->GetDirty())
+                    ok &= FinishWriteBack(frame, StartWriteBack(frame, page_id, IOPriority::BACKGROUND_FLUSH));
+            }
+            UnpinForIO(frame_id);
+        }
+        retry.swap(remaining);
+        if (!retry.empty())
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    if (!ok) {
+        std::promise<bool> failed;
+        failed.set_value(false);
+        return failed.get_future().share();
     }
+    return background_scheduler_->SyncBarrier();
+}
 
-    /* If page is on disk, but not in memory. */
-    std::optional<frame_id_t> frame_id_opt = GetFreeFrame();
+std::optional<frame_id_t> BufferManager::LoadFrame(PageTableShard& shard, page_id_t page_id, bool io_pin,
+    AccessHint hint) {
+    std::optional<frame_id_t> frame_id_opt = GetFreeFrame(shard, GetPageSizeClass(page_id));
+
+    std::unique_lock<std::mutex> lock = LockShard(shard);
     if (!frame_id_opt.has_value()) {
-        bpm_latch_->unlock();
+        shard.page_table_.erase(page_id);
+        lock.unlock();
+        shard.loads_cv_.notify_all();
         return std::nullopt;
     }
-    frame_id = frame_id_opt.value();
+    frame_id_t frame_id = frame_id_opt.value();
 
-    /* Map assigned frame to page. */
-    page_table_[page_id] = frame_id;
-    reverse_page_table_[frame_id] = page_id;
+    /* Map assigned frame to page, and publish it as LOADING. */
+    Frame* frame = &frames_[frame_id];
+    frame->BeginLoading();
+    shard.page_table_[page_id] = frame_id;
+    frame->SetPageId(page_id);
+    frame->GetStateWord().Publish(1);
+    if (io_pin)
+        AddIOPin();
+    GetReplacer(frame_id).RecordAccess(frame_id, page_id, io_pin ? AccessHint::SCAN : hint);
+    lock.unlock();
+    shard.loads_cv_.notify_all();
+    return frame_id;
+}
 
-    /* Read the page into frame. */
-    std::shared_ptr<Request> read_req = std::make_shared<Request>(true, page_id, buffer_[frame_id]->GetDataMut());
+void BufferManager::FailLoad(frame_id_t frame_id, page_id_t page_id, bool io_pin) {
+    Frame* frame = &frames_[frame_id];
+    PageTableShard& shard = GetShard(page_id);
+    {
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        frame->BeginWrite();
+        std::memset(frame->GetDataMut(), 0, frame->GetPageSize());
+        shard.page_table_.erase(page_id);
+        frame->SetPageId(INVALID_PAGE_ID);
+        frame->EndWrite();
+    }
+    shard.loads_cv_.notify_all();
+    frame->FinishLoading();
+    if (io_pin)
+        UnpinForIO(frame_id);
+    else
+        frame->Unpin();
+
+    /* Waiters still holding a pin leave the frame to eviction. */
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    if (frame->GetStateWord().TryClaim()) {
+        GetReplacer(frame_id).Remove(frame_id);
+        shard.free_frames_[frame->GetSizeClass()].push_back(frame_id);
+    }
+}
+
+std::optional<std::pair<frame_id_t, bool>> BufferManager::PinOrLoadFrame(page_id_t page_id, AccessHint hint) {
+    PageTableShard& shard = GetShard(page_id);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+
+    /*
+     * If page already in memory (or being loaded), a frame is already assigned. A hit is a single CAS on the
+     * frame's state word. Point accesses set its reference bit, which the replacer reads when it next evicts.
+     */
+    auto it = shard.page_table_.find(page_id);
+    while (it != shard.page_table_.end()) {
+        frame_id_t frame_id = it->second;
+        if (frame_id != INVALID_FRAME_ID && frames_[frame_id].TryPin(hint == AccessHint::POINT)) {
+            lock.unlock();
+            metrics_->Add(Metric::HITS);
+            if (readahead_max_pages_.load() > 0)
+                Readahead(page_id, false);
+            return std::make_pair(frame_id, false);
+        }
+
+        /* Another thread is looking for a frame to load the page into, or evicting the page. */
+        shard.loads_cv_.wait(lock);
+        it = shard.page_table_.find(page_id);
+    }
+
+    /* If page not in memory and not on disk i.e. INVALID_PAGE_ID, return nullopt. */
+    if (!background_scheduler_->CheckPageExists(page_id))
+        return std::nullopt;
+
+    /* If page is on disk, but not in memory. Claim the load, so concurrent fetches wait for us. */
+    shard.page_table_[page_id] = INVALID_FRAME_ID;
+    lock.unlock();
+    metrics_->Add(Metric::MISSES);
+
+    std::optional<frame_id_t> frame_id_opt = LoadFrame(shard, page_id, false, hint);
+    if (!frame_id_opt.has_value())
+        return std::nullopt;
+    if (readahead_max_pages_.load() > 0)
+        Readahead(page_id, true);
+    return std::make_pair(frame_id_opt.value(), true);
+}
+
+std::optional<frame_id_t> BufferManager::FetchFrame(page_id_t page_id, AccessHint hint) {
+    std::optional<std::pair<frame_id_t, bool>> pinned = PinOrLoadFrame(page_id, hint);
+    if (!pinned.has_value())
+        return std::nullopt;
+    auto [frame_id, must_read] = pinned.value();
+    Frame* frame = &frames_[frame_id];
+    if (!must_read) {
+        frame->WaitUntilLoaded();
+
+        /* The read failed, and the page was unmapped. */
+        if (frame->GetPageId() != page_id) {
+            frame->Unpin();
+            return std::nullopt;
+        }
+        return frame_id;
+    }
+
+    /* Read the page into frame. Our pin keeps the frame from being evicted during the read. */
+    std::shared_ptr<Request> read_req = std::make_shared<Request>(true, page_id, frame->GetDataMut());
     background_scheduler_->Schedule(read_req);
     try {
-        read_req.get()->promise_.get_future().get();
+        read_req.get()->promise_->get_future().get();
     } catch (const std::exception &e) {
-        std::cerr << "[GetGuardedPageReader] " << e.what();
+        std::cerr << "[FetchFrame] " << e.what() << std::endl;
+        FailLoad(frame_id, page_id, false);
+        return std::nullopt;
     }
 
-    /* Note: guard constructor increments pincount, which implies page_id must be valid henceforth. */
-    GuardedPageReader guard{
-        page_id, buffer_[frame_id], bpm_latch_,
-        lru_k_replacer_, background_scheduler_ 
+    frame->FinishLoading();
+    return frame_id;
+}
+
+PageReadAwaitable BufferManager::FetchRead(page_id_t page_id, Executor& executor, AccessHint hint) {
+    return PageReadAwaitable(this, page_id, &executor, hint);
+}
+
+void BufferManager::Prefetch(const std::vector<page_id_t>& page_ids) {
+    for (page_id_t page_id : page_ids) {
+        PageTableShard& shard = GetShard(page_id);
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+
+        /* Skip pages that are resident, being loaded, or not on disk. */
+        if (shard.page_table_.find(page_id) != shard.page_table_.end())
+            continue;
+        if (!background_scheduler_->CheckPageExists(page_id))
+            continue;
+
+        shard.page_table_[page_id] = INVALID_FRAME_ID;
+        lock.unlock();
+
+        /* The load's pin is an I/O pin, and is released by the I/O worker once the read completes. */
+        std::optional<frame_id_t> frame_id_opt = LoadFrame(shard, page_id, true, AccessHint::POINT);
+        if (!frame_id_opt.has_value())
+            return;
+        frame_id_t frame_id = frame_id_opt.value();
+        Frame* frame = &frames_[frame_id];
+
+        std::shared_ptr<Request> read_req = std::make_shared<Request>(true, page_id, frame->GetDataMut(),
+            IOPriority::PREFETCH);
+        read_req->on_complete_ = [this, frame, frame_id, page_id](bool ok) {
+            if (!ok) {
+                std::cerr << "[Prefetch] failed to read page " << page_id << "!" << std::endl;
+                FailLoad(frame_id, page_id, true);
+                return;
+            }
+            frame->FinishLoading();
+            metrics_->Add(Metric::PREFETCHES);
+            UnpinForIO(frame_id);
+        };
+        background_scheduler_->Schedule(read_req);
+    }
+}
+
+void BufferManager::Readahead(page_id_t page_id, bool miss) {
+    auto continues = [page_id](const ReadaheadStream& s) {
+        return s.next_page_id_.load(std::memory_order_relaxed) == page_id;
     };
 
-    bpm_latch_->unlock();
-    return std::optional<GuardedPageReader>(std::move(guard));
+    /* Hits on resident pages that continue no stream leave the table untouched, and never take the latch. */
+    if (!miss && std::none_of(readahead_streams_.begin(), readahead_streams_.end(), continues))
+        return;
+
+    std::vector<page_id_t> page_ids;
+    {
+        std::lock_guard<std::mutex> lock(readahead_latch_);
+        auto stream = std::find_if(readahead_streams_.begin(), readahead_streams_.end(), continues);
+
+        /* Not the continuation of a known stream. A miss starts tracking a new one in place of the oldest. */
+        if (stream == readahead_streams_.end()) {
+            if (!miss)
+                return;
+            ReadaheadStream& victim = readahead_streams_[readahead_victim_];
+            victim.next_page_id_.store(page_id + 1, std::memory_order_relaxed);
+            victim.prefetched_until_ = page_id + 1;
+            victim.window_ = READAHEAD_MIN_PAGES;
+            readahead_victim_ = (readahead_victim_ + 1) % readahead_streams_.size();
+            return;
+        }
+
+        /* Sequential access. Once the consumer is within half a window of the readahead, double the window and read ahead. */
+        stream->next_page_id_.store(page_id + 1, std::memory_order_relaxed);
+        if (page_id + static_cast<page_id_t>(stream->window_ / 2) < stream->prefetched_until_)
+            return;
+        page_id_t from = std::max(stream->prefetched_until_, page_id + 1);
+        page_id_t until = page_id + 1 + static_cast<page_id_t>(stream->window_);
+        for (page_id_t p=from; p<until; p++)
+            page_ids.push_back(p);
+        stream->prefetched_until_ = until;
+        stream->window_ = std::min(stream->window_ * 2, readahead_max_pages_.load());
+    }
+    Prefetch(page_ids);
 }
 
-GuardedPageReader BufferManager::GetGuardedPageReader(page_id_t page_id) {
-    std::optional<GuardedPageReader> read_guard_opt = GetGuardedPageReaderNoCheck(page_id);
+page_id_t BufferManager::NewPage(size_class_t size_class, AccessHint hint) {
+    assert(size_class < NUM_PAGE_SIZE_CLASSES);
+    page_id_t page_id = next_page_ids_[size_class].fetch_add(1);
+    PageTableShard& shard = GetShard(page_id);
+
+    std::optional<frame_id_t> frame_id_opt = GetFreeFrame(shard, size_class);
+    if (!frame_id_opt.has_value())
+        return INVALID_PAGE_ID;
+    frame_id_t frame_id = frame_id_opt.value();
+
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+
+    /* Set page dirty. Page will be flushed if required. */
+    Frame* frame = &frames_[frame_id];
+    frame->SetDirty(true);
+
+    /* Map assigned frame to page. Creating the page counts as its first access. The page is unpinned, so it may be evicted. */
+    shard.page_table_[page_id] = frame_id;
+    frame->SetPageId(page_id);
+    frame->GetStateWord().Publish(0);
+    GetReplacer(frame_id).RecordAccess(frame_id, page_id, hint);
+
+    return page_id;
+}
+
+page_id_t BufferManager::NewPages(size_t num_pages, size_class_t size_class) {
+    assert(size_class < NUM_PAGE_SIZE_CLASSES);
+    assert(num_pages > 0);
+
+    /* The ids, and the next id after them, must stay within the size class's bits. */
+    constexpr uint32_t class_pages = uint32_t(1) << PAGE_SIZE_CLASS_SHIFT;
+    page_id_t first_page_id = next_page_ids_[size_class].load();
+    do {
+        uint32_t n = static_cast<uint32_t>(first_page_id) & (class_pages - 1);
+        if (num_pages >= class_pages - n)
+            return INVALID_PAGE_ID;
+    } while (!next_page_ids_[size_class].compare_exchange_weak(first_page_id, first_page_id + num_pages));
+
+    if (!background_scheduler_->AllocatePages(first_page_id, num_pages))
+        return INVALID_PAGE_ID;
+    return first_page_id;
+}
+
+const char* BufferManager::MapPage(page_id_t page_id) {
+    const char* data = background_scheduler_->MapPage(page_id);
+    if (data != nullptr)
+        metrics_->Add(Metric::MAPPED_READS);
+    return data;
+}
+
+/* Disk manager simply invalidates page_id so that future (racy) read/writes throw error. */
+bool BufferManager::DeletePage(page_id_t page_id) {
+    PageTableShard& shard = GetShard(page_id);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+
+    auto it = shard.page_table_.find(page_id);
+    while (it != shard.page_table_.end()) {
+        /* Page is being loaded by another thread. */
+        frame_id_t frame_id = it->second;
+        if (frame_id == INVALID_FRAME_ID)
+            return false;
+
+        /* Claiming the frame keeps anyone from pinning it again. */
+        Frame* frame = &frames_[frame_id];
+        if (frame->GetStateWord().TryClaim()) {
+            /* No need to flush. We simply reset frame state. */
+            frame->SetDirty(false);
+            frame->BeginWrite();
+            char* data = frame->GetDataMut();
+            std::memset(data, 0, frame->GetPageSize());
+
+            shard.page_table_.erase(it);
+            frame->SetPageId(INVALID_PAGE_ID);
+            frame->EndWrite();
+
+            /* Untrack the frame before another thread can take it off the free list. */
+            GetReplacer(frame_id).Remove(frame_id);
+            shard.free_frames_[frame->GetSizeClass()].push_back(frame_id);
+            break;
+        }
+
+        /* The pin may be held for write-back or prefetch. Wait for that I/O, then try again. */
+        if (frame->GetPinCount() > 0) {
+            lock.unlock();
+            if (!WaitForIOPins())
+                return false;
+            return DeletePage(page_id);
+        }
+
+        /* The page is being evicted. Wait until it is unmapped, or given back if its write-back failed. */
+        shard.loads_cv_.wait(lock);
+        it = shard.page_table_.find(page_id);
+    }
+
+    background_scheduler_->DeletePage(page_id);
+    return true;
+}
+
+std::optional<GuardedPageReader> BufferManager::GetGuardedPageReaderNoCheck(page_id_t page_id, AccessHint hint) {
+    std::optional<frame_id_t> frame_id_opt = FetchFrame(page_id, hint);
+    if (!frame_id_opt.has_value())
+        return std::nullopt;
+
+    /* Note: frame is pinned by FetchFrame, and the guard takes over the pin. */
+    return std::optional<GuardedPageReader>(GuardedPageReader{
+        page_id, &frames_[frame_id_opt.value()], background_scheduler_
+    });
+}
+
+GuardedPageReader BufferManager::GetGuardedPageReader(page_id_t page_id, AccessHint hint) {
+    std::optional<GuardedPageReader> read_guard_opt = GetGuardedPageReaderNoCheck(page_id, hint);
     assert(read_guard_opt.has_value());
     return std::move(read_guard_opt.value());
 }
 
-std::optional<GuardedPageWriter> BufferManager::GetGuardedPageWriterNoCheck(page_id_t page_id) {
-    bpm_latch_->lock();
+std::optional<GuardedPageReaderSet> BufferManager::GetGuardedPageReadersNoCheck(const std::vector<page_id_t>& page_ids,
+    AccessHint hint) {
+    size_t n = page_ids.size();
+    std::vector<Frame*> frames(n, nullptr);
+    std::vector<size_t> misses;    /* Pages we claimed and must load. */
+    std::vector<size_t> contended; /* Pages another thread is finding a frame for. */
+    bool failed = false;
 
-    /* If page not in memory and not on disk, return nullopt. */
-    if ((page_table_.find(page_id) == page_table_.end()) && (!background_scheduler_->CheckPageExists(page_id))) {
-        bpm_latch_->unlock();
-        return std::nullopt;
+    /* Pass 1: visit each shard once. Pin the hits, and claim the misses. */
+    std::vector<std::vector<size_t>> by_shard(shards_.size());
+    for (size_t i=0; i<n; i++) {
+        PageTableShard& shard = GetShard(page_ids[i]);
+        by_shard[&shard - shards_.data()].push_back(i);
+    }
+    for (size_t s=0; s<shards_.size() && !failed; s++) {
+        if (by_shard[s].empty())
+            continue;
+        PageTableShard& shard = shards_[s];
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        for (size_t i : by_shard[s]) {
+            auto it = shard.page_table_.find(page_ids[i]);
+            if (it != shard.page_table_.end() && it->second != INVALID_FRAME_ID &&
+                frames_[it->second].TryPin(hint == AccessHint::POINT)) {
+                frames[i] = &frames_[it->second];
+                metrics_->Add(Metric::HITS);
+            } else if (it != shard.page_table_.end()) {
+                contended.push_back(i);
+            } else if (background_scheduler_->CheckPageExists(page_ids[i])) {
+                shard.page_table_[page_ids[i]] = INVALID_FRAME_ID;
+                misses.push_back(i);
+                metrics_->Add(Metric::MISSES);
+            } else {
+                failed = true;
+            }
+        }
     }
 
-    /* If page already in memory, a frame is already assigned. */
-    frame_id_t frame_id;
-    if ((page_table_.find(page_id) != page_table_.end())) {
-        frame_id = page_table_[page_id];
-        bpm_latch_->unlock();
-        auto guard = GuardedPageWriter{
-            page_id, buffer_[frame_id], bpm_latch_, 
-            lru_k_replacer_, background_scheduler_ 
-        };
-        return std::optional<GuardedPageWriter>(std::move(guard));
+    /* Pass 2: assign frames to all misses, then issue their reads together and wait for them together. */
+    std::vector<std::pair<size_t, std::shared_ptr<Request>>> reads;
+    for (size_t i : misses) {
+        PageTableShard& shard = GetShard(page_ids[i]);
+        if (failed) {
+            std::unique_lock<std::mutex> lock = LockShard(shard);
+            shard.page_table_.erase(page_ids[i]);
+            shard.loads_cv_.notify_all();
+            continue;
+        }
+        std::optional<frame_id_t> frame_id_opt = LoadFrame(shard, page_ids[i], false, hint);
+        if (!frame_id_opt.has_value()) {
+            failed = true; /* LoadFrame has released the claim. */
+            continue;
+        }
+        frames[i] = &frames_[frame_id_opt.value()];
+        reads.emplace_back(i, std::make_shared<Request>(true, page_ids[i], frames[i]->GetDataMut()));
+        background_scheduler_->Schedule(reads.back().second);
+    }
+    for (auto& [i, read_req] : reads) {
+        try {
+            read_req->promise_->get_future().get();
+        } catch (const std::exception &e) {
+            std::cerr << "[GetGuardedPageReaders] " << e.what() << std::endl;
+            FailLoad(frames[i]->GetFrameId(), page_ids[i], false);
+            frames[i] = nullptr;
+            failed = true;
+            continue;
+        }
+        frames[i]->FinishLoading();
     }
 
-    /* If page is on disk, but not in memory. */
-    std::optional<frame_id_t> frame_id_opt = GetFreeFrame();
-    if (!frame_id_opt.has_value()) {
-        bpm_latch_->unlock();
-        return std::nullopt;
+    /* Pass 3: pages that were being loaded or evicted by someone else take the single page path. */
+    for (size_t i : contended) {
+        std::optional<frame_id_t> frame_id_opt = failed ? std::nullopt : FetchFrame(page_ids[i], hint);
+        if (!frame_id_opt.has_value()) {
+            failed = true;
+            continue;
+        }
+        frames[i] = &frames_[frame_id_opt.value()];
     }
-    frame_id = frame_id_opt.value();
 
-    /* Map assigned frame to page. */
-    page_table_[page_id] = frame_id;
-    reverse_page_table_[frame_id] = page_id;
+    /* Wait for the reads of other threads. A page whose read failed is no longer held by its frame. */
+    for (size_t i=0; i<n && !failed; i++) {
+        frames[i]->WaitUntilLoaded();
+        failed = frames[i]->GetPageId() != page_ids[i];
+    }
 
-    /* Read the page into frame. */
-    std::shared_ptr<Request> read_req = std::make_shared<Request>(true, page_id, buffer_[frame_id]->GetDataMut());
-    background_scheduler_->Schedule(read_req);
-    try {
-        read_req.get()->promise_.get_future().get();
-    }  catch (const std::exception &e) {
-        std::cerr << "[GetGuardedPageWriter] " << e.what();
+    /* Back out: release every pin we took. */
+    if (failed) {
+        std::vector<Frame*> pinned_frames;
+        for (size_t i=0; i<n; i++) {
+            if (frames[i] != nullptr)
+                pinned_frames.push_back(frames[i]);
+        }
+        GuardedPageReaderSet::UnpinFrames(pinned_frames);
+        return std::nullopt;
     }
 
-    bpm_latch_->unlock();
-    /* Note: guard constructor increments pincount, which implies page_id must be valid henceforth. */
-    auto guard = GuardedPageWriter{
-        page_id, buffer_[frame_id], bpm_latch_,
-        lru_k_replacer_, background_scheduler_ 
-    };
-    return std::optional<GuardedPageWriter>(std::move(guard));
+    /* Note: frames are pinned, and the set takes over the pins. */
+    return std::optional<GuardedPageReaderSet>(GuardedPageReaderSet{
+        page_ids, std::move(frames)
+    });
+}
+
+GuardedPageReaderSet BufferManager::GetGuardedPageReaders(const std::vector<page_id_t>& page_ids, AccessHint hint) {
+    std::optional<GuardedPageReaderSet> read_guards_opt = GetGuardedPageReadersNoCheck(page_ids, hint);
+    assert(read_guards_opt.has_value());
+    return std::move(read_guards_opt.value());
+}
+
+std::optional<GuardedPageWriter> BufferManager::GetGuardedPageWriterNoCheck(page_id_t page_id, AccessHint hint) {
+    std::optional<frame_id_t> frame_id_opt = FetchFrame(page_id, hint);
+    if (!frame_id_opt.has_value())
+        return std::nullopt;
+
+    /* Note: frame is pinned by FetchFrame, and the guard takes over the pin. */
+    return std::optional<GuardedPageWriter>(GuardedPageWriter{
+        page_id, &frames_[frame_id_opt.value()], background_scheduler_
+    });
 }
 
 
-GuardedPageWriter BufferManager::GetGuardedPageWriter(page_id_t page_id) {
-    std::optional<GuardedPageWriter> write_guard_opt = GetGuardedPageWriterNoCheck(page_id);
+GuardedPageWriter BufferManager::GetGuardedPageWriter(page_id_t page_id, AccessHint hint) {
+    std::optional<GuardedPageWriter> write_guard_opt = GetGuardedPageWriterNoCheck(page_id, hint);
     assert(write_guard_opt.has_value());
     return std::move(write_guard_opt.value());
 }
 
+std::optional<OptimisticPageReader> BufferManager::GetOptimisticPageReader(page_id_t page_id) {
+    Frame* frame;
+    {
+        PageTableShard& shard = GetShard(page_id);
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        auto it = shard.page_table_.find(page_id);
+        if (it == shard.page_table_.end() || it->second == INVALID_FRAME_ID)
+            return std::nullopt;
+        frame = &frames_[it->second];
+    }
+
+    /* No pin is taken: Restart() checks that the frame still holds the page, and Validate() that it kept it. */
+    OptimisticPageReader reader(page_id, frame);
+    if (!reader.Restart())
+        return std::nullopt;
+    metrics_->Add(Metric::HITS);
+    return std::optional<OptimisticPageReader>(reader);
+}
+
+bool BufferManager::ReadPageOptimistic(page_id_t page_id, const std::function<void(const char*)>& read) {
+    std::optional<OptimisticPageReader> reader_opt = GetOptimisticPageReader(page_id);
+    for (size_t i=0; reader_opt.has_value() && i<OPTIMISTIC_READ_RETRIES; i++) {
+        read(reader_opt->GetData());
+        if (reader_opt->Validate())
+            return true;
+        if (!reader_opt->Restart())
+            break;
+    }
+
+    /* Page not resident, or too many concurrent writes. */
+    std::optional<GuardedPageReader> read_guard_opt = GetGuardedPageReaderNoCheck(page_id);
+    if (!read_guard_opt.has_value())
+        return false;
+    read(read_guard_opt->GetData());
+    return true;
+}
+
+bool BufferManager::AddFrames(size_class_t size_class, size_t count) {
+    /* Reuse frames retired by an earlier shrink first. Their memory was released, and reads back as zeroes. */
+    std::vector<frame_id_t> added;
+    std::vector<frame_id_t>& retired = retired_frames_[size_class];
+    while (added.size() < count && !retired.empty()) {
+        added.push_back(retired.back());
+        retired.pop_back();
+    }
+
+    /* Then carve new frames off the end of the arena. */
+    size_t num_new = count - added.size();
+    size_t page_size = PAGE_SIZE_CLASSES[size_class];
+    size_t num_frames = num_frames_.load();
+    if (num_frames + num_new > MAX_BUFFER_FRAMES || arena_used_ + num_new * page_size > MAX_BUFFER_POOL_BYTES) {
+        retired.insert(retired.end(), added.rbegin(), added.rend());
+        return false;
+    }
+    if (num_new > 0) {
+        /* Commit the memory of the new frames. Frame metadata may share a page with frames already in use. */
+        size_t frames_from = num_frames * sizeof(Frame) / PAGE_SIZE * PAGE_SIZE;
+        size_t frames_to = (num_frames + num_new) * sizeof(Frame);
+        if (mprotect(reinterpret_cast<char*>(frames_) + frames_from, frames_to - frames_from, PROT_READ | PROT_WRITE) != 0 ||
+            mprotect(arena_ + arena_used_, num_new * page_size, PROT_READ | PROT_WRITE) != 0) {
+            std::cerr << "[AddFrames] failed to commit frame memory!" << std::endl;
+            retired.insert(retired.end(), added.rbegin(), added.rend());
+            return false;
+        }
+        for (auto& replacer : replacers_)
+            replacer->Resize(num_frames + num_new);
+    }
+    for (size_t i=0; i<num_new; i++) {
+        frame_id_t frame_id = num_frames + i;
+        new (&frames_[frame_id]) Frame(frame_id, size_class, arena_ + arena_used_, &num_dirty_);
+        arena_used_ += page_size;
+        added.push_back(frame_id);
+    }
+
+    /* Frames reused after a shrink got fresh pages, so their old registration is stale too. */
+    if (count > 0)
+        RegisterFrameBuffers();
+
+    /* Publish the new frames to the flusher, then hand them out through the free lists. */
+    num_frames_.store(num_frames + num_new);
+    for (frame_id_t frame_id : added) {
+        PageTableShard& shard = shards_[frame_id % shards_.size()];
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        shard.free_frames_[size_class].push_back(frame_id);
+    }
+    num_class_frames_[size_class].fetch_add(count);
+    replacers_[size_class]->SetCapacity(num_class_frames_[size_class].load());
+    return true;
+}
+
+void BufferManager::RegisterFrameBuffers() {
+    if (background_scheduler_->GetBackend() != IOBackend::IO_URING)
+        return;
+
+    /* The kernel takes buffers of at most 1 GiB. */
+    const size_t max_buffer_bytes = size_t(1) << 30;
+    std::vector<iovec> buffers;
+    for (size_t offset=0; offset<arena_used_; offset+=max_buffer_bytes)
+        buffers.push_back(iovec{arena_ + offset, std::min(max_buffer_bytes, arena_used_ - offset)});
+    background_scheduler_->RegisterBuffers(buffers);
+}
+
+size_t BufferManager::Resize(size_t num_frames, size_class_t size_class) {
+    assert(size_class < NUM_PAGE_SIZE_CLASSES);
+    std::lock_guard<std::mutex> resize_lock(resize_latch_);
+
+    size_t current = num_class_frames_[size_class].load();
+    if (num_frames >= current) {
+        if (!AddFrames(size_class, num_frames - current))
+            std::cerr << "[Resize] buffer pool too large!" << std::endl;
+        return 0;
+    }
+
+    /*
+     * Take frames the way a page fetch would: free frames first, then evict unpinned pages (writing them back
+     * if dirty). Frames holding pinned pages cannot be reclaimed. The memory of a retired frame is released,
+     * but stays mapped, so stale optimistic readers fail validation rather than fault.
+     */
+    size_t to_release = current - num_frames;
+    size_t released = 0;
+    for (; released<to_release; released++) {
+        std::optional<frame_id_t> frame_id_opt = GetFreeFrame(shards_[0], size_class);
+        if (!frame_id_opt.has_value())
+            break;
+        Frame* frame = &frames_[frame_id_opt.value()];
+        madvise(frame->GetDataMut(), frame->GetPageSize(), MADV_DONTNEED);
+        retired_frames_[size_class].push_back(frame_id_opt.value());
+        num_class_frames_[size_class].fetch_sub(1);
+    }
+    replacers_[size_class]->SetCapacity(num_class_frames_[size_class].load());
+    return to_release - released;
+}
+
+size_t BufferManager::GetNumFrames() {
+    size_t num_frames = 0;
+    for (size_class_t c=0; c<NUM_PAGE_SIZE_CLASSES; c++)
+        num_frames += num_class_frames_[c].load();
+    return num_frames;
+}
+
+size_t BufferManager::GetNumFrames(size_class_t size_class) {
+    return num_class_frames_[size_class].load();
+}
+
 std::optional<size_t> BufferManager::GetPinCount(page_id_t page_id) {
-    bpm_latch_->lock();
-    std::optional<size_t> pin_count = std::nullopt;
-    if (page_table_.find(page_id) != page_table_.end()) {
-        pin_count = buffer_[page_table_[page_id]]->GetPinCount();
-    }
-    bpm_latch_->unlock();
-    return pin_count;
-}
\ No newline at end of file
+    PageTableShard& shard = GetShard(page_id);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    auto it = shard.page_table_.find(page_id);
+    if (it == shard.page_table_.end() || it->second == INVALID_FRAME_ID)
+        return std::nullopt;
+    return frames_[it->second].GetPinCount();
+}
+
+void BufferManager::SetFlusherWatermarks(double low_watermark, double high_watermark) {
+    assert(0 <= low_watermark && low_watermark <= high_watermark && high_watermark <= 1);
+    low_watermark_.store(low_watermark);
+    high_watermark_.store(high_watermark);
+    flusher_cv_.notify_one();
+}
+
+FlushStats BufferManager::GetFlushStats() {
+    MetricsSnapshot metrics = metrics_->Snapshot();
+    return FlushStats{
+        metrics.Get(Metric::CLEAN_EVICTIONS) + metrics.Get(Metric::DIRTY_EVICTIONS), metrics.Get(Metric::SYNC_FLUSHES),
+        metrics.Get(Metric::BACKGROUND_FLUSHES), metrics.Get(Metric::PREFETCHES)
+    };
+}
+
+MetricsSnapshot BufferManager::GetMetrics() {
+    return metrics_->Snapshot();
+}
+
+void BufferManager::SetReadahead(size_t max_pages) {
+    assert(max_pages == 0 || max_pages >= READAHEAD_MIN_PAGES);
+    readahead_max_pages_.store(max_pages);
+}
@@ -0,0 +1,88 @@
+#include "clock_replacer.h"
+#include "common.h"
+
+ClockReplacer::ClockReplacer(size_t num_frames, FrameStateTable* frames, Metrics* metrics):
+Replacer(num_frames, frames, metrics), hand_(0), num_tracked_(0), page_ids_(num_frames, INVALID_PAGE_ID),
+cold_(num_frames, false), prev_(num_frames, INVALID_FRAME_ID), next_(num_frames, INVALID_FRAME_ID),
+cold_frames_(prev_, next_) {}
+
+void ClockReplacer::SetNotCold(frame_id_t frame_id) {
+    if (!cold_[frame_id])
+        return;
+    cold_[frame_id] = false;
+    cold_frames_.Erase(frame_id);
+}
+
+void ClockReplacer::Untrack(frame_id_t frame_id) {
+    if (page_ids_[frame_id] == INVALID_PAGE_ID)
+        return;
+    SetNotCold(frame_id);
+    page_ids_[frame_id] = INVALID_PAGE_ID;
+    num_tracked_--;
+}
+
+std::optional<frame_id_t> ClockReplacer::EvictLocked() {
+    if (num_tracked_ == 0)
+        return std::nullopt;
+
+    /* Pages only scanned go first, oldest first. A scanned page hit since joins the clock, still referenced. */
+    frame_id_t frame_id = ClaimFromBack(cold_frames_, [this](frame_id_t hit) {
+        SetNotCold(hit);
+        State(hit).SetReferenced();
+    });
+    if (frame_id != INVALID_FRAME_ID) {
+        Untrack(frame_id);
+        return frame_id;
+    }
+
+    /* Every unpinned frame has its bit cleared within one revolution, so a victim is found within two. */
+    for (size_t i=0; i<2 * page_ids_.size(); i++) {
+        frame_id = hand_;
+        hand_ = (hand_ + 1) % page_ids_.size();
+        if (page_ids_[frame_id] == INVALID_PAGE_ID)
+            continue;
+        FrameStateWord& state = State(frame_id);
+        if (state.ClearReferenced() || !state.TryClaim())
+            continue;
+        Untrack(frame_id);
+        return frame_id;
+    }
+    return std::nullopt;
+}
+
+void ClockReplacer::RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) {
+    bool new_page = page_ids_[frame_id] != page_id;
+    if (new_page) {
+        if (page_ids_[frame_id] == INVALID_PAGE_ID)
+            num_tracked_++;
+        SetNotCold(frame_id);
+        page_ids_[frame_id] = page_id;
+    }
+    if (hint == AccessHint::POINT) {
+        SetNotCold(frame_id);
+        State(frame_id).SetReferenced();
+    } else if (new_page) {
+        cold_[frame_id] = true;
+        cold_frames_.PushFront(frame_id);
+    }
+}
+
+void ClockReplacer::RemoveLocked(frame_id_t frame_id) {
+    Untrack(frame_id);
+}
+
+size_t ClockReplacer::SizeLocked() {
+    size_t size = 0;
+    for (size_t i=0; i<page_ids_.size(); i++)
+        size += page_ids_[i] != INVALID_PAGE_ID && State(i).IsClaimable();
+    return size;
+}
+
+void ClockReplacer::ResizeLocked(size_t num_frames) {
+    if (num_frames <= page_ids_.size())
+        return;
+    page_ids_.resize(num_frames, INVALID_PAGE_ID);
+    cold_.resize(num_frames, false);
+    prev_.resize(num_frames, INVALID_FRAME_ID);
+    next_.resize(num_frames, INVALID_FRAME_ID);
+}
@@ -5,6 +5,31 @@
 #include "common.h"
 #include <memory.h>
 #include <iostream>
+#include <cassert>
+
+SegmentExtent::SegmentExtent(std::shared_ptr<BufferManager> buffer_manager): buffer_manager_(buffer_manager) {}
+
+SegmentExtent::~SegmentExtent() {
+    Release();
+}
+
+void SegmentExtent::Release() {
+    for (; remaining_ > 0; remaining_--)
+        buffer_manager_->DeletePage(next_page_id_++);
+}
+
+page_id_t SegmentExtent::NextPage(size_class_t size_class) {
+    if (remaining_ == 0 || size_class != size_class_) {
+        Release();
+        size_class_ = size_class;
+        next_page_id_ = buffer_manager_->NewPages(EXTENT_PAGES, size_class);
+        if (next_page_id_ == INVALID_PAGE_ID)
+            return INVALID_PAGE_ID;
+        remaining_ = EXTENT_PAGES;
+    }
+    remaining_--;
+    return next_page_id_++;
+}
 
 ColumnSegment::ColumnSegment(
     std::shared_ptr<BufferManager> buffer_manager, row_id_t start, idx_t count,
@@ -17,20 +42,42 @@ segment_type_(segment_type), segment_size_(segment_size) {
         // handle
         std::cerr << "[ColumnSegment] invalid page id!" << std::endl;
     }
-    UncompressedStringStorage::InitSegment(buffer_manager, page_id, segment_size);
+    /* A persistent segment's page already holds its data. */
+    if (segment_type == ColumnSegmentType::TRANSIENT)
+        UncompressedStringStorage::InitSegment(buffer_manager, page_id, segment_size);
     // add compression function
 }
 
-std::unique_ptr<ColumnSegment> ColumnSegment::CreateTransientSegment(std::shared_ptr<BufferManager> buffer_manager, row_id_t start, idx_t segment_size) {
-    page_id_t page_id = buffer_manager->NewPage();
+std::unique_ptr<ColumnSegment> ColumnSegment::CreateTransientSegment(std::shared_ptr<BufferManager> buffer_manager, row_id_t start, idx_t segment_size, SegmentExtent* extent) {
+    /* Large segments get pages of a larger size class, so scans fetch fewer pages. */
+    size_class_t size_class = GetSizeClassFor(segment_size);
+    assert(size_class < NUM_PAGE_SIZE_CLASSES);
+    page_id_t page_id = extent != nullptr ? extent->NextPage(size_class) : buffer_manager->NewPage(size_class);
     return std::make_unique<ColumnSegment>(buffer_manager, start, 0, page_id, 0, ColumnSegmentType::TRANSIENT, segment_size);
 }
 
+bool ColumnSegment::ConvertToPersistent() {
+    /* Mapped reads see the page in the file, so write it back first. */
+    GuardedPageWriter page_writer = buffer_manager_->GetGuardedPageWriter(page_id_);
+    if (!page_writer.FlushPage())
+        return false;
+    segment_type_ = ColumnSegmentType::PERSISTENT;
+    return true;
+}
+
 void ColumnSegment::InitAppend(ColumnAppendState &append_state) {
+    /* Mapped scans would not see the change. */
+    if (segment_type_ == ColumnSegmentType::PERSISTENT) {
+        std::cerr << "[InitAppend] segment is persistent, read-only!" << std::endl;
+        append_state.write_guard.reset();
+        return;
+    }
     append_state.write_guard = UncompressedStringStorage::InitAppend(*this);
 }
 
 idx_t ColumnSegment::Append(ColumnAppendState &append_state, std::vector<std::string> &data) {
+    if (append_state.write_guard == nullptr)
+        return 0;
     return UncompressedStringStorage::Append(append_state, *this, data);
 }
 
@@ -41,7 +88,16 @@ void ColumnSegment::FinalizeAppend(ColumnAppendState &append_state) {
 }
 
 void ColumnSegment::InitScan(ColumnScanState &scan_state) {
-    scan_state.read_guard = UncompressedStringStorage::InitScan(*this);
+    /* The page of a persistent segment never changes, so it can be read without a frame or a latch. */
+    scan_state.mapped_data = nullptr;
+    if (segment_type_ == ColumnSegmentType::PERSISTENT && scan_state.use_mapping) {
+        scan_state.mapped_data = buffer_manager_->MapPage(page_id_);
+        if (scan_state.mapped_data != nullptr) {
+            scan_state.read_guard.reset();
+            return;
+        }
+    }
+    scan_state.read_guard = UncompressedStringStorage::InitScan(*this, scan_state.access_hint);
 }
 
 idx_t ColumnSegment::Scan(ColumnScanState &scan_state, std::vector<std::string> &result, idx_t count) {
@@ -1,112 +1,727 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include "disk_manager.h"
 #include "common.h"
 
-DiskManager::DiskManager(const std::filesystem::path &db_path, const idx_t page_size): db_path_(db_path), page_size_(page_size) {
-    db_io_.open(db_path, std::ios::binary | std::ios::out | std::ios::in);
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
 
-    if (!db_io_.is_open()) {
-        db_io_.clear();
-        db_io_.open(db_path, std::ios::binary | std::ios::out | std::ios::in | std::ios::trunc);
-        if (!db_io_.is_open()) {
-            std::cerr << "[DiskManager] failed to create/open file!" << std::endl;
-            return;
+DiskManager::DiskManager(const std::filesystem::path &db_path, const idx_t page_size, bool direct_io):
+db_path_(db_path), db_fd_(-1), direct_io_(direct_io), db_capacity_(0), page_size_(page_size), header_(nullptr) {
+    db_fd_ = open(db_path_.c_str(), O_RDWR | O_CREAT | (direct_io_ ? O_DIRECT : 0), 0644);
+    if (direct_io_ && (O_DIRECT == 0 || (db_fd_ < 0 && errno == EINVAL))) {
+        if (db_fd_ >= 0)
+            close(db_fd_);
+        std::cerr << "[DiskManager] file system does not support direct I/O, using buffered I/O!" << std::endl;
+        direct_io_ = false;
+        db_fd_ = open(db_path_.c_str(), O_RDWR | O_CREAT, 0644);
+    }
+    if (db_fd_ < 0) {
+        std::cerr << "[DiskManager] failed to create/open file!" << std::endl;
+        return;
+    }
+
+    /* Freed blocks are found lazily, by the first allocation of each class that scans the free-space map. */
+    std::fill(std::begin(free_cursor_), std::end(free_cursor_), 0);
+
+    /* An existing database: its header is all we need to read. Anything else but an empty file is left alone. */
+    struct stat st;
+    bool stat_ok = fstat(db_fd_, &st) == 0;
+    if (!stat_ok || st.st_size != 0) {
+        if (stat_ok && size_t(st.st_size) >= 2 * PAGE_SIZE) {
+            db_capacity_ = st.st_size / PAGE_SIZE;
+            header_ = reinterpret_cast<DBHeader*>(GetMetaPage(0, false));
+            if (memcmp(header_->magic_, DB_MAGIC, sizeof(DB_MAGIC)) == 0 && header_->version_ == DB_VERSION &&
+                header_->page_size_ == PAGE_SIZE)
+                return;
         }
-        std::filesystem::resize_file(db_path_, DEFAULT_DB_PAGES * PAGE_SIZE);
-        db_capacity_ = DEFAULT_DB_PAGES;
-        // TODO: handle resize error
+        for (auto& [block, page] : meta_pages_)
+            free(page);
+        close(db_fd_);
+        throw std::runtime_error("[DiskManager] " + db_path_.string() + " has no valid header, refusing to open it!");
     }
+
+    /* A new database holds the header and group 0's bitmap, which marks both as used. */
+    db_capacity_ = std::max(DEFAULT_DB_PAGES, 2);
+    if (ftruncate(db_fd_, db_capacity_ * PAGE_SIZE) != 0)
+        std::cerr << "[DiskManager] failed to preallocate file!" << std::endl;
+    header_ = reinterpret_cast<DBHeader*>(GetMetaPage(0, true));
+    memcpy(header_->magic_, DB_MAGIC, sizeof(DB_MAGIC));
+    header_->version_ = DB_VERSION;
+    header_->page_size_ = PAGE_SIZE;
+    header_->next_block_ = 2;
+    GetMetaPage(BitmapBlock(0), true);
+    MarkBlocks(0, 2, true);
+    WriteMetaPage(0);
 }
 
-// DiskManager::~DiskManager()
+DiskManager::~DiskManager() {
+    for (auto& [chunk, addr] : mappings_)
+        munmap(addr, MMAP_CHUNK_SIZE);
+    for (auto& [block, page] : meta_pages_)
+        free(page);
+    if (db_fd_ >= 0)
+        close(db_fd_);
+}
 
-/* Allocates a new page. */
-void DiskManager::AllocatePage(page_id_t next_page_id) {
-    db_io_latch_.lock();
+char* DiskManager::GetMetaPage(uint64_t block, bool fresh) {
+    auto it = meta_pages_.find(block);
+    if (it != meta_pages_.end())
+        return it->second;
 
-    size_t page_pos;
-    size_t num_pages = pages_.size();
+    char* page = static_cast<char*>(aligned_alloc(DIRECT_IO_ALIGNMENT, PAGE_SIZE));
+    if (fresh || TransferPage(page, PAGE_SIZE, block * PAGE_SIZE, false) != PAGE_SIZE) {
+        if (!fresh)
+            std::cerr << "[GetMetaPage] failed to read block " << block << "!" << std::endl;
+        memset(page, 0, PAGE_SIZE);
+    }
+    meta_pages_.emplace(block, page);
+    return page;
+}
 
-    /* If a free slot exists, use it. */
-    if (!free_slots_.empty()) {
-        page_pos = free_slots_.back();
-        free_slots_.pop_back();
-        pages_.insert({next_page_id, page_pos * PAGE_SIZE});
-        db_io_latch_.unlock();
+void DiskManager::WriteMetaPage(uint64_t block) {
+    if (TransferPage(meta_pages_.at(block), PAGE_SIZE, block * PAGE_SIZE, true) == PAGE_SIZE) {
+        unwritten_meta_pages_.erase(block);
         return;
     }
+    std::cerr << "[WriteMetaPage] failed to write block " << block << "!" << std::endl;
+    unwritten_meta_pages_.insert(block);
+}
 
-    /* Increase (double) capacity if required. */
-    if (num_pages + 1 > db_capacity_) {
-        db_capacity_ *= 2;
-        std::filesystem::resize_file(db_path_, db_capacity_ * PAGE_SIZE);
+uint32_t* DiskManager::DirectoryEntry(page_id_t page_id, bool create, uint64_t* leaf_block) {
+    size_class_t size_class = GetPageSizeClass(page_id);
+    if (page_id < 0 || size_class >= NUM_PAGE_SIZE_CLASSES)
+        return nullptr;
+    uint32_t n = static_cast<uint32_t>(page_id) & ((uint32_t(1) << PAGE_SIZE_CLASS_SHIFT) - 1);
+
+    uint32_t& root = header_->roots_[size_class][n / (DIRECTORY_FANOUT * DIRECTORY_FANOUT)];
+    if (root == 0) {
+        if (!create)
+            return nullptr;
+        uint64_t block = AllocateBlocks(1, 0);
+        GetMetaPage(block, true);
+        WriteMetaPage(block);
+        root = block;
+        WriteMetaPage(0);
+    }
+    uint32_t& leaf = reinterpret_cast<uint32_t*>(GetMetaPage(root, false))[n / DIRECTORY_FANOUT % DIRECTORY_FANOUT];
+    if (leaf == 0) {
+        if (!create)
+            return nullptr;
+        uint64_t block = AllocateBlocks(1, 0);
+        GetMetaPage(block, true);
+        WriteMetaPage(block);
+        leaf = block;
+        WriteMetaPage(root);
     }
+    *leaf_block = leaf;
+    return &reinterpret_cast<uint32_t*>(GetMetaPage(leaf, false))[n % DIRECTORY_FANOUT];
+}
 
-    page_pos = num_pages;
-    pages_.insert({next_page_id, page_pos * PAGE_SIZE});
-    db_io_latch_.unlock();
+std::optional<uint64_t> DiskManager::LookupBlock(page_id_t page_id) {
+    uint64_t leaf_block;
+    uint32_t* entry = DirectoryEntry(page_id, false, &leaf_block);
+    if (entry == nullptr || *entry == 0)
+        return std::nullopt;
+    return *entry;
 }
 
-void DiskManager::ReadPage(page_id_t page_id, char* data) {
-    /* If page has not been allocated, throw error. */
-    if (pages_.find(page_id) == pages_.end()) {
-        std::cerr << "[ReadPage] reading from unallocated page!" << std::endl;
+uint64_t DiskManager::AllocateBlocks(size_t num_blocks, size_class_t size_class) {
+    std::optional<uint64_t> free_run = FindFreeRun(num_blocks, size_class);
+    if (free_run.has_value()) {
+        MarkBlocks(free_run.value(), num_blocks, true);
+        return free_run.value();
+    }
+
+    /* A page never spans groups. Crossing into a group starts with its bitmap page. */
+    uint64_t first = header_->next_block_;
+    uint64_t group = first / BLOCKS_PER_GROUP;
+    if (first + num_blocks > (group + 1) * BLOCKS_PER_GROUP)
+        first = ++group * BLOCKS_PER_GROUP;
+    if (first == BitmapBlock(group)) {
+        EnsureCapacity(first + 1);
+        GetMetaPage(first, true);
+        MarkBlocks(first, 1, true);
+        first++;
+    }
+    EnsureCapacity(first + num_blocks);
+    header_->next_block_ = first + num_blocks;
+    MarkBlocks(first, num_blocks, true);
+    WriteMetaPage(0);
+    return first;
+}
+
+std::optional<uint64_t> DiskManager::FindFreeRun(size_t num_blocks, size_class_t size_class) {
+    uint64_t end = header_->next_block_;
+    for (uint64_t block = free_cursor_[size_class]; block < end; ) {
+        uint64_t group = block / BLOCKS_PER_GROUP;
+        const uint8_t* bitmap = reinterpret_cast<const uint8_t*>(GetMetaPage(BitmapBlock(group), false));
+        uint64_t group_end = std::min(end, (group + 1) * BLOCKS_PER_GROUP);
+        uint64_t run_start = block;
+        size_t run = 0;
+        for (; block < group_end; block++) {
+            uint64_t bit = block % BLOCKS_PER_GROUP;
+
+            /* Skip fully used bytes. */
+            if (run == 0 && bit % 8 == 0 && bitmap[bit / 8] == 0xFF) {
+                block += 7;
+                continue;
+            }
+            if (bitmap[bit / 8] & (1 << (bit % 8))) {
+                run = 0;
+                continue;
+            }
+            if (run++ == 0)
+                run_start = block;
+            if (run == num_blocks) {
+                free_cursor_[size_class] = run_start;
+                return run_start;
+            }
+        }
+    }
+    free_cursor_[size_class] = end;
+    return std::nullopt;
+}
+
+void DiskManager::MarkBlocks(uint64_t first, size_t num_blocks, bool used) {
+    uint64_t block = first;
+    while (block < first + num_blocks) {
+        uint64_t group = block / BLOCKS_PER_GROUP;
+        uint8_t* bitmap = reinterpret_cast<uint8_t*>(GetMetaPage(BitmapBlock(group), false));
+        for (; block < first + num_blocks && block / BLOCKS_PER_GROUP == group; block++) {
+            uint64_t bit = block % BLOCKS_PER_GROUP;
+            if (used)
+                bitmap[bit / 8] |= 1 << (bit % 8);
+            else
+                bitmap[bit / 8] &= ~(1 << (bit % 8));
+        }
+        WriteMetaPage(BitmapBlock(group));
+    }
+
+    /* Freed blocks may hold a page of any class. */
+    if (!used) {
+        for (uint64_t& cursor : free_cursor_)
+            cursor = std::min(cursor, first);
+    }
+}
+
+/* Increase (double) capacity if required. */
+void DiskManager::EnsureCapacity(uint64_t num_blocks) {
+    if (num_blocks <= db_capacity_)
         return;
+    while (num_blocks > db_capacity_)
+        db_capacity_ *= 2;
+    if (ftruncate(db_fd_, db_capacity_ * PAGE_SIZE) != 0)
+        std::cerr << "[AllocatePage] failed to grow file!" << std::endl;
+}
+
+bool DiskManager::ZeroBlocks(uint64_t first, size_t num_blocks) {
+    if (fallocate(db_fd_, FALLOC_FL_ZERO_RANGE, first * PAGE_SIZE, num_blocks * PAGE_SIZE) == 0)
+        return true;
+
+    /* Not supported by the file system: write the zeroes. */
+    char* zeroes = static_cast<char*>(aligned_alloc(DIRECT_IO_ALIGNMENT, PAGE_SIZE));
+    memset(zeroes, 0, PAGE_SIZE);
+    bool ok = true;
+    for (uint64_t block = first; ok && block < first + num_blocks; block++) {
+        if (TransferPage(zeroes, PAGE_SIZE, block * PAGE_SIZE, true) != PAGE_SIZE) {
+            std::cerr << "[AllocatePages] failed to zero block " << block << "!" << std::endl;
+            ok = false;
+        }
+    }
+    free(zeroes);
+    return ok;
+}
+
+std::optional<size_t> DiskManager::FindPage(DirectoryShard& shard, page_id_t page_id,
+    std::shared_lock<std::shared_mutex>& lock) {
+    auto it = shard.pages_.find(page_id);
+    if (it != shard.pages_.end())
+        return it->second;
+
+    /* A page missing from the directory cannot be allocated while we hold the shard. */
+    {
+        std::lock_guard<std::mutex> meta_lock(meta_latch_);
+        if (!LookupBlock(page_id).has_value())
+            return std::nullopt;
+    }
+
+    /* Cache the entry. It is looked up again, as the page may have been deleted while we held no latch. */
+    lock.unlock();
+    {
+        std::unique_lock<std::shared_mutex> unique_lock(shard.latch_);
+        if (shard.pages_.find(page_id) == shard.pages_.end()) {
+            std::lock_guard<std::mutex> meta_lock(meta_latch_);
+            std::optional<uint64_t> block = LookupBlock(page_id);
+            if (block.has_value())
+                shard.pages_.emplace(page_id, block.value() * PAGE_SIZE);
+        }
     }
+    lock.lock();
+    it = shard.pages_.find(page_id);
+    if (it == shard.pages_.end())
+        return std::nullopt;
+    return it->second;
+}
 
-    /* Seek to required page. */
-    db_io_latch_.lock();
-    db_io_.seekg(pages_[page_id], std::ios::beg);
-    db_io_.read(data, PAGE_SIZE);
-    db_io_latch_.unlock();
+/* Allocates a new page, sized by the page's size class. */
+void DiskManager::AllocatePage(page_id_t next_page_id) {
+    DirectoryShard& shard = GetShard(next_page_id);
+    std::unique_lock<std::shared_mutex> lock(shard.latch_);
+
+    /* Another I/O worker writing the page may have allocated it first. */
+    if (shard.pages_.find(next_page_id) != shard.pages_.end())
+        return;
 
-    if (db_io_.bad()) {
-        std::cerr << "[ReadPage] error while reading page!" << std::endl;
+    std::lock_guard<std::mutex> meta_lock(meta_latch_);
+    uint64_t leaf_block;
+    uint32_t* entry = DirectoryEntry(next_page_id, true, &leaf_block);
+    if (entry == nullptr) {
+        std::cerr << "[AllocatePage] invalid page id " << next_page_id << "!" << std::endl;
         return;
     }
 
-    /* Should never happen: encounter EOF in middle of page. */
-    if (db_io_.gcount() < PAGE_SIZE) {
-        std::cerr << "[ReadPage] read less than a full page!" << std::endl;
+    /* Allocated before we last opened the database. */
+    if (*entry != 0) {
+        shard.pages_.emplace(next_page_id, size_t(*entry) * PAGE_SIZE);
         return;
     }
+
+    size_class_t size_class = GetPageSizeClass(next_page_id);
+    uint64_t block = AllocateBlocks(::GetPageSize(next_page_id) / PAGE_SIZE, size_class);
+    *entry = block;
+    WriteMetaPage(leaf_block);
+
+    uint32_t n = static_cast<uint32_t>(next_page_id) & ((uint32_t(1) << PAGE_SIZE_CLASS_SHIFT) - 1);
+    header_->num_pages_++;
+    header_->next_page_ids_[size_class] = std::max(header_->next_page_ids_[size_class], n + 1);
+    WriteMetaPage(0);
+    shard.pages_.emplace(next_page_id, block * PAGE_SIZE);
+}
+
+bool DiskManager::AllocatePages(page_id_t first_page_id, size_t num_pages) {
+    size_class_t size_class = GetPageSizeClass(first_page_id);
+    size_t page_blocks = ::GetPageSize(first_page_id) / PAGE_SIZE;
+    size_t max_pages = (BLOCKS_PER_GROUP - 1) / page_blocks;
+    if (num_pages > max_pages)
+        return AllocatePages(first_page_id, max_pages) &&
+            AllocatePages(first_page_id + max_pages, num_pages - max_pages);
+
+    std::vector<page_id_t> page_ids(num_pages);
+    std::iota(page_ids.begin(), page_ids.end(), first_page_id);
+    bool used[NUM_PAGE_DIRECTORY_SHARDS] = {};
+    for (page_id_t page_id : page_ids)
+        used[static_cast<uint32_t>(page_id) % NUM_PAGE_DIRECTORY_SHARDS] = true;
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    for (size_t i=0; i<NUM_PAGE_DIRECTORY_SHARDS; i++) {
+        if (used[i])
+            locks.emplace_back(directory_[i].latch_);
+    }
+
+    /* Missing directory pages are created before the run is taken, so they do not split it. */
+    std::lock_guard<std::mutex> meta_lock(meta_latch_);
+    std::vector<page_id_t> new_pages;
+    std::vector<uint32_t*> entries;
+    std::vector<uint64_t> leaf_blocks;
+    for (page_id_t page_id : page_ids) {
+        uint64_t leaf_block;
+        uint32_t* entry = DirectoryEntry(page_id, true, &leaf_block);
+        if (entry == nullptr) {
+            std::cerr << "[AllocatePages] invalid page id " << page_id << "!" << std::endl;
+            return false;
+        }
+        if (*entry != 0) {
+            GetShard(page_id).pages_.emplace(page_id, size_t(*entry) * PAGE_SIZE);
+            continue;
+        }
+        new_pages.push_back(page_id);
+        entries.push_back(entry);
+        if (leaf_blocks.empty() || leaf_blocks.back() != leaf_block)
+            leaf_blocks.push_back(leaf_block);
+    }
+    if (new_pages.empty())
+        return true;
+
+    /* Reused blocks still hold the data of the pages freed from them, so they are not handed out unless zeroed. */
+    uint64_t block = AllocateBlocks(new_pages.size() * page_blocks, size_class);
+    if (!ZeroBlocks(block, new_pages.size() * page_blocks)) {
+        MarkBlocks(block, new_pages.size() * page_blocks, false);
+        return false;
+    }
+    for (size_t i=0; i<new_pages.size(); i++) {
+        *entries[i] = block + i * page_blocks;
+        GetShard(new_pages[i]).pages_.emplace(new_pages[i], (block + i * page_blocks) * PAGE_SIZE);
+    }
+    for (uint64_t leaf_block : leaf_blocks)
+        WriteMetaPage(leaf_block);
+
+    uint32_t n = static_cast<uint32_t>(new_pages.back()) & ((uint32_t(1) << PAGE_SIZE_CLASS_SHIFT) - 1);
+    header_->num_pages_ += new_pages.size();
+    header_->next_page_ids_[size_class] = std::max(header_->next_page_ids_[size_class], n + 1);
+    WriteMetaPage(0);
+    return true;
+}
+
+/* Called by several I/O workers at once. Only the page's shard is latched, and only shared. */
+void DiskManager::ReadPage(page_id_t page_id, char* data) {
+    DirectoryShard& shard = GetShard(page_id);
+    std::shared_lock<std::shared_mutex> lock(shard.latch_);
+
+    /* If page has not been allocated, throw error. */
+    std::optional<size_t> offset = FindPage(shard, page_id, lock);
+    if (!offset.has_value()) {
+        std::cerr << "[ReadPage] reading from unallocated page!" << std::endl;
+        return;
+    }
+
+    idx_t page_size = ::GetPageSize(page_id);
+    ssize_t n = TransferPage(data, page_size, offset.value(), false);
+    if (n < 0)
+        throw std::runtime_error("[ReadPage] error while reading page: " + std::string(strerror(errno)));
+
+    /* Should never happen: encounter EOF in middle of page. */
+    if (size_t(n) < page_size)
+        throw std::runtime_error("[ReadPage] read less than a full page");
 }
 
 void DiskManager::WritePage(page_id_t page_id, const char* data) {
     /* If page has not been allocated, page was allocated in-memory and now flushed. Allocate a page first. */
-    if (pages_.find(page_id) == pages_.end()) {
+    if (!CheckPageExists(page_id)) {
         AllocatePage(page_id);
     }
 
-    /* Overwrite data. */
-    db_io_latch_.lock();
-    db_io_.seekp(pages_[page_id], std::ios::beg);
-    db_io_.write(data, PAGE_SIZE);
-    db_io_latch_.unlock();
-
-    if (db_io_.bad()) {
-        std::cerr << "[WritePage] failed to write to page!" << std::endl;
+    /* Overwrite data, unless the page was deleted meanwhile. */
+    DirectoryShard& shard = GetShard(page_id);
+    std::shared_lock<std::shared_mutex> lock(shard.latch_);
+    std::optional<size_t> offset = FindPage(shard, page_id, lock);
+    if (!offset.has_value())
         return;
+
+    idx_t page_size = ::GetPageSize(page_id);
+    ssize_t n = TransferPage(const_cast<char*>(data), page_size, offset.value(), true);
+    if (n < 0)
+        throw std::runtime_error("[WritePage] failed to write to page: " + std::string(strerror(errno)));
+    if (size_t(n) < page_size)
+        throw std::runtime_error("[WritePage] wrote less than a full page");
+}
+
+ssize_t DiskManager::TransferPage(char* data, size_t len, size_t offset, bool write) {
+    std::unique_ptr<char, decltype(&free)> bounce(nullptr, &free);
+    char* buf = data;
+    if (NeedsBounce(data)) {
+        bounce.reset(static_cast<char*>(aligned_alloc(DIRECT_IO_ALIGNMENT, len)));
+        buf = bounce.get();
+        if (write)
+            memcpy(buf, data, len);
+    }
+
+    /* Short transfers continue where they stopped, until EOF. */
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write ? pwrite(db_fd_, buf + done, len - done, offset + done) :
+            pread(db_fd_, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    if (!write && bounce)
+        memcpy(data, buf, done);
+    return done;
+}
+
+std::vector<std::shared_lock<std::shared_mutex>> DiskManager::LockShards(const std::vector<page_id_t>& page_ids) {
+    bool used[NUM_PAGE_DIRECTORY_SHARDS] = {};
+    for (page_id_t page_id : page_ids)
+        used[static_cast<uint32_t>(page_id) % NUM_PAGE_DIRECTORY_SHARDS] = true;
+
+    /* Everyone holding several shards takes them in shard order, so this cannot deadlock. */
+    std::vector<std::shared_lock<std::shared_mutex>> locks;
+    for (size_t i=0; i<NUM_PAGE_DIRECTORY_SHARDS; i++) {
+        if (used[i])
+            locks.emplace_back(directory_[i].latch_);
+    }
+    return locks;
+}
+
+size_t DiskManager::ReadPages(const std::vector<page_id_t>& page_ids, const std::vector<char*>& data) {
+    /* Cache the pages' directory entries, so they are found below. */
+    for (page_id_t page_id : page_ids)
+        CheckPageExists(page_id);
+
+    std::vector<std::shared_lock<std::shared_mutex>> locks = LockShards(page_ids);
+    std::vector<PageIO> pages;
+    for (size_t i=0; i<page_ids.size(); i++) {
+        DirectoryShard& shard = GetShard(page_ids[i]);
+        auto it = shard.pages_.find(page_ids[i]);
+        if (it == shard.pages_.end()) {
+            std::cerr << "[ReadPages] reading from unallocated page!" << std::endl;
+            continue;
+        }
+        pages.push_back(PageIO{it->second, ::GetPageSize(page_ids[i]), data[i]});
+    }
+    return TransferVectored(pages, false);
+}
+
+size_t DiskManager::WritePages(const std::vector<page_id_t>& page_ids, const std::vector<const char*>& data) {
+    /*
+     * Pages allocated in-memory and now flushed are allocated on disk first, as in WritePage. The other pages'
+     * directory entries are cached, so they are found below.
+     */
+    for (page_id_t page_id : page_ids) {
+        if (!CheckPageExists(page_id))
+            AllocatePage(page_id);
+    }
+
+    /* Pages deleted meanwhile are skipped. */
+    std::vector<std::shared_lock<std::shared_mutex>> locks = LockShards(page_ids);
+    std::vector<PageIO> pages;
+    for (size_t i=0; i<page_ids.size(); i++) {
+        DirectoryShard& shard = GetShard(page_ids[i]);
+        auto it = shard.pages_.find(page_ids[i]);
+        if (it != shard.pages_.end())
+            pages.push_back(PageIO{it->second, ::GetPageSize(page_ids[i]), const_cast<char*>(data[i])});
+    }
+    return TransferVectored(pages, true);
+}
+
+size_t DiskManager::TransferVectored(std::vector<PageIO>& pages, bool write) {
+    std::sort(pages.begin(), pages.end(), [](const PageIO& a, const PageIO& b) { return a.offset_ < b.offset_; });
+
+    /* Unaligned buffers are transferred through aligned copies under direct I/O. */
+    std::vector<std::unique_ptr<char, decltype(&free)>> bounces;
+    std::vector<std::pair<size_t, char*>> bounced;  /* Page, and the caller's buffer. */
+    for (size_t i=0; i<pages.size(); i++) {
+        if (!NeedsBounce(pages[i].data_))
+            continue;
+        bounces.emplace_back(static_cast<char*>(aligned_alloc(DIRECT_IO_ALIGNMENT, pages[i].len_)), &free);
+        bounced.emplace_back(i, pages[i].data_);
+        if (write)
+            memcpy(bounces.back().get(), pages[i].data_, pages[i].len_);
+        pages[i].data_ = bounces.back().get();
     }
 
-    db_io_.flush();
+    size_t num_ios = 0;
+    std::vector<iovec> iovs;
+    for (size_t begin=0; begin<pages.size(); ) {
+        /* Extend the run while the next page starts where the previous one ends. */
+        size_t end = begin + 1;
+        while (end < pages.size() && end - begin < IOV_MAX &&
+            pages[end].offset_ == pages[end - 1].offset_ + pages[end - 1].len_)
+            end++;
+
+        iovs.clear();
+        size_t total = 0;
+        for (size_t i=begin; i<end; i++) {
+            iovs.push_back(iovec{pages[i].data_, pages[i].len_});
+            total += pages[i].len_;
+        }
+
+        /* Short transfers continue where they stopped. */
+        iovec* iov = iovs.data();
+        int iovcnt = iovs.size();
+        size_t offset = pages[begin].offset_;
+        while (total > 0) {
+            ssize_t n = write ? pwritev(db_fd_, iov, iovcnt, offset) : preadv(db_fd_, iov, iovcnt, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                throw std::runtime_error(std::string(write ? "[WritePages] failed to write pages: " :
+                    "[ReadPages] error while reading pages: ") + strerror(errno));
+            }
+            if (n == 0)
+                throw std::runtime_error(write ? "[WritePages] wrote less than the pages" : "[ReadPages] read past the end of the file");
+            total -= n;
+            offset += n;
+            while (iovcnt > 0 && size_t(n) >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+        num_ios++;
+        begin = end;
+    }
+
+    if (!write) {
+        for (auto [i, data] : bounced)
+            memcpy(data, pages[i].data_, pages[i].len_);
+    }
+    return num_ios;
 }
 
 void DiskManager::DeletePage(page_id_t page_id) {
+    /* Wait for pinned I/O without holding the latch, which the pinning thread may need to make progress. */
+    DirectoryShard& shard = GetShard(page_id);
+    std::unique_lock<std::shared_mutex> lock(shard.latch_, std::defer_lock);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> pins_lock(shard.pins_latch_);
+            shard.pins_cv_.wait(pins_lock, [&] { return shard.pins_.find(page_id) == shard.pins_.end(); });
+        }
+        lock.lock();
+        std::lock_guard<std::mutex> pins_lock(shard.pins_latch_);
+        if (shard.pins_.find(page_id) == shard.pins_.end())
+            break;
+        lock.unlock();
+    }
+    shard.pages_.erase(page_id);
+
     /* It is possible that page has only been allocated in-memory, and does not exist on disk. */
-    if (pages_.find(page_id) == pages_.end())
+    std::lock_guard<std::mutex> meta_lock(meta_latch_);
+    uint64_t leaf_block;
+    uint32_t* entry = DirectoryEntry(page_id, false, &leaf_block);
+    if (entry == nullptr || *entry == 0)
         return;
 
     /* Free page, no need to zero data. */
-    db_io_latch_.lock();
-    pages_.erase(page_id);
-    free_slots_.emplace_back(page_id);
-    db_io_latch_.unlock();
+    uint64_t block = *entry;
+    *entry = 0;
+    WriteMetaPage(leaf_block);
+    header_->num_pages_--;
+    WriteMetaPage(0);
+    MarkBlocks(block, ::GetPageSize(page_id) / PAGE_SIZE, false);
 }
 
 bool DiskManager::CheckPageExists(page_id_t page_id) {
-    return (pages_.find(page_id) != pages_.end());
-}
\ No newline at end of file
+    /* Called concurrently by the buffer manager's shards while the scheduler allocates pages. */
+    DirectoryShard& shard = GetShard(page_id);
+    std::shared_lock<std::shared_mutex> lock(shard.latch_);
+    return FindPage(shard, page_id, lock).has_value();
+}
+
+std::optional<size_t> DiskManager::GetPageOffset(page_id_t page_id) {
+    DirectoryShard& shard = GetShard(page_id);
+    std::shared_lock<std::shared_mutex> lock(shard.latch_);
+    return FindPage(shard, page_id, lock);
+}
+
+std::optional<PinnedPage> DiskManager::PinPage(page_id_t page_id) {
+    DirectoryShard& shard = GetShard(page_id);
+    std::shared_lock<std::shared_mutex> lock(shard.latch_);
+    std::optional<size_t> offset = FindPage(shard, page_id, lock);
+    if (!offset.has_value())
+        return std::nullopt;
+    std::lock_guard<std::mutex> pins_lock(shard.pins_latch_);
+    shard.pins_[page_id]++;
+    return std::optional<PinnedPage>(std::in_place, this, page_id, offset.value());
+}
+
+void DiskManager::UnpinPage(page_id_t page_id) {
+    DirectoryShard& shard = GetShard(page_id);
+    std::lock_guard<std::mutex> pins_lock(shard.pins_latch_);
+    auto it = shard.pins_.find(page_id);
+    if (--it->second == 0) {
+        shard.pins_.erase(it);
+        shard.pins_cv_.notify_all();
+    }
+}
+
+PinnedPage::PinnedPage(PinnedPage&& that):
+    disk_manager_(that.disk_manager_), page_id_(that.page_id_), offset_(that.offset_) {
+    that.disk_manager_ = nullptr;
+}
+
+PinnedPage& PinnedPage::operator=(PinnedPage&& that) {
+    if (this != &that) {
+        Release();
+        disk_manager_ = that.disk_manager_;
+        page_id_ = that.page_id_;
+        offset_ = that.offset_;
+        that.disk_manager_ = nullptr;
+    }
+    return *this;
+}
+
+void PinnedPage::Release() {
+    if (disk_manager_ != nullptr) {
+        disk_manager_->UnpinPage(page_id_);
+        disk_manager_ = nullptr;
+    }
+}
+
+const char* DiskManager::MapPage(page_id_t page_id) {
+    std::optional<size_t> offset = GetPageOffset(page_id);
+    if (!offset.has_value()) {
+        std::cerr << "[MapPage] mapping unallocated page!" << std::endl;
+        return nullptr;
+    }
+
+    /* A chunk may extend past the end of the file. Its pages can be read once the file grows over them. */
+    uint64_t chunk = offset.value() / MMAP_CHUNK_SIZE;
+    char* base;
+    {
+        std::lock_guard<std::mutex> lock(map_latch_);
+        auto it = mappings_.find(chunk);
+        if (it == mappings_.end()) {
+            void* addr = mmap(nullptr, MMAP_CHUNK_SIZE, PROT_READ, MAP_SHARED, db_fd_, chunk * MMAP_CHUNK_SIZE);
+            if (addr == MAP_FAILED) {
+                std::cerr << "[MapPage] failed to map file!" << std::endl;
+                return nullptr;
+            }
+            it = mappings_.emplace(chunk, static_cast<char*>(addr)).first;
+        }
+        base = it->second;
+    }
+
+    /* Read the whole page in at once, rather than fault it in an OS page at a time. */
+    char* data = base + offset.value() % MMAP_CHUNK_SIZE;
+    madvise(data, ::GetPageSize(page_id), MADV_WILLNEED);
+    return data;
+}
+
+bool DiskManager::Sync() {
+    /* Metadata that could not be written is retried: the sync only succeeds once it is all on disk. */
+    {
+        std::lock_guard<std::mutex> meta_lock(meta_latch_);
+        std::vector<uint64_t> unwritten(unwritten_meta_pages_.begin(), unwritten_meta_pages_.end());
+        for (uint64_t block : unwritten)
+            WriteMetaPage(block);
+        if (!unwritten_meta_pages_.empty()) {
+            std::cerr << "[Sync] failed to write metadata!" << std::endl;
+            return false;
+        }
+    }
+
+    int ret;
+    do {
+        ret = fdatasync(db_fd_);
+    } while (ret != 0 && errno == EINTR);
+    if (ret != 0) {
+        std::cerr << "[Sync] failed to sync file!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+size_t DiskManager::GetNumPages() {
+    std::lock_guard<std::mutex> meta_lock(meta_latch_);
+    return header_->num_pages_;
+}
+
+page_id_t DiskManager::GetNextPageId(size_class_t size_class) {
+    std::lock_guard<std::mutex> meta_lock(meta_latch_);
+    return (static_cast<page_id_t>(size_class) << PAGE_SIZE_CLASS_SHIFT) + header_->next_page_ids_[size_class];
+}
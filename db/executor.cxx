@@ -0,0 +1,64 @@
+#include "executor.h"
+#include <cassert>
+
+Executor::Executor(size_t num_threads): num_tasks_(0), stop_(false) {
+    assert(num_threads > 0);
+    for (size_t i=0; i<num_threads; i++)
+        threads_.emplace_back([this] { Run(); });
+}
+
+Executor::~Executor() {
+    WaitIdle();
+    {
+        std::lock_guard<std::mutex> lock(latch_);
+        stop_ = true;
+    }
+    ready_cv_.notify_all();
+    for (std::thread& thread : threads_)
+        thread.join();
+}
+
+void Executor::Run() {
+    std::unique_lock<std::mutex> lock(latch_);
+    while (true) {
+        ready_cv_.wait(lock, [this] { return stop_ || !ready_.empty(); });
+        if (ready_.empty())
+            return;
+        std::coroutine_handle<> handle = ready_.front();
+        ready_.pop_front();
+        lock.unlock();
+        handle.resume();
+        lock.lock();
+    }
+}
+
+void Executor::Post(std::coroutine_handle<> handle) {
+    /* Notify under the latch: once the coroutine runs, its owner may destroy the executor. */
+    std::lock_guard<std::mutex> lock(latch_);
+    ready_.push_back(handle);
+    ready_cv_.notify_one();
+}
+
+task_detail::Detached Executor::RunSpawned(Executor* executor, Task<void> task) {
+    co_await task;
+    executor->FinishTask();
+}
+
+void Executor::Spawn(Task<void> task) {
+    {
+        std::lock_guard<std::mutex> lock(latch_);
+        num_tasks_++;
+    }
+    Post(RunSpawned(this, std::move(task)).handle_);
+}
+
+void Executor::FinishTask() {
+    std::lock_guard<std::mutex> lock(latch_);
+    if (--num_tasks_ == 0)
+        idle_cv_.notify_all();
+}
+
+void Executor::WaitIdle() {
+    std::unique_lock<std::mutex> lock(latch_);
+    idle_cv_.wait(lock, [this] { return num_tasks_ == 0; });
+}
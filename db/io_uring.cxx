@@ -0,0 +1,193 @@
+#include "io_uring.h"
+#include "common.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if CYGNET_HAS_IO_URING
+
+/* The ring indices are shared with the kernel, which reads and writes them concurrently. */
+static unsigned LoadAcquire(const unsigned* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static void StoreRelease(unsigned* p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+static int Enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    int ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+    return ret < 0 ? -errno : ret;
+}
+
+IOUring::IOUring(unsigned entries): ring_fd_(-1), sq_entries_(0), cq_entries_(0), sq_pending_(0),
+buffers_registered_(false), sq_ring_(MAP_FAILED), sq_ring_size_(0), cq_ring_(MAP_FAILED), cq_ring_size_(0),
+sqes_mem_(MAP_FAILED), sqes_size_(0) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+        return;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    /* Since 5.4 the submission and completion rings share one mapping. */
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap ? sq_ring_ :
+        mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqes_mem_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_mem_ == MAP_FAILED) {
+        std::cerr << "[IOUring] failed to map rings!" << std::endl;
+        close(fd);
+        return;
+    }
+
+    char* sq = static_cast<char*>(sq_ring_);
+    char* cq = static_cast<char*>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    sqes_ = static_cast<io_uring_sqe*>(sqes_mem_);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    sq_entries_ = params.sq_entries;
+    cq_entries_ = params.cq_entries;
+    ring_fd_ = fd;
+}
+
+IOUring::~IOUring() {
+    if (sqes_mem_ != MAP_FAILED)
+        munmap(sqes_mem_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+        munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED)
+        munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+}
+
+bool IOUring::Prepare(uint8_t opcode, int fd, uint64_t addr, uint32_t len, uint64_t offset, int buf_index,
+    uint64_t user_data) {
+    /* Only this thread advances the tail, the kernel advances the head as it consumes entries. */
+    unsigned tail = *sq_tail_;
+    if (tail - LoadAcquire(sq_head_) >= sq_entries_)
+        return false;
+
+    unsigned index = tail & *sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    if (buf_index >= 0)
+        sqe->buf_index = buf_index;
+    sq_array_[index] = index;
+    StoreRelease(sq_tail_, tail + 1);
+    sq_pending_++;
+    return true;
+}
+
+bool IOUring::PrepareRead(int fd, char* data, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data) {
+    return Prepare(buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, reinterpret_cast<uint64_t>(data),
+        len, offset, buf_index, user_data);
+}
+
+bool IOUring::PrepareWrite(int fd, const char* data, uint32_t len, uint64_t offset, int buf_index,
+    uint64_t user_data) {
+    return Prepare(buf_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, reinterpret_cast<uint64_t>(data),
+        len, offset, buf_index, user_data);
+}
+
+bool IOUring::PrepareReadv(int fd, const iovec* iovs, unsigned iovcnt, uint64_t offset, uint64_t user_data) {
+    return Prepare(IORING_OP_READV, fd, reinterpret_cast<uint64_t>(iovs), iovcnt, offset, -1, user_data);
+}
+
+bool IOUring::PrepareWritev(int fd, const iovec* iovs, unsigned iovcnt, uint64_t offset, uint64_t user_data) {
+    return Prepare(IORING_OP_WRITEV, fd, reinterpret_cast<uint64_t>(iovs), iovcnt, offset, -1, user_data);
+}
+
+int IOUring::Submit() {
+    if (sq_pending_ == 0)
+        return 0;
+    int ret = Enter(ring_fd_, sq_pending_, 0, 0);
+    if (ret > 0)
+        sq_pending_ -= ret;
+    return ret;
+}
+
+int IOUring::WaitCompletion() {
+    if (LoadAcquire(cq_tail_) != *cq_head_)
+        return 0;
+    int ret = Enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+    return ret < 0 ? ret : 0;
+}
+
+size_t IOUring::PopCompletions(Completion* out, size_t max) {
+    unsigned head = *cq_head_;
+    unsigned tail = LoadAcquire(cq_tail_);
+    size_t n = 0;
+    for (; head != tail && n < max; head++, n++) {
+        const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+        out[n] = Completion{cqe.user_data, cqe.res};
+    }
+
+    /* Hand the slots back to the kernel only after reading them. */
+    StoreRelease(cq_head_, head);
+    return n;
+}
+
+bool IOUring::RegisterBuffers(const std::vector<iovec>& buffers) {
+    UnregisterBuffers();
+    if (buffers.empty())
+        return true;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) < 0) {
+        std::cerr << "[RegisterBuffers] failed to register buffers: " << strerror(errno) << std::endl;
+        return false;
+    }
+    buffers_registered_ = true;
+    return true;
+}
+
+void IOUring::UnregisterBuffers() {
+    if (!buffers_registered_)
+        return;
+    syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    buffers_registered_ = false;
+}
+
+#else
+
+IOUring::IOUring(unsigned entries): ring_fd_(-1), sq_entries_(0), cq_entries_(0), sq_pending_(0),
+buffers_registered_(false) {}
+
+IOUring::~IOUring() {}
+
+bool IOUring::PrepareRead(int, char*, uint32_t, uint64_t, int, uint64_t) { return false; }
+
+bool IOUring::PrepareWrite(int, const char*, uint32_t, uint64_t, int, uint64_t) { return false; }
+
+bool IOUring::PrepareReadv(int, const iovec*, unsigned, uint64_t, uint64_t) { return false; }
+
+bool IOUring::PrepareWritev(int, const iovec*, unsigned, uint64_t, uint64_t) { return false; }
+
+int IOUring::Submit() { return -ENOSYS; }
+
+int IOUring::WaitCompletion() { return -ENOSYS; }
+
+size_t IOUring::PopCompletions(Completion*, size_t) { return 0; }
+
+bool IOUring::RegisterBuffers(const std::vector<iovec>&) { return false; }
+
+void IOUring::UnregisterBuffers() {}
+
+#endif
@@ -1,93 +1,176 @@
-#include <chrono>
+#include <algorithm>
 #include "lru_k_replacer.h"
 #include "cassert"
 #include "common.h"
 
-/* Maybe can optimize to have locking on LRUKNodes too? */
-
-void LRUKNode::RecordAccess() {
-    std::chrono::time_point now = std::chrono::steady_clock::now();
-    if (times_.size() >= k_) {
-        times_.pop_front();
+void LRUKNode::RecordAccess(size_t timestamp) {
+    if (history_size_ < k_) {
+        history_[history_size_++] = timestamp;
+        return;
     }
-    times_.push_back(now.time_since_epoch().count());
+
+    /* Ring is full. Overwrite the oldest access, and the next one becomes the oldest. */
+    history_[history_head_] = timestamp;
+    history_head_ = (history_head_ + 1) % k_;
+}
+
+void LRUKNode::RestoreHistory(const LRUKNode& evicted) {
+    history_ = evicted.history_;
+    history_size_ = evicted.history_size_;
+    history_head_ = evicted.history_head_;
 }
 
-void LRUKNode::Evict() {
-    times_.clear();
+bool LRUKNode::EvictsBefore(const LRUKNode& that) const {
+    bool full = history_size_ == k_;
+    bool that_full = that.history_size_ == that.k_;
+    if (full != that_full)
+        return !full;
+    if (OldestAccess() != that.OldestAccess())
+        return OldestAccess() < that.OldestAccess();
+    return fid_ < that.fid_;
 }
 
-LRUKReplacer::LRUKReplacer(size_t num_frames, size_t k): num_frames_(num_frames), k_(k) {
+LRUKReplacer::LRUKReplacer(size_t num_frames, size_t k, FrameStateTable* frames, Metrics* metrics):
+Replacer(num_frames, frames, metrics), num_frames_(num_frames),
+k_(k), current_timestamp_(0) {
+    assert(k > 0 && k <= LRUK_MAX_K);
     lru_nodes_.reserve(num_frames);
     for (int i=0; i<num_frames; i++)
         lru_nodes_.emplace_back(i, k);
+    heap_.reserve(num_frames);
 }
 
-/* TODO: Slightly incorrect because we evict any node that has < k accesses immediately. To fix. */
-std::optional<frame_id_t> LRUKReplacer::Evict(){
-    lock_.lock();
-
-    /* LRU K algorithm */
-    std::optional<frame_id_t> evictable_frame_id = std::nullopt;
-    size_t current_time_since_epoch = std::chrono::steady_clock::now().time_since_epoch().count();
-    size_t max_backward_k_distance = 0;
+void LRUKReplacer::HeapSwap(size_t i, size_t j) {
+    std::swap(heap_[i], heap_[j]);
+    lru_nodes_[heap_[i]].heap_index_ = i;
+    lru_nodes_[heap_[j]].heap_index_ = j;
+}
 
-    for (int i=0; i<num_frames_; i++) {
-        LRUKNode& node = lru_nodes_[i];
-        if (!node.GetEvictable())
-            continue;
+void LRUKReplacer::SiftUp(size_t i) {
+    while (i > 0 && HeapLess(i, (i - 1) / 2)) {
+        HeapSwap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
 
-        std::list<size_t>& times = node.GetTimes();
-        size_t node_num_accesses = times.size();
-        size_t node_backward_k_distance = current_time_since_epoch - times.front();
+void LRUKReplacer::SiftDown(size_t i) {
+    while (true) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = 2 * i + 2;
+        if (left < heap_.size() && HeapLess(left, smallest))
+            smallest = left;
+        if (right < heap_.size() && HeapLess(right, smallest))
+            smallest = right;
+        if (smallest == i)
+            return;
+        HeapSwap(i, smallest);
+        i = smallest;
+    }
+}
 
-        if (node_num_accesses < k_) {
-            evictable_frame_id = node.GetFrameId();
-            break;
-        }
+void LRUKReplacer::HeapInsert(frame_id_t frame_id) {
+    heap_.push_back(frame_id);
+    lru_nodes_[frame_id].heap_index_ = heap_.size() - 1;
+    SiftUp(heap_.size() - 1);
+}
 
-        if (node_backward_k_distance >= max_backward_k_distance) {
-            max_backward_k_distance = node_backward_k_distance;
-            evictable_frame_id = node.GetFrameId();
-        }
+void LRUKReplacer::HeapErase(frame_id_t frame_id) {
+    size_t i = lru_nodes_[frame_id].heap_index_;
+    HeapSwap(i, heap_.size() - 1);
+    heap_.pop_back();
+    lru_nodes_[frame_id].heap_index_ = LRUKNode::NOT_IN_HEAP;
+
+    /* The frame moved into position i may belong further up or down. */
+    if (i < heap_.size()) {
+        frame_id_t moved = heap_[i];
+        SiftUp(i);
+        SiftDown(lru_nodes_[moved].heap_index_);
     }
+}
 
-    /* evict frame */
-    if (evictable_frame_id.has_value()) {
-        LRUKNode& node = lru_nodes_[evictable_frame_id.value()];
-        assert(node.GetEvictable());
+void LRUKReplacer::RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) {
+    LRUKNode& node = lru_nodes_[frame_id];
+    if (node.GetPageId() != page_id) {
+        /* The frame holds a new page. If the page was evicted recently, it keeps its history. */
         node.Evict();
+        node.SetPageId(page_id);
+        auto it = evicted_.find(page_id);
+        if (it != evicted_.end()) {
+            node.RestoreHistory(it->second);
+            evicted_.erase(it);
+            evicted_order_.Erase(page_id);
+        }
+        if (node.heap_index_ == LRUKNode::NOT_IN_HEAP) {
+            if (hint == AccessHint::POINT)
+                node.RecordAccess(++current_timestamp_);
+            HeapInsert(frame_id);
+            return;
+        }
+        SiftUp(node.heap_index_);
+        SiftDown(node.heap_index_);
     }
+    if (hint != AccessHint::POINT)
+        return;
+    node.RecordAccess(++current_timestamp_);
 
-    lock_.unlock();
-    return evictable_frame_id;
+    /* An access only moves the frame later in eviction order. */
+    SiftDown(node.heap_index_);
 }
 
-void LRUKReplacer::RecordAccess(frame_id_t frame_id) {
-    lock_.lock();
+std::optional<frame_id_t> LRUKReplacer::EvictLocked() {
+    frame_id_t frame_id = INVALID_FRAME_ID;
+    while (!heap_.empty()) {
+        frame_id_t candidate = heap_.front();
+        FrameStateWord& state = State(candidate);
+        if (state.ClearReferenced()) {
+            /* Hit since Evict last looked at the frame. */
+            lru_nodes_[candidate].RecordAccess(++current_timestamp_);
+            SiftDown(0);
+            continue;
+        }
+        HeapErase(candidate);
+        if (state.TryClaim()) {
+            frame_id = candidate;
+            break;
+        }
+        skipped_.push_back(candidate);
+    }
+    for (frame_id_t skipped : skipped_)
+        HeapInsert(skipped);
+    skipped_.clear();
+    if (frame_id == INVALID_FRAME_ID)
+        return std::nullopt;
+
+    /* Remember the evicted page's history, forgetting the oldest evicted page beyond capacity. */
     LRUKNode& node = lru_nodes_[frame_id];
-    node.RecordAccess();
-    lock_.unlock();
+    if (node.GetPageId() != INVALID_PAGE_ID && node.HasHistory()) {
+        evicted_.insert_or_assign(node.GetPageId(), node);
+        evicted_order_.Erase(node.GetPageId());
+        evicted_order_.PushFront(node.GetPageId());
+        if (evicted_order_.Size() > capacity_)
+            evicted_.erase(evicted_order_.PopBack());
+    }
+    node.Evict();
+    return frame_id;
 }
 
-void LRUKReplacer::SetEvictable(frame_id_t frame_id) {
-    lock_.lock();
-    LRUKNode& node = lru_nodes_[frame_id];
-    node.SetEvictable();
-    lock_.unlock();
+void LRUKReplacer::RemoveLocked(frame_id_t frame_id) {
+    if (lru_nodes_[frame_id].heap_index_ != LRUKNode::NOT_IN_HEAP)
+        HeapErase(frame_id);
+    lru_nodes_[frame_id].Evict();
 }
 
-void LRUKReplacer::SetNotEvictable(frame_id_t frame_id) {
-    lock_.lock();
-    LRUKNode& node = lru_nodes_[frame_id];
-    node.SetNotEvictable();
-    lock_.unlock();
+size_t LRUKReplacer::SizeLocked() {
+    size_t size = 0;
+    for (frame_id_t frame_id : heap_)
+        size += State(frame_id).IsClaimable();
+    return size;
 }
 
-void LRUKReplacer::Remove(frame_id_t frame_id) {
-    lock_.lock();
-    LRUKNode& node = lru_nodes_[frame_id];
-    assert(node.GetEvictable());
-    node.Evict();
-    lock_.unlock();
+void LRUKReplacer::ResizeLocked(size_t num_frames) {
+    for (size_t i=num_frames_; i<num_frames; i++)
+        lru_nodes_.emplace_back(i, k_);
+    num_frames_ = std::max(num_frames_, num_frames);
+    heap_.reserve(num_frames_);
 }
@@ -0,0 +1,71 @@
+#include "metrics.h"
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+
+size_t HistogramSnapshot::Count() const {
+    size_t count = 0;
+    for (size_t i=0; i<LATENCY_HISTOGRAM_BUCKETS; i++)
+        count += buckets_[i];
+    return count;
+}
+
+uint64_t HistogramSnapshot::Percentile(double p) const {
+    size_t count = Count();
+    if (count == 0)
+        return 0;
+
+    /* Rank of the percentile, counting from 1. */
+    size_t rank = std::max(static_cast<size_t>(std::ceil(p / 100 * count)), size_t(1));
+    size_t seen = 0;
+    for (size_t i=0; i<LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets_[i];
+        if (seen >= rank)
+            return (uint64_t(1) << (i + 1)) - 1;
+    }
+    return (uint64_t(1) << LATENCY_HISTOGRAM_BUCKETS) - 1;
+}
+
+double MetricsSnapshot::HitRatio() const {
+    size_t fetches = Get(Metric::HITS) + Get(Metric::MISSES);
+    if (fetches == 0)
+        return 0;
+    return static_cast<double>(Get(Metric::HITS)) / fetches;
+}
+
+Metrics::Metrics(): stripes_(new Stripe[METRICS_STRIPES]) {
+    for (size_t s=0; s<METRICS_STRIPES; s++) {
+        for (size_t m=0; m<NUM_METRICS; m++)
+            stripes_[s].metrics_[m].store(0);
+        for (size_t h=0; h<NUM_HISTOGRAMS; h++) {
+            for (size_t b=0; b<LATENCY_HISTOGRAM_BUCKETS; b++)
+                stripes_[s].histograms_[h][b].store(0);
+        }
+    }
+}
+
+Metrics::Stripe& Metrics::LocalStripe() {
+    /* Threads are assigned stripes round robin, the first time they update any Metrics. */
+    static std::atomic<size_t> next_stripe = 0;
+    thread_local size_t stripe = next_stripe.fetch_add(1) % METRICS_STRIPES;
+    return stripes_[stripe];
+}
+
+void Metrics::Record(LatencyHistogram histogram, uint64_t latency_ns) {
+    size_t bucket = latency_ns == 0 ? 0 : 63 - __builtin_clzll(latency_ns);
+    bucket = std::min(bucket, size_t(LATENCY_HISTOGRAM_BUCKETS - 1));
+    LocalStripe().histograms_[static_cast<size_t>(histogram)][bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+MetricsSnapshot Metrics::Snapshot() {
+    MetricsSnapshot snapshot{};
+    for (size_t s=0; s<METRICS_STRIPES; s++) {
+        for (size_t m=0; m<NUM_METRICS; m++)
+            snapshot.metrics_[m] += stripes_[s].metrics_[m].load(std::memory_order_relaxed);
+        for (size_t h=0; h<NUM_HISTOGRAMS; h++) {
+            for (size_t b=0; b<LATENCY_HISTOGRAM_BUCKETS; b++)
+                snapshot.histograms_[h].buckets_[b] += stripes_[s].histograms_[h][b].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
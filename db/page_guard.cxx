@@ -2,7 +2,6 @@
 #include "background_scheduler.h"
 #include "buffer_manager.h"
 #include "common.h"
-#include "lru_k_replacer.h"
 #include <iostream>
 #include <memory>
 #include <mutex>
@@ -15,20 +14,16 @@
  */
 
 GuardedPageReader::GuardedPageReader(
-    page_id_t page_id, std::shared_ptr<Frame> frame, std::shared_ptr<std::mutex> bpm_latch,
-    std::shared_ptr<LRUKReplacer> lru_replacer, std::shared_ptr<Background_Scheduler> background_scheduler
+    page_id_t page_id, Frame* frame, std::shared_ptr<Background_Scheduler> background_scheduler
 ): 
-    page_id_(page_id), frame_(frame), bpm_latch_(bpm_latch),
-    lru_replacer_(lru_replacer), background_scheduler_(background_scheduler) {
+    page_id_(page_id), frame_(frame), background_scheduler_(background_scheduler) {
     rlock_ = std::shared_lock<std::shared_mutex>(frame->GetMutex());
-    frame_->IncPinCount();
     is_pinned_ = true;
-    lru_replacer_->SetNotEvictable(frame_->GetFrameId());
 }
 
 GuardedPageReader::~GuardedPageReader() {
     /* Reader has transfered ownership. */
-    if (bpm_latch_ == nullptr)
+    if (frame_ == nullptr)
         return;
     
     Drop();
@@ -36,9 +31,7 @@ GuardedPageReader::~GuardedPageReader() {
 
 GuardedPageReader::GuardedPageReader(GuardedPageReader&& that) noexcept:
     page_id_(that.page_id_),
-    frame_(std::move(that.frame_)),
-    bpm_latch_(std::move(that.bpm_latch_)),
-    lru_replacer_(std::move(that.lru_replacer_)),
+    frame_(that.frame_),
     background_scheduler_(std::move(that.background_scheduler_)) {
     /* Invalidate the old reader. */
     this->rlock_ = std::move(that.rlock_);
@@ -46,8 +39,6 @@ GuardedPageReader::GuardedPageReader(GuardedPageReader&& that) noexcept:
     that.is_pinned_ = false;
     that.page_id_ = INVALID_PAGE_ID;
     that.frame_ = nullptr;
-    that.bpm_latch_ = nullptr;
-    that.lru_replacer_ = nullptr;
     that.background_scheduler_ = nullptr;
 }
 
@@ -64,16 +55,12 @@ GuardedPageReader& GuardedPageReader::operator=(GuardedPageReader&& that) noexce
     this->is_pinned_ = that.is_pinned_;
     that.is_pinned_ = false;
     page_id_ = that.page_id_,
-    frame_ = std::move(that.frame_),
-    bpm_latch_ = std::move(that.bpm_latch_),
-    lru_replacer_ = std::move(that.lru_replacer_),
+    frame_ = that.frame_,
     background_scheduler_ = std::move(that.background_scheduler_);
 
     /* Invalidate old reader. */
     that.page_id_ = INVALID_PAGE_ID;
     that.frame_ = nullptr;
-    that.bpm_latch_ = nullptr;
-    that.lru_replacer_ = nullptr;
     that.background_scheduler_ = nullptr;
 
     return *this;
@@ -85,28 +72,83 @@ const char* GuardedPageReader::GetData() const {
 
 void GuardedPageReader::Drop() {
     if (is_pinned_) {
-        frame_->DecPinCount();
         is_pinned_ = false;
-        if (frame_->GetPinCount() == 0)
-            lru_replacer_->SetEvictable(frame_->GetFrameId());
         rlock_.unlock();
+
+        /* A single atomic decrement. Eviction reads the pin count from the frame's state word. */
+        frame_->Unpin();
+    }
+}
+
+GuardedPageReaderSet::GuardedPageReaderSet(std::vector<page_id_t> page_ids, std::vector<Frame*> frames):
+    page_ids_(std::move(page_ids)), frames_(std::move(frames)) {
+    rlocks_.reserve(frames_.size());
+    for (Frame* frame : frames_)
+        rlocks_.emplace_back(frame->GetMutex());
+    is_pinned_ = true;
+}
+
+GuardedPageReaderSet::~GuardedPageReaderSet() {
+    Drop();
+}
+
+GuardedPageReaderSet::GuardedPageReaderSet(GuardedPageReaderSet&& that) noexcept:
+    page_ids_(std::move(that.page_ids_)),
+    frames_(std::move(that.frames_)),
+    rlocks_(std::move(that.rlocks_)),
+    is_pinned_(that.is_pinned_) {
+    /* Invalidate the old set. */
+    that.is_pinned_ = false;
+}
+
+GuardedPageReaderSet& GuardedPageReaderSet::operator=(GuardedPageReaderSet&& that) noexcept {
+    /* Self-assignment detection. */
+    if (&that == this)
+        return *this;
+
+    /* Release resources held by LHS object (this), since it is being replaced. */
+    this->Drop();
+
+    /* Transfer ownership */
+    page_ids_ = std::move(that.page_ids_);
+    frames_ = std::move(that.frames_);
+    rlocks_ = std::move(that.rlocks_);
+    is_pinned_ = that.is_pinned_;
+
+    /* Invalidate old set. */
+    that.is_pinned_ = false;
+
+    return *this;
+}
+
+const char* GuardedPageReaderSet::GetData(size_t i) const {
+    return frames_[i]->GetData();
+}
+
+void GuardedPageReaderSet::Drop() {
+    if (is_pinned_) {
+        is_pinned_ = false;
+        rlocks_.clear();
+        UnpinFrames(frames_);
     }
 }
 
+void GuardedPageReaderSet::UnpinFrames(const std::vector<Frame*>& frames) {
+    for (Frame* frame : frames)
+        frame->Unpin();
+}
+
 GuardedPageWriter::GuardedPageWriter(
-    page_id_t page_id, std::shared_ptr<Frame> frame, std::shared_ptr<std::mutex> bpm_latch,
-    std::shared_ptr<LRUKReplacer> lru_replacer, std::shared_ptr<Background_Scheduler> background_scheduler
+    page_id_t page_id, Frame* frame, std::shared_ptr<Background_Scheduler> background_scheduler
 ): 
-    page_id_(page_id), frame_(frame), bpm_latch_(bpm_latch),
-    lru_replacer_(lru_replacer), background_scheduler_(background_scheduler) {
+    page_id_(page_id), frame_(frame), background_scheduler_(background_scheduler) {
     wlock_ = std::unique_lock<std::shared_mutex>(frame->GetMutex());
-    frame->IncPinCount();
+    frame->BeginWrite();
     is_pinned_ = true;
-    lru_replacer_->SetNotEvictable(frame_->GetFrameId());
 }
 
 GuardedPageWriter::~GuardedPageWriter() {
-    if (bpm_latch_ == nullptr)
+    if (frame_ == nullptr)
         return;
     
     Drop();
@@ -114,9 +156,7 @@ GuardedPageWriter::~GuardedPageWriter() {
 
 GuardedPageWriter::GuardedPageWriter(GuardedPageWriter&& that):
     page_id_(that.page_id_),
-    frame_(std::move(that.frame_)),
-    bpm_latch_(std::move(that.bpm_latch_)),
-    lru_replacer_(std::move(that.lru_replacer_)),
+    frame_(that.frame_),
     background_scheduler_(std::move(that.background_scheduler_)) {
     /* Invalidate the old reader. */
     this->wlock_ = std::move(that.wlock_);
@@ -124,8 +164,6 @@ GuardedPageWriter::GuardedPageWriter(GuardedPageWriter&& that):
     that.is_pinned_ = false;
     that.page_id_ = INVALID_PAGE_ID;
     that.frame_ = nullptr;
-    that.bpm_latch_ = nullptr;
-    that.lru_replacer_ = nullptr;
     that.background_scheduler_ = nullptr;
 }
 
@@ -142,16 +180,12 @@ GuardedPageWriter& GuardedPageWriter::operator=(GuardedPageWriter&& that) {
     this->is_pinned_ = that.is_pinned_;
     that.is_pinned_ = false;
     page_id_ = that.page_id_,
-    frame_ = std::move(that.frame_),
-    bpm_latch_ = std::move(that.bpm_latch_),
-    lru_replacer_ = std::move(that.lru_replacer_),
+    frame_ = that.frame_,
     background_scheduler_ = std::move(that.background_scheduler_);
 
     /* Invalidate old reader. */
     that.page_id_ = INVALID_PAGE_ID;
     that.frame_ = nullptr;
-    that.bpm_latch_ = nullptr;
-    that.lru_replacer_ = nullptr;
     that.background_scheduler_ = nullptr;
 
     return *this;
@@ -167,26 +201,97 @@ char* GuardedPageWriter::GetDataMut() {
     return frame_->GetDataMut();
 }
 
-void GuardedPageWriter::FlushPage() {
+bool GuardedPageWriter::FlushPage() {
     std::shared_ptr<Request> write_req = std::make_shared<Request>(false, page_id_, frame_->GetData());
     background_scheduler_->Schedule(write_req);
     try {
-        write_req.get()->promise_.get_future().get();
+        return write_req.get()->promise_->get_future().get();
     } catch (const std::exception &e) {
-        std::cerr << "[FlushPage] " << e.what();
+        std::cerr << "[FlushPage] " << e.what() << std::endl;
+        return false;
     }
 }
 
 void GuardedPageWriter::Drop() {
     if (is_pinned_) {
-        frame_->DecPinCount();
         is_pinned_ = false;
-        if (frame_->GetPinCount() == 0)
-            lru_replacer_->SetEvictable(frame_->GetFrameId());
+        frame_->EndWrite();
         wlock_.unlock();
+        frame_->Unpin();
     }
 }
 
 const page_id_t GuardedPageWriter::GetPageId() const {
     return page_id_;
-}
\ No newline at end of file
+}
+
+OptimisticPageReader::OptimisticPageReader(page_id_t page_id, Frame* frame):
+    page_id_(page_id), frame_(frame), version_(0) {}
+
+bool OptimisticPageReader::Restart() {
+    version_ = frame_->GetVersion();
+    if (version_ % 2 != 0)
+        return false;
+
+    /* Unmapping the frame bumps the version, so a frame that still holds the page now keeps it until Validate() fails. */
+    return frame_->GetPageId() == page_id_ && frame_->IsLoaded();
+}
+
+bool OptimisticPageReader::Validate() const {
+    return frame_->ValidateVersion(version_);
+}
+
+PageReadAwaitable::PageReadAwaitable(BufferManager* bpm, page_id_t page_id, Executor* executor, AccessHint hint):
+    bpm_(bpm), page_id_(page_id), executor_(executor), hint_(hint), frame_(nullptr), must_read_(false) {}
+
+bool PageReadAwaitable::await_ready() {
+    std::optional<std::pair<frame_id_t, bool>> pinned = bpm_->PinOrLoadFrame(page_id_, hint_);
+    if (!pinned.has_value())
+        return true;
+    frame_ = &bpm_->frames_[pinned->first];
+    must_read_ = pinned->second;
+
+    /* A hit on a resident page does not suspend. */
+    return !must_read_ && frame_->IsLoaded();
+}
+
+bool PageReadAwaitable::await_suspend(std::coroutine_handle<> waiter) {
+    waiter_ = waiter;
+
+    /* Another fetch is reading the page. Its FinishLoading posts us, unless it is already done. */
+    if (!must_read_)
+        return frame_->WhenLoaded([this] { executor_->Post(waiter_); });
+
+    /*
+     * The request is not owned by the scheduler: the coroutine, and with it the request, stays suspended until
+     * the callback posts it, and the worker does not touch the request after calling the callback.
+     */
+    request_.emplace(page_id_, frame_->GetDataMut(), [this](bool ok) { OnRead(ok); });
+    bpm_->background_scheduler_->Schedule(std::shared_ptr<Request>(std::shared_ptr<Request>(), &request_.value()));
+    return true;
+}
+
+void PageReadAwaitable::OnRead(bool ok) {
+    if (ok) {
+        frame_->FinishLoading();
+    } else {
+        std::cerr << "[FetchRead] failed to read page " << page_id_ << "!" << std::endl;
+        bpm_->FailLoad(frame_->GetFrameId(), page_id_, false);
+        frame_ = nullptr;
+    }
+
+    /* The coroutine may run, and free this awaitable, as soon as it is posted. */
+    executor_->Post(waiter_);
+}
+
+std::optional<GuardedPageReader> PageReadAwaitable::await_resume() {
+    if (frame_ == nullptr)
+        return std::nullopt;
+
+    /* Another fetch's read failed, and the page was unmapped. */
+    if (frame_->GetPageId() != page_id_) {
+        frame_->Unpin();
+        return std::nullopt;
+    }
+    return std::optional<GuardedPageReader>(std::in_place, page_id_, frame_, bpm_->background_scheduler_);
+}
@@ -0,0 +1,123 @@
+#include "replacer.h"
+#include "arc_replacer.h"
+#include "clock_replacer.h"
+#include "common.h"
+#include "lru_k_replacer.h"
+#include "two_q_replacer.h"
+
+std::optional<frame_id_t> Replacer::Evict() {
+    Lock();
+    std::optional<frame_id_t> frame_id = EvictLocked();
+    lock_.unlock();
+    return frame_id;
+}
+
+void Replacer::RecordAccess(frame_id_t frame_id, page_id_t page_id, AccessHint hint) {
+    Lock();
+    RecordAccessLocked(frame_id, page_id, hint);
+    lock_.unlock();
+}
+
+void Replacer::Remove(frame_id_t frame_id) {
+    Lock();
+    RemoveLocked(frame_id);
+    lock_.unlock();
+}
+
+void Replacer::Resize(size_t num_frames) {
+    Lock();
+    ResizeLocked(num_frames);
+    lock_.unlock();
+}
+
+void Replacer::SetCapacity(size_t capacity) {
+    Lock();
+    capacity_ = capacity;
+    lock_.unlock();
+}
+
+size_t Replacer::Size() {
+    Lock();
+    size_t size = SizeLocked();
+    lock_.unlock();
+    return size;
+}
+
+size_t Replacer::CountClaimable(const FrameList& list) {
+    size_t count = 0;
+    for (frame_id_t frame_id = list.Back(); frame_id != INVALID_FRAME_ID; frame_id = list.Prev(frame_id))
+        count += State(frame_id).IsClaimable();
+    return count;
+}
+
+std::shared_ptr<Replacer> MakeReplacer(ReplacerType type, size_t num_frames, size_t k, FrameStateTable* frames,
+    Metrics* metrics) {
+    switch (type) {
+        case ReplacerType::CLOCK:
+            return std::make_shared<ClockReplacer>(num_frames, frames, metrics);
+        case ReplacerType::TWO_Q:
+            return std::make_shared<TwoQReplacer>(num_frames, frames, metrics);
+        case ReplacerType::ARC:
+            return std::make_shared<ARCReplacer>(num_frames, frames, metrics);
+        case ReplacerType::LRU_K:
+        default:
+            return std::make_shared<LRUKReplacer>(num_frames, k, frames, metrics);
+    }
+}
+
+void FrameList::PushFront(frame_id_t frame_id) {
+    prev_[frame_id] = INVALID_FRAME_ID;
+    next_[frame_id] = head_;
+    if (head_ != INVALID_FRAME_ID)
+        prev_[head_] = frame_id;
+    else
+        tail_ = frame_id;
+    head_ = frame_id;
+    size_++;
+}
+
+void FrameList::PushBack(frame_id_t frame_id) {
+    prev_[frame_id] = tail_;
+    next_[frame_id] = INVALID_FRAME_ID;
+    if (tail_ != INVALID_FRAME_ID)
+        next_[tail_] = frame_id;
+    else
+        head_ = frame_id;
+    tail_ = frame_id;
+    size_++;
+}
+
+void FrameList::Erase(frame_id_t frame_id) {
+    if (prev_[frame_id] != INVALID_FRAME_ID)
+        next_[prev_[frame_id]] = next_[frame_id];
+    else
+        head_ = next_[frame_id];
+    if (next_[frame_id] != INVALID_FRAME_ID)
+        prev_[next_[frame_id]] = prev_[frame_id];
+    else
+        tail_ = prev_[frame_id];
+    prev_[frame_id] = INVALID_FRAME_ID;
+    next_[frame_id] = INVALID_FRAME_ID;
+    size_--;
+}
+
+void GhostList::PushFront(page_id_t page_id) {
+    order_.push_front(page_id);
+    index_[page_id] = order_.begin();
+}
+
+bool GhostList::Erase(page_id_t page_id) {
+    auto it = index_.find(page_id);
+    if (it == index_.end())
+        return false;
+    order_.erase(it->second);
+    index_.erase(it);
+    return true;
+}
+
+page_id_t GhostList::PopBack() {
+    page_id_t page_id = order_.back();
+    order_.pop_back();
+    index_.erase(page_id);
+    return page_id;
+}
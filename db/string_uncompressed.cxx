@@ -75,15 +75,15 @@ idx_t UncompressedStringStorage::RemainingSpace(ColumnAppendState &append_state,
     return remaining_space;
 }
 
-std::unique_ptr<GuardedPageReader> UncompressedStringStorage::InitScan(ColumnSegment &segment) {
-    auto page_reader = segment.buffer_manager_->GetGuardedPageReader(segment.page_id_);
+std::unique_ptr<GuardedPageReader> UncompressedStringStorage::InitScan(ColumnSegment &segment, AccessHint access_hint) {
+    auto page_reader = segment.buffer_manager_->GetGuardedPageReader(segment.page_id_, access_hint);
     return std::make_unique<GuardedPageReader>(std::move(page_reader));
 }
 
 idx_t UncompressedStringStorage::Scan(ColumnScanState &scan_state, ColumnSegment &segment,
     std::vector<std::string> &result, idx_t count) {
     assert(result.size() >= count);
-    const char* ptr  = scan_state.read_guard->GetData();
+    const char* ptr = scan_state.mapped_data != nullptr ? scan_state.mapped_data : scan_state.read_guard->GetData();
     const int32_t* offsets = reinterpret_cast<const int32_t*>(ptr + DICTIONARY_HEADER_SIZE);
     const uint32_t* dictionary_size = reinterpret_cast<const uint32_t*>(ptr);
     const uint32_t* dictionary_end = reinterpret_cast<const uint32_t*>(ptr + sizeof(uint32_t));
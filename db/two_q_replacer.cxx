@@ -0,0 +1,95 @@
+#include <algorithm>
+#include "two_q_replacer.h"
+#include "common.h"
+
+TwoQReplacer::TwoQReplacer(size_t num_frames, FrameStateTable* frames, Metrics* metrics):
+Replacer(num_frames, frames, metrics), num_frames_(num_frames), page_ids_(num_frames, INVALID_PAGE_ID),
+queues_(num_frames, Queue::NONE), cold_(num_frames, false), prev_(num_frames, INVALID_FRAME_ID),
+next_(num_frames, INVALID_FRAME_ID), a1in_(prev_, next_), am_(prev_, next_) {}
+
+void TwoQReplacer::Hit(frame_id_t frame_id) {
+    /* Hits in A1in are correlated references, and do not move the page, unless it was only scanned so far. */
+    if (queues_[frame_id] == Queue::AM || cold_[frame_id]) {
+        Unlink(frame_id);
+        (cold_[frame_id] ? a1in_ : am_).PushFront(frame_id);
+        queues_[frame_id] = cold_[frame_id] ? Queue::A1IN : Queue::AM;
+        cold_[frame_id] = false;
+    }
+}
+
+void TwoQReplacer::Unlink(frame_id_t frame_id) {
+    if (queues_[frame_id] == Queue::A1IN)
+        a1in_.Erase(frame_id);
+    else if (queues_[frame_id] == Queue::AM)
+        am_.Erase(frame_id);
+    queues_[frame_id] = Queue::NONE;
+}
+
+std::optional<frame_id_t> TwoQReplacer::EvictLocked() {
+    /*
+     * Pages only scanned go first. Then reclaim from A1in while it is over its share, and from Am otherwise,
+     * falling back to the other list.
+     */
+    auto hit = [this](frame_id_t frame_id) { Hit(frame_id); };
+    frame_id_t frame_id = INVALID_FRAME_ID;
+    frame_id_t oldest = a1in_.Back();
+    if (oldest != INVALID_FRAME_ID && (cold_[oldest] || a1in_.Size() > MaxA1In()))
+        frame_id = ClaimFromBack(a1in_, hit);
+    if (frame_id == INVALID_FRAME_ID)
+        frame_id = ClaimFromBack(am_, hit);
+    if (frame_id == INVALID_FRAME_ID)
+        frame_id = ClaimFromBack(a1in_, hit);
+    if (frame_id == INVALID_FRAME_ID)
+        return std::nullopt;
+
+    /* Only pages leaving A1in are remembered. Pages leaving Am have had their chance. */
+    if (queues_[frame_id] == Queue::A1IN && page_ids_[frame_id] != INVALID_PAGE_ID && !cold_[frame_id]) {
+        a1out_.Erase(page_ids_[frame_id]);
+        a1out_.PushFront(page_ids_[frame_id]);
+        if (a1out_.Size() > MaxA1Out())
+            a1out_.PopBack();
+    }
+    Unlink(frame_id);
+    page_ids_[frame_id] = INVALID_PAGE_ID;
+    return frame_id;
+}
+
+void TwoQReplacer::RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) {
+    if (queues_[frame_id] != Queue::NONE && page_ids_[frame_id] == page_id) {
+        if (hint == AccessHint::POINT)
+            Hit(frame_id);
+        return;
+    }
+
+    /* The frame holds a new page. */
+    Unlink(frame_id);
+    page_ids_[frame_id] = page_id;
+    cold_[frame_id] = hint != AccessHint::POINT;
+    if (cold_[frame_id]) {
+        a1out_.Erase(page_id);
+        a1in_.PushBack(frame_id);
+        queues_[frame_id] = Queue::A1IN;
+    } else if (a1out_.Erase(page_id)) {
+        am_.PushFront(frame_id);
+        queues_[frame_id] = Queue::AM;
+    } else {
+        a1in_.PushFront(frame_id);
+        queues_[frame_id] = Queue::A1IN;
+    }
+}
+
+void TwoQReplacer::RemoveLocked(frame_id_t frame_id) {
+    Unlink(frame_id);
+    page_ids_[frame_id] = INVALID_PAGE_ID;
+}
+
+void TwoQReplacer::ResizeLocked(size_t num_frames) {
+    if (num_frames <= num_frames_)
+        return;
+    page_ids_.resize(num_frames, INVALID_PAGE_ID);
+    queues_.resize(num_frames, Queue::NONE);
+    cold_.resize(num_frames, false);
+    prev_.resize(num_frames, INVALID_FRAME_ID);
+    next_.resize(num_frames, INVALID_FRAME_ID);
+    num_frames_ = num_frames;
+}
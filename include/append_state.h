@@ -12,5 +12,11 @@ struct ColumnAppendState {
 
 struct ColumnScanState {
     std::unique_ptr<GuardedPageReader> read_guard;
+    /* Full scans should not push hot pages out of the pool. Set to AccessHint::POINT for short, selective reads. */
+    AccessHint access_hint = AccessHint::SCAN;
+
+    /* Persistent segments are read through the file mapping, in mapped_data, rather than through read_guard. */
+    bool use_mapping = true;
+    const char* mapped_data = nullptr;
 
 };
\ No newline at end of file
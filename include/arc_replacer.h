@@ -0,0 +1,53 @@
+#include <optional>
+#include <vector>
+#include "common.h"
+#include "metrics.h"
+#include "replacer.h"
+
+#pragma once
+
+/*
+ * Adaptive Replacement Cache (Megiddo and Modha). T1 holds pages seen once recently, T2 pages seen at
+ * least twice, both in LRU order. B1 and B2 remember the pages last evicted from T1 and T2.
+ * A re-read of a page in B1 means T1 was too small, and grows its target size p, a re-read of a page in
+ * B2 shrinks it. Evict takes from T1 while it is larger than p, and from T2 otherwise. The capacity c bounds
+ * p, |T1| + |B1| and, at 2c, all four lists together.
+ *
+ * Pages read in by a scan or bulk load go to the LRU end of T1, do not adapt p, and are not remembered in B1.
+ *
+ * Pinned frames stay in their list, and are skipped by Evict. Hits on resident pages only set the frame's reference
+ * bit, and are applied when Evict comes across the frame.
+ */
+class ARCReplacer: public Replacer {
+    public:
+        ARCReplacer(size_t num_frames, FrameStateTable* frames, Metrics* metrics = nullptr);
+
+        ~ARCReplacer() = default;
+
+    protected:
+        std::optional<frame_id_t> EvictLocked() override;
+        void RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) override;
+        void RemoveLocked(frame_id_t frame_id) override;
+        void ResizeLocked(size_t num_frames) override;
+        size_t SizeLocked() override { return CountClaimable(t1_) + CountClaimable(t2_); }
+
+    private:
+        enum class Queue: uint8_t { NONE, T1, T2 };
+
+        size_t num_frames_;
+        size_t target_t1_size_;  /* p */
+        std::vector<page_id_t> page_ids_;
+        std::vector<Queue> queues_;
+        std::vector<bool> cold_;  /* Page was only accessed by scans or bulk loads. */
+        std::vector<frame_id_t> prev_;
+        std::vector<frame_id_t> next_;
+        FrameList t1_;
+        FrameList t2_;
+        GhostList b1_;
+        GhostList b2_;
+
+        /* Applies a hit on a tracked frame. */
+        void Hit(frame_id_t frame_id);
+
+        void Unlink(frame_id_t frame_id);
+};
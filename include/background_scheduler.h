@@ -1,46 +1,154 @@
-#include <queue>
 #include "common.h"
+#include <condition_variable>
+#include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sys/uio.h>
+#include <thread>
+#include "blocking_queue.h"
 #include "disk_manager.h"
+#include "io_uring.h"
+#include "metrics.h"
 
 #pragma once
 
+/*
+ * Priority classes of I/O requests, highest first. The scheduler serves a request of a higher class first, but
+ * a request that has waited IO_AGING_MS per class below FOREGROUND_READ is served ahead of newer ones.
+ */
+enum class IOPriority: uint8_t {
+    FOREGROUND_READ,    /* A thread is waiting for the page, e.g. a miss. */
+    EVICTION_WRITE,     /* A thread is waiting for the write, e.g. to reuse the frame. */
+    BACKGROUND_FLUSH,   /* Nobody waits: the flusher cleaning pages ahead of eviction. */
+    PREFETCH,           /* Nobody waits yet: prefetch and readahead. */
+    NUM_PRIORITIES
+};
+
+constexpr size_t NUM_IO_PRIORITIES = static_cast<size_t>(IOPriority::NUM_PRIORITIES);
+
 struct Request {
     bool read_;
     page_id_t page_id_;
     char *read_data_;         /* For read requests */
     const char *write_data_;  /* For write requests */
-    std::promise<bool> promise_;
+    IOPriority priority_;
+    uint64_t deadline_ns_;    /* Optional (0). Served ahead of higher classes once due, in Metrics::NowNs() time. */
+    std::optional<std::promise<bool>> promise_;  /* Unset if completion is only reported through on_complete_. */
+    std::function<void(bool)> on_complete_;  /* Optional. Called by the worker once the request is done. */
 
-    Request(bool read, page_id_t page_id, char* read_data):
-        read_(read), page_id_(page_id), read_data_(read_data) {}
+    Request(bool read, page_id_t page_id, char* read_data, IOPriority priority = IOPriority::FOREGROUND_READ,
+        uint64_t deadline_ns = 0):
+        read_(read), page_id_(page_id), read_data_(read_data), priority_(priority), deadline_ns_(deadline_ns),
+        promise_(std::in_place) {}
 
-    Request(bool read, page_id_t page_id, const char* write_data):
-        read_(read), page_id_(page_id), write_data_(write_data) {}
+    Request(bool read, page_id_t page_id, const char* write_data, IOPriority priority = IOPriority::EVICTION_WRITE,
+        uint64_t deadline_ns = 0):
+        read_(read), page_id_(page_id), write_data_(write_data), priority_(priority), deadline_ns_(deadline_ns),
+        promise_(std::in_place) {}
+
+    /*
+     * A read that reports completion only through on_complete, so it allocates no promise. The worker moves
+     * on_complete out of the request before calling it, so the callback may free the request.
+     */
+    Request(page_id_t page_id, char* read_data, std::function<void(bool)> on_complete,
+        IOPriority priority = IOPriority::FOREGROUND_READ):
+        read_(true), page_id_(page_id), read_data_(read_data), priority_(priority), deadline_ns_(0),
+        on_complete_(std::move(on_complete)) {}
 
     Request(const Request&) = delete;
 
     Request(Request&& that): read_(that.read_), page_id_(that.page_id_),
-    read_data_(that.read_data_), write_data_(that.write_data_), promise_(std::move(that.promise_)) {}
+    read_data_(that.read_data_), write_data_(that.write_data_), priority_(that.priority_),
+    deadline_ns_(that.deadline_ns_), promise_(std::move(that.promise_)), on_complete_(std::move(that.on_complete_)) {}
 
 };
 
+/*
+ * THREAD_POOL: every worker thread serves one request at a time, with blocking DiskManager calls.
+ * IO_URING: one thread submits the queued requests in batches to an io_uring, and completes them as the kernel
+ * reaps them. No thread is parked per outstanding request, and a batch costs one system call.
+ */
+enum class IOBackend: uint8_t { THREAD_POOL, IO_URING };
+
+/*
+ * Pool of I/O workers, fed by a bounded queue of requests. Workers sleep while the queue is empty, and
+ * Schedule blocks while it is full. Requests are served in parallel, by priority class and deadline, but
+ * otherwise in no particular order: callers that need an order wait for the earlier request's promise first.
+ *
+ * If an io_uring cannot be set up, the scheduler falls back to the thread pool.
+ */
 class Background_Scheduler {
     private:
         std::vector<std::thread> background_threads_;
-        std::queue<std::shared_ptr<Request>> request_queue_;
-        std::mutex request_queue_lock_;
+        PriorityBlockingQueue<std::shared_ptr<Request>> request_queue_;
         DiskManager* disk_manager_;
-        bool stop_ = false;
-        /* 
-        TODO: support multiple threads
-        std::condition_variable cv_;
-        std::mutex request_queue_lock_;
-        */
+        Metrics* metrics_; /* Optional. Disk read and write latencies are recorded here. */
+
+        IOBackend backend_;
+        std::unique_ptr<IOUring> ring_;
+        std::mutex ring_latch_;  /* Keeps buffer registration from racing with submissions that use the buffers. */
+        std::vector<iovec> registered_buffers_;
+
+        /*
+         * Group commit. Barriers requested while no sync is pending create the next group; later ones join it
+         * and share its future. The syncer serves one group per fdatasync, so barriers requested while a sync
+         * is running are batched into the next one.
+         */
+        std::thread syncer_thread_;
+        std::mutex sync_latch_;
+        std::condition_variable sync_cv_;
+        std::optional<std::promise<bool>> next_sync_;
+        std::shared_future<bool> next_sync_future_;
+        bool stop_syncer_;
+
+        /* How long a request of each priority class may be passed over by higher classes. */
+        static std::vector<uint64_t> ClassDelays();
+
+        void RunWorker();
+        void RunRing();
+        void RunSyncer();
+        void Serve(Request& r);
+        void ServeBatch(const std::vector<std::shared_ptr<Request>>& batch);
+        void Complete(Request& r, std::exception_ptr error, uint64_t start);
+
+        /* Index of the registered buffer holding [data, data + len), or -1. */
+        int FindRegisteredBuffer(const char* data, size_t len);
+
     public:
-        Background_Scheduler(DiskManager* disk_manager);
+        Background_Scheduler(DiskManager* disk_manager, Metrics* metrics = nullptr,
+            size_t num_threads = NUM_BACKGROUND_THREADS, size_t queue_capacity = IO_QUEUE_CAPACITY,
+            IOBackend backend = DEFAULT_IO_BACKEND);
+
+        /* Serves the requests and sync barriers already queued, then stops the workers. */
         ~Background_Scheduler();
-        void Schedule(std::shared_ptr<Request> req); /* TODO: add error handling */
+
+        /* Queues a request. If the scheduler is stopping, the request fails straight away. */
+        void Schedule(std::shared_ptr<Request> req);
         void DeletePage(page_id_t page_id);
         bool CheckPageExists(page_id_t page_id);
+
+        /* Allocates the pages on disk right away, as one extent. See DiskManager::AllocatePages. */
+        bool AllocatePages(page_id_t first_page_id, size_t num_pages);
+
+        const char* MapPage(page_id_t page_id);
+
+        /*
+         * Sync barrier: the future becomes true once every write completed before the call is durable, or false
+         * if the sync failed. Writes still queued or in flight are not covered; wait for their requests first.
+         */
+        std::shared_future<bool> SyncBarrier();
+
+        size_t GetNumThreads() { return background_threads_.size(); }
+
+        /* The backend in use, i.e. THREAD_POOL if the io_uring backend was asked for but is unavailable. */
+        IOBackend GetBackend() { return backend_; }
+
+        /*
+         * Registers memory that requests read into and write from (e.g. the buffer pool's frames) with the
+         * io_uring, replacing the buffers registered before. Returns false if there is no io_uring, or the
+         * kernel refused; requests then still work, just without fixed buffers.
+         */
+        bool RegisterBuffers(const std::vector<iovec>& buffers);
 };
\ No newline at end of file
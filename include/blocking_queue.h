@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#pragma once
+
+/*
+ * Bounded multi-producer multi-consumer queue with priority classes, class 0 being the highest. Producers
+ * block while it is full, and consumers sleep while it is empty, so idle consumers burn no CPU.
+ *
+ * Pop takes the oldest item of the highest non-empty class, unless an item is past its deadline: overdue items
+ * are taken first, earliest deadline first. An item's deadline defaults to the time it was pushed plus its
+ * class's delay, so a lower class waits at most that long behind a steady stream of higher class items.
+ * Deadlines are in steady_clock nanoseconds.
+ *
+ * Close() wakes up everyone. Pushes fail from then on, but consumers still drain the queued items.
+ */
+template <typename T>
+class PriorityBlockingQueue {
+    private:
+        struct Entry {
+            uint64_t deadline_ns_;
+            uint64_t seq_;  /* Breaks ties between equal deadlines in push order. */
+            T item_;
+        };
+
+        /* Per class min-heap on (deadline, seq). With default deadlines, that is push order. */
+        static bool Later(const Entry& a, const Entry& b) {
+            return a.deadline_ns_ != b.deadline_ns_ ? a.deadline_ns_ > b.deadline_ns_ : a.seq_ > b.seq_;
+        }
+
+        std::vector<std::vector<Entry>> classes_;
+        std::vector<uint64_t> class_delays_ns_;
+        size_t capacity_;
+        size_t size_;
+        uint64_t next_seq_;
+        bool closed_;
+        std::mutex latch_;
+        std::condition_variable not_empty_;
+        std::condition_variable not_full_;
+
+        std::optional<T> PopLocked(std::unique_lock<std::mutex>& lock) {
+            if (size_ == 0)
+                return std::nullopt;
+
+            /* The first non-empty class, unless some class's head is overdue. */
+            uint64_t now = NowNs();
+            size_t pick = classes_.size();
+            for (size_t c=0; c<classes_.size(); c++) {
+                if (classes_[c].empty())
+                    continue;
+                const Entry& head = classes_[c].front();
+                if (pick == classes_.size())
+                    pick = c;
+                if (head.deadline_ns_ <= now && (classes_[pick].front().deadline_ns_ > now ||
+                    Later(classes_[pick].front(), head)))
+                    pick = c;
+            }
+
+            std::vector<Entry>& heap = classes_[pick];
+            std::pop_heap(heap.begin(), heap.end(), Later);
+            std::optional<T> item = std::move(heap.back().item_);
+            heap.pop_back();
+            size_--;
+            lock.unlock();
+            not_full_.notify_one();
+            return item;
+        }
+
+        /* Takes the entry out of its class's heap. */
+        std::optional<T> RemoveLocked(std::vector<Entry>& heap, typename std::vector<Entry>::iterator it,
+            std::unique_lock<std::mutex>& lock) {
+            std::optional<T> item = std::move(it->item_);
+            *it = std::move(heap.back());
+            heap.pop_back();
+            std::make_heap(heap.begin(), heap.end(), Later);
+            size_--;
+            lock.unlock();
+            not_full_.notify_one();
+            return item;
+        }
+
+    public:
+        static uint64_t NowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        PriorityBlockingQueue(size_t capacity, std::vector<uint64_t> class_delays_ns):
+        classes_(class_delays_ns.size()), class_delays_ns_(std::move(class_delays_ns)), capacity_(capacity), size_(0),
+        next_seq_(0), closed_(false) {}
+
+        PriorityBlockingQueue(const PriorityBlockingQueue&) = delete;
+        PriorityBlockingQueue& operator=(const PriorityBlockingQueue&) = delete;
+
+        /*
+         * Blocks while the queue is full. Returns false, without queueing item, if the queue is closed.
+         * A deadline of 0 means the class's default.
+         */
+        bool Push(T item, size_t priority_class, uint64_t deadline_ns = 0) {
+            std::unique_lock<std::mutex> lock(latch_);
+            not_full_.wait(lock, [this] { return closed_ || size_ < capacity_; });
+            if (closed_)
+                return false;
+            if (deadline_ns == 0)
+                deadline_ns = NowNs() + class_delays_ns_[priority_class];
+            std::vector<Entry>& heap = classes_[priority_class];
+            heap.push_back(Entry{deadline_ns, next_seq_++, std::move(item)});
+            std::push_heap(heap.begin(), heap.end(), Later);
+            size_++;
+            lock.unlock();
+            not_empty_.notify_one();
+            return true;
+        }
+
+        /* Blocks while the queue is empty. Returns nullopt once the queue is closed and drained. */
+        std::optional<T> Pop() {
+            std::unique_lock<std::mutex> lock(latch_);
+            not_empty_.wait(lock, [this] { return closed_ || size_ > 0; });
+            return PopLocked(lock);
+        }
+
+        /* Pops an item if there is one, without blocking. */
+        std::optional<T> TryPop() {
+            std::unique_lock<std::mutex> lock(latch_);
+            return PopLocked(lock);
+        }
+
+        /*
+         * Pops an item of the class for which match returns true, if there is one, without blocking. Looks at
+         * every queued item of the class, regardless of deadlines: the other items stay queued.
+         */
+        template <typename Match>
+        std::optional<T> TryPopIf(size_t priority_class, Match match) {
+            std::unique_lock<std::mutex> lock(latch_);
+            std::vector<Entry>& heap = classes_[priority_class];
+            auto it = std::find_if(heap.begin(), heap.end(), [&](const Entry& e) { return match(e.item_); });
+            if (it == heap.end())
+                return std::nullopt;
+            return RemoveLocked(heap, it, lock);
+        }
+
+        void Close() {
+            {
+                std::lock_guard<std::mutex> lock(latch_);
+                closed_ = true;
+            }
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+        size_t Size() {
+            std::lock_guard<std::mutex> lock(latch_);
+            return size_;
+        }
+};
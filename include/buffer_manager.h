@@ -1,95 +1,455 @@
+#include <condition_variable>
+#include <functional>
 #include <list>
+#include <thread>
 #include <shared_mutex>
 #include <unordered_map>
 #include <vector>
 #include <cstring>
 #include "common.h"
 #include "disk_manager.h"
-#include "lru_k_replacer.h"
+#include "frame_state.h"
+#include "replacer.h"
 #include "background_scheduler.h"
+#include "metrics.h"
 
 #pragma once
 
 /* forward declarations */
 class GuardedPageReader;
+class GuardedPageReaderSet;
 class GuardedPageWriter;
+class OptimisticPageReader;
+class PageReadAwaitable;
+class Executor;
+
+/*
+ * LOADING: the frame is mapped to a page whose data is still being read from disk.
+ * READY: the frame's data is valid (or the frame is free).
+ */
+enum class FrameState: uint8_t { READY, LOADING };
 
 class Frame {
     private:
         const frame_id_t frame_id_;
-        bool dirty_;
-        std::atomic<size_t> pincount_; // Need to make this atomic!! Equivalent to Frame being evictable.
+        const size_class_t size_class_; /* Size class of the pages the frame holds. */
+        std::atomic<size_t>* num_dirty_; /* Number of dirty frames in the pool, maintained by SetDirty. */
+        FrameStateWord state_word_; /* Pin count, evictable, dirty and reference bits. */
+        std::atomic<page_id_t> page_id_; /* Page currently held by the frame, INVALID_PAGE_ID if free. */
         char* data_;
         std::shared_mutex rwlock_;
 
-    public: 
-        Frame(frame_id_t frame_id);
-        ~Frame();
+        /*
+         * Threads that pin a LOADING frame wait on state_cv_ for the single in-flight read to finish.
+         * Coroutines leave a callback in load_waiters_ instead.
+         */
+        std::atomic<FrameState> state_;
+        std::mutex state_latch_;
+        std::condition_variable state_cv_;
+        std::vector<std::function<void()>> load_waiters_;
+
+        /*
+         * Seqlock version for optimistic readers. Odd while the data is being modified, i.e. while a writer
+         * guard is held, or while the frame is being unmapped from its page.
+         */
+        std::atomic<uint64_t> version_;
+
+    public:
+        /* data points into the buffer manager's frame arena, and is not owned by the frame. */
+        Frame(frame_id_t frame_id, size_class_t size_class, char* data, std::atomic<size_t>* num_dirty);
 
         frame_id_t GetFrameId() { return frame_id_; }
 
-        bool GetDirty() { return dirty_; }
-        void SetDirty(bool dirty) { dirty_ = dirty; }
+        size_class_t GetSizeClass() { return size_class_; }
+        idx_t GetPageSize() { return PAGE_SIZE_CLASSES[size_class_]; }
 
-        void IncPinCount() { pincount_.fetch_add(1); }
-        void DecPinCount() { pincount_.fetch_sub(1); }
-        size_t GetPinCount() { return pincount_.load(); }
+        bool GetDirty() { return state_word_.IsDirty(); }
+        void SetDirty(bool dirty);
+
+        /* Pins the frame, unless it is free or claimed by eviction. Point accesses also set the reference bit. */
+        bool TryPin(bool reference) { return state_word_.TryPin(reference); }
+        void Unpin() { state_word_.Unpin(); }
+        size_t GetPinCount() { return state_word_.GetPinCount(); }
+
+        FrameStateWord& GetStateWord() { return state_word_; }
+
+        /* Only modified while holding the latch of the page table shard that owns the page. */
+        page_id_t GetPageId() { return page_id_.load(); }
+        void SetPageId(page_id_t page_id) { page_id_.store(page_id); }
 
         const char* GetData() { return data_; }; /* For reading from frame, and writing frame to disk. */
         char* GetDataMut() { return data_; }; /* For modifying frame, and reading a page from disk into memory/frame. */
-        
+
         std::shared_mutex& GetMutex() { return rwlock_; }
+
+        /* Marks the frame as LOADING. Called while holding the shard latch, before the page is published. */
+        void BeginLoading() { state_.store(FrameState::LOADING); }
+
+        /* Marks the frame as READY and wakes up all threads waiting for the read. */
+        void FinishLoading();
+
+        /* Blocks until the frame is READY. Caller must hold a pin, so the frame cannot be reused meanwhile. */
+        void WaitUntilLoaded();
+
+        /*
+         * Calls callback once the frame is READY, on the thread that finishes the read. Returns false, without
+         * keeping the callback, if it is READY already. Caller must hold a pin.
+         */
+        bool WhenLoaded(std::function<void()> callback);
+
+        bool IsLoaded() { return state_.load() == FrameState::READY; }
+
+        /* Brackets a modification of the frame's data. Only one thread may modify the data at a time. */
+        void BeginWrite();
+        void EndWrite();
+
+        uint64_t GetVersion() { return version_.load(std::memory_order_acquire); }
+
+        /* Returns true if the data has not been modified since GetVersion() returned version. */
+        bool ValidateVersion(uint64_t version);
+};
+
+/*
+ * A partition of the page table. Pages are assigned to shards by page_id, so lookups of pages in
+ * different shards never contend. The shard latch protects the page->frame mappings of the shard,
+ * and the shard's free lists (one per size class). Pin counts live in the frames' state words.
+ *
+ * A page mapped to INVALID_FRAME_ID is being loaded, and the loading thread is still looking for a frame.
+ * A page whose frame was claimed by eviction stays mapped until its evictor unmaps it. Other threads fetching
+ * the page wait on loads_cv_ in both cases.
+ */
+struct PageTableShard {
+    std::shared_ptr<std::mutex> latch_;
+    std::unordered_map<page_id_t, frame_id_t> page_table_;
+    std::list<frame_id_t> free_frames_[NUM_PAGE_SIZE_CLASSES];
+    std::condition_variable loads_cv_;
+
+    PageTableShard(): latch_(std::make_shared<std::mutex>()) {}
+};
+
+struct FlushStats {
+    size_t evictions;           /* Frames reused by evicting a page. */
+    size_t sync_flushes;        /* Evictions that still had to write a dirty victim before reusing its frame. */
+    size_t background_flushes;  /* Pages written by the background flusher. */
+    size_t prefetches;          /* Pages read by Prefetch or readahead. */
+};
+
+/*
+ * A sequential run of page accesses detected by readahead. next_page_id_ is read without the readahead latch,
+ * so hits that continue no stream never take it. All fields are written under the latch.
+ */
+struct ReadaheadStream {
+    std::atomic<page_id_t> next_page_id_{INVALID_PAGE_ID};     /* The access that continues the stream. */
+    page_id_t prefetched_until_ = INVALID_PAGE_ID;             /* Pages before this id have already been prefetched. */
+    size_t window_ = 0;                                        /* Number of pages to read ahead of the consumer. */
 };
 
-class BufferManager {
+class BufferManager: public FrameStateTable {
     private:
-        std::vector<std::shared_ptr<Frame>> buffer_;
+        /*
+         * One contiguous, page aligned reservation backing the data of all frames. Only the first arena_used_
+         * bytes are committed. Resize grows the pool into the rest of the reservation.
+         */
+        void* arena_base_;
+        size_t arena_size_;
+        char* arena_;
+        size_t arena_used_;
 
-        std::unordered_map<page_id_t, frame_id_t> page_table_;
-        std::unordered_map<frame_id_t, page_id_t> reverse_page_table_;
+        /*
+         * Frame metadata, indexed by frame_id_t, in a reservation of MAX_BUFFER_FRAMES. Frames are never moved
+         * or destroyed before the buffer manager, so guards and optimistic readers stay valid across Resize.
+         * num_frames_ counts every frame ever constructed, including frames retired by shrinking the pool.
+         */
+        Frame* frames_;
+        size_t frames_size_;
+        std::atomic<size_t> num_frames_;
 
-        std::list<frame_id_t> free_frames_;
+        /* Frames in use per size class, and retired frames that growing the pool reuses first. Guarded by resize_latch_. */
+        std::mutex resize_latch_;
+        std::atomic<size_t> num_class_frames_[NUM_PAGE_SIZE_CLASSES];
+        std::vector<frame_id_t> retired_frames_[NUM_PAGE_SIZE_CLASSES];
 
-        std::shared_ptr<LRUKReplacer> lru_k_replacer_;
-        std::shared_ptr<Background_Scheduler> background_scheduler_;
+        /* Declared before the replacers and scheduler, which record into it. */
+        std::shared_ptr<Metrics> metrics_;
 
-        std::shared_ptr<std::mutex> bpm_latch_;
+        std::vector<PageTableShard> shards_;
+
+        /* One replacer per size class, so a page is only ever evicted to make room for a page of its class. */
+        std::vector<std::shared_ptr<Replacer>> replacers_;
+        std::shared_ptr<Background_Scheduler> background_scheduler_;
 
         /*
-         * Important note: Page_id is monotonically increasing and is not recyclable. 
+         * Important note: Page_id is monotonically increasing and is not recyclable.
          * This ensures we know which page_id has been deleted.
-         * 
+         *
          * For e.g., if page_id can be recycled, we could have the following situation:
          * 1. Thread 1 deletes page 1
          * 2. Thread 2 tries to access page 1 but is preempted.
          * 3. Thread 3 allocates a new page, and reuses page_id 1.
          * 4. Thread 2 continues execution and writes to page 1, without realizing the page had been deleted.
+         *
+         * Each size class has its own sequence, tagged with the class in the page_id's high bits.
+         */
+        std::atomic<page_id_t> next_page_ids_[NUM_PAGE_SIZE_CLASSES];
+
+        /*
+         * Background flusher. Once more than high_watermark_ of the frames are dirty, it writes back unpinned
+         * dirty frames until at most low_watermark_ of the frames are dirty, so eviction finds clean victims.
+         */
+        std::atomic<size_t> num_dirty_;
+        std::atomic<double> low_watermark_;
+        std::atomic<double> high_watermark_;
+        std::mutex flusher_latch_;
+        std::condition_variable flusher_cv_;
+        bool stop_flusher_;
+        frame_id_t flusher_hand_;
+        std::thread flusher_thread_;
+
+        /*
+         * Number of pins the buffer manager itself holds for write-back and prefetch I/O. Such pins are
+         * short-lived, so eviction and DeletePage wait for them instead of failing.
          */
-        page_id_t next_page_id_; 
-    
-        /* Evicts frame if required. Schedules a flush of old page to disk. */
-        std::optional<frame_id_t> GetFreeFrame();
+        std::mutex io_pins_latch_;
+        std::condition_variable io_pins_cv_;
+        size_t io_pins_;
+
+        /* Adaptive readahead. Disabled while readahead_max_pages_ is 0. */
+        std::mutex readahead_latch_;
+        std::vector<ReadaheadStream> readahead_streams_;
+        size_t readahead_victim_;
+        std::atomic<size_t> readahead_max_pages_;
+
+        PageTableShard& GetShard(page_id_t page_id) {
+            return shards_[static_cast<uint32_t>(page_id) % shards_.size()];
+        }
+
+        /* Locks the shard latch, recording the wait if the latch is contended. */
+        std::unique_lock<std::mutex> LockShard(PageTableShard& shard) {
+            LockTimed(*shard.latch_, metrics_.get(), Metric::SHARD_LATCH_WAITS, Metric::SHARD_LATCH_WAIT_NS);
+            return std::unique_lock<std::mutex>(*shard.latch_, std::adopt_lock);
+        }
+
+        Replacer& GetReplacer(frame_id_t frame_id) { return *replacers_[frames_[frame_id].GetSizeClass()]; }
+
+        /* Adds count free frames of the size class. Returns false if the reservation is exhausted. Caller must hold resize_latch_. */
+        bool AddFrames(size_class_t size_class, size_t count);
+
+        /* Registers the committed part of the arena with the I/O backend, if it takes registered buffers. */
+        void RegisterFrameBuffers();
+
+        /*
+         * Takes a frame of the size class off a free list (preferring the given shard's), or evicts a page
+         * of the same class. Writes the old page to disk if dirty. Must be called without holding any shard latch.
+         * The frame is returned not evictable, and only becomes so once published for a new page. Returns nullopt
+         * if no frame is evictable, or the write-backs of EVICTION_WRITE_RETRIES victims (at most one per frame
+         * of the class) failed.
+         */
+        std::optional<frame_id_t> GetFreeFrame(PageTableShard& shard, size_class_t size_class);
+
+        /* Pins a frame for I/O issued by the buffer manager itself. Returns false if the frame is free or being evicted. */
+        bool PinForIO(frame_id_t frame_id);
+
+        /* Counts an I/O pin taken on a frame, e.g. while publishing it. */
+        void AddIOPin();
+
+        /* Unpins a frame pinned for I/O. */
+        void UnpinForIO(frame_id_t frame_id);
+
+        /* Waits until no I/O pins are held. Returns false straight away if there were none. */
+        bool WaitForIOPins();
+
+        /*
+         * Writes the page held by a pinned or claimed frame to disk and clears its dirty bit. Returns false if
+         * the page is being written to, or the write failed.
+         */
+        bool WriteBack(Frame* frame, page_id_t page_id, IOPriority priority);
+
+        /*
+         * The two halves of a write-back, for callers that keep several in flight. The caller holds the frame's
+         * latch shared from start to finish, so the dirty bit is only cleared once the page reached the OS.
+         */
+        std::shared_ptr<Request> StartWriteBack(Frame* frame, page_id_t page_id, IOPriority priority);
+        bool FinishWriteBack(Frame* frame, const std::shared_ptr<Request>& write_req);
+
+        void RunFlusher();
+
+        /* Writes back frame_id if it holds an unpinned dirty page. Returns whether the page was written. */
+        bool FlushInBackground(frame_id_t frame_id);
+
+        /*
+         * Assigns a frame to page_id, which the caller has claimed in the shard. Returns the frame pinned
+         * (with an I/O pin if io_pin) and LOADING, or releases the claim and returns nullopt if no frame is available.
+         * hint is ignored for I/O pins, which are not accesses: the page is tracked like a scanned one until read.
+         */
+        std::optional<frame_id_t> LoadFrame(PageTableShard& shard, page_id_t page_id, bool io_pin, AccessHint hint);
+
+        /*
+         * Backs out a load whose read failed: unmaps page_id, so later fetches read it again, and releases the
+         * loader's pin (an I/O pin if io_pin). Threads waiting for the read find that the frame no longer holds
+         * the page, and give up their pins. The frame goes back on a free list, or is evicted once unpinned.
+         */
+        void FailLoad(frame_id_t frame_id, page_id_t page_id, bool io_pin);
+
+        /*
+         * Tracks sequential page accesses, and prefetches ahead of detected streams. Only misses start new
+         * streams; a hit is just checked against the known ones, and takes the latch only if it continues one.
+         */
+        void Readahead(page_id_t page_id, bool miss);
+
+        /*
+         * Returns the pinned frame holding page_id, reading the page from disk if required.
+         * The read is done without holding the shard latch. Concurrent fetches of the same page pin the
+         * LOADING frame and wait for that one read, instead of issuing their own. Returns nullopt, for all of
+         * them, if the read failed.
+         */
+        std::optional<frame_id_t> FetchFrame(page_id_t page_id, AccessHint hint);
+
+        /*
+         * FetchFrame up to the read: pins the frame holding page_id, or maps a frame to it. Returns the pinned
+         * frame, and true if the caller has to read the page into it and then call FinishLoading(). Returns
+         * nullopt if the page does not exist or no frame is available.
+         */
+        std::optional<std::pair<frame_id_t, bool>> PinOrLoadFrame(page_id_t page_id, AccessHint hint);
+
+        friend class PageReadAwaitable;
 
     public:
-        BufferManager(size_t num_buffer_frames, DiskManager* disk_manager, size_t k);
+        /*
+         * All frames hold PAGE_SIZE pages, i.e. size class 0. k is only used by the LRU-K replacer.
+         * num_io_threads disk reads and writes are served in parallel. With the IO_URING backend the frames are
+         * registered as fixed buffers, so reads land directly in frame memory.
+         */
+        BufferManager(size_t num_buffer_frames, DiskManager* disk_manager, size_t k,
+            size_t num_shards = NUM_PAGE_TABLE_SHARDS, bool use_huge_pages = false,
+            ReplacerType replacer_type = DEFAULT_REPLACER, size_t num_io_threads = NUM_BACKGROUND_THREADS,
+            IOBackend io_backend = DEFAULT_IO_BACKEND);
+
+        /* num_frames_per_class[c] frames hold pages of size class c. Classes not listed get no frames. */
+        BufferManager(const std::vector<size_t>& num_frames_per_class, DiskManager* disk_manager, size_t k,
+            size_t num_shards = NUM_PAGE_TABLE_SHARDS, bool use_huge_pages = false,
+            ReplacerType replacer_type = DEFAULT_REPLACER, size_t num_io_threads = NUM_BACKGROUND_THREADS,
+            IOBackend io_backend = DEFAULT_IO_BACKEND);
+
+        ~BufferManager();
 
-        /* Allocates new page on disk only. */
-        page_id_t NewPage();
+        BufferManager(const BufferManager&) = delete;
+        BufferManager& operator=(const BufferManager&) = delete;
+
+        /* State words of the frames, read by the replacers during eviction. */
+        FrameStateWord& GetFrameState(frame_id_t frame_id) override { return frames_[frame_id].GetStateWord(); }
+
+        /*
+         * Allocates new page of the size class. Returns INVALID_PAGE_ID if the class has no frame available.
+         * Pass AccessHint::BULK_LOAD when creating many pages that will not be read again soon.
+         */
+        page_id_t NewPage(size_class_t size_class = 0, AccessHint hint = AccessHint::POINT);
+
+        /*
+         * Allocates num_pages pages of the size class with consecutive ids, first_page_id onwards, and returns
+         * first_page_id. The pages are allocated on disk straight away, contiguous and zeroed, rather than in
+         * frames: fetching them in id order reads the file sequentially, with few large I/Os.
+         * Returns INVALID_PAGE_ID if the size class has too few ids left, or the pages could not be allocated.
+         */
+        page_id_t NewPages(size_t num_pages, size_class_t size_class = 0);
 
         /* If pincount_ > 0, return false. Else uses disk manager to delete page, and evict frame. */
         bool DeletePage(page_id_t page_id);
 
-        /* Performs 1. reading from in-memory page. */
-        std::optional<GuardedPageReader> GetGuardedPageReaderNoCheck(page_id_t page_id);
+        /*
+         * Performs 1. reading from in-memory page. Pass AccessHint::SCAN from large sequential scans, so the
+         * pages they read in are evicted first and the pool keeps its hot pages.
+         */
+        std::optional<GuardedPageReader> GetGuardedPageReaderNoCheck(page_id_t page_id, AccessHint hint = AccessHint::POINT);
 
         /* Performs 1. writing to in-memory page, and 2. flushing to disk. */
-        std::optional<GuardedPageWriter> GetGuardedPageWriterNoCheck(page_id_t page_id);
+        std::optional<GuardedPageWriter> GetGuardedPageWriterNoCheck(page_id_t page_id, AccessHint hint = AccessHint::POINT);
+
+        /*
+         * Asynchronous GetGuardedPageReaderNoCheck, for coroutines: co_await bpm.FetchRead(page_id, executor)
+         * yields the reader, or nullopt. On a miss, or while another fetch reads the page, the coroutine is
+         * suspended instead of blocking its thread, and resumed on executor once the page is in memory.
+         * Only finding a frame can still block, if eviction has to write a dirty page back. Suspended fetches
+         * keep their frames pinned, so there should be fewer of them in flight than there are frames.
+         */
+        PageReadAwaitable FetchRead(page_id_t page_id, Executor& executor, AccessHint hint = AccessHint::POINT);
+
+        /*
+         * Reads a page through a mapping of the database file instead of a frame: no frame is taken or pinned,
+         * and no latch is held while reading. For pages that no longer change, such as persistent segments.
+         * The page must have been written back, and must not be written to or deleted while it is read.
+         * See DiskManager::MapPage. Returns nullptr if the page is not on disk.
+         */
+        const char* MapPage(page_id_t page_id);
 
         /* Calls GetGuardedPageReaderNoCheck and aborts if reader invalid. */
-        GuardedPageReader GetGuardedPageReader(page_id_t page_id);
+        GuardedPageReader GetGuardedPageReader(page_id_t page_id, AccessHint hint = AccessHint::POINT);
 
         /* Calls GetGuardedPageWriterNoCheck and aborts if writer invalid. */
-        GuardedPageWriter GetGuardedPageWriter(page_id_t page_id);
+        GuardedPageWriter GetGuardedPageWriter(page_id_t page_id, AccessHint hint = AccessHint::POINT);
+
+        /*
+         * Pins a set of distinct pages in one pass, taking each shard latch once. The reads for all misses are
+         * issued together before waiting on any of them. Returns nullopt, with nothing pinned, if any page
+         * does not exist or no frame is available.
+         */
+        std::optional<GuardedPageReaderSet> GetGuardedPageReadersNoCheck(const std::vector<page_id_t>& page_ids,
+            AccessHint hint = AccessHint::POINT);
+
+        /* Calls GetGuardedPageReadersNoCheck and aborts if the set is invalid. */
+        GuardedPageReaderSet GetGuardedPageReaders(const std::vector<page_id_t>& page_ids, AccessHint hint = AccessHint::POINT);
+
+        /*
+         * Returns an optimistic reader on a resident page, without pinning or locking it. Returns nullopt if
+         * the page is not resident, still loading, or being written to.
+         */
+        std::optional<OptimisticPageReader> GetOptimisticPageReader(page_id_t page_id);
+
+        /*
+         * Calls read on the page's data without pinning or locking the page, until read sees a consistent
+         * page. read may observe a concurrent write before it is retried, so it must not trust what it reads
+         * (e.g. follow offsets read from the page without bounds checks). Falls back to a read guard after
+         * OPTIMISTIC_READ_RETRIES attempts. Returns false if the page does not exist.
+         */
+        bool ReadPageOptimistic(page_id_t page_id, const std::function<void(const char*)>& read);
 
         std::optional<size_t> GetPinCount(page_id_t page_id);
-};
\ No newline at end of file
+
+        /*
+         * Grows or shrinks the frames of a size class to num_frames, while the pool is in use. Shrinking takes
+         * free frames first, then evicts unpinned pages. Returns the number of frames that could not be
+         * reclaimed because their pages were pinned. The class is left with that many frames more than asked for.
+         */
+        size_t Resize(size_t num_frames, size_class_t size_class = 0);
+
+        /* Number of frames in use, over all size classes or for one size class. */
+        size_t GetNumFrames();
+        size_t GetNumFrames(size_class_t size_class);
+
+        /* Fractions of the pool that start (high) and stop (low) a round of background flushing. */
+        void SetFlusherWatermarks(double low_watermark, double high_watermark);
+
+        FlushStats GetFlushStats();
+
+        /*
+         * Writes back every page dirty at the time of the call, then requests a sync barrier. The future becomes
+         * true once all of them are durable, and is false if a write or the sync failed. Concurrent checkpoints
+         * share one fdatasync. Pages being evicted are left to the eviction's write-back, which is waited for.
+         * Waits for writers of dirty pages, so must not be called while holding a page guard.
+         */
+        std::shared_future<bool> Checkpoint();
+
+        /* Aggregates the counters and latency histograms of all threads. */
+        MetricsSnapshot GetMetrics();
+
+        /*
+         * Starts loading pages into frames without pinning them, and returns without waiting for the reads.
+         * Pages that are already resident, or do not exist, are skipped.
+         */
+        void Prefetch(const std::vector<page_id_t>& page_ids);
+
+        /*
+         * Enables adaptive readahead on sequential page accesses, reading up to max_pages ahead.
+         * 0 disables readahead.
+         */
+        void SetReadahead(size_t max_pages);
+};
@@ -0,0 +1,42 @@
+#include <optional>
+#include <vector>
+#include "common.h"
+#include "metrics.h"
+#include "replacer.h"
+
+#pragma once
+
+/*
+ * CLOCK (second chance). The reference bit is the one in the frame's state word, set by hits without taking
+ * the replacer lock. The clock hand sweeps the tracked frames, clearing reference bits, and claims the first
+ * unpinned frame whose bit is already clear. Accesses are O(1) and never reorder anything, at the cost of
+ * only approximating LRU.
+ *
+ * Pages read in by a scan or bulk load are kept in a FIFO, and evicted before the clock sweeps. Otherwise every
+ * sweep for a scan's victim would clear the hot pages' bits, and the scan would soon push them out.
+ */
+class ClockReplacer: public Replacer {
+    public:
+        ClockReplacer(size_t num_frames, FrameStateTable* frames, Metrics* metrics = nullptr);
+
+        ~ClockReplacer() = default;
+
+    protected:
+        std::optional<frame_id_t> EvictLocked() override;
+        void RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) override;
+        void RemoveLocked(frame_id_t frame_id) override;
+        void ResizeLocked(size_t num_frames) override;
+        size_t SizeLocked() override;
+
+    private:
+        size_t hand_;
+        size_t num_tracked_;
+        std::vector<page_id_t> page_ids_;  /* INVALID_PAGE_ID if the frame is not tracked. */
+        std::vector<bool> cold_;  /* In cold_frames_: the page was only accessed by scans or bulk loads. */
+        std::vector<frame_id_t> prev_;
+        std::vector<frame_id_t> next_;
+        FrameList cold_frames_;
+
+        void SetNotCold(frame_id_t frame_id);
+        void Untrack(frame_id_t frame_id);
+};
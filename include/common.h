@@ -4,13 +4,63 @@
 
 #define DB_PATH "/home/nic/Desktop/cygnet/dbfile"
 #define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
 #define DEFAULT_DB_PAGES 1
-#define NUM_BACKGROUND_THREADS 1
+#define DIRECT_IO_ALIGNMENT 4096
+#define NUM_BACKGROUND_THREADS 4
+#define IO_QUEUE_CAPACITY 1024
+#define IO_URING_DEPTH 128
+#define IO_COALESCE_MAX_PAGES 32
+#define IO_AGING_MS 10
+#define DEFAULT_IO_BACKEND IOBackend::THREAD_POOL
 #define NUM_BUFFER_FRAMES 10
+#define MAX_BUFFER_FRAMES (1 << 22)
+#define MAX_BUFFER_POOL_BYTES (64ULL * 1024 * 1024 * 1024)
+#define NUM_PAGE_TABLE_SHARDS 16
+#define NUM_PAGE_DIRECTORY_SHARDS 16
 #define INVALID_PAGE_ID -1
+#define INVALID_FRAME_ID -1
 #define K_DIST 10
+#define LRUK_MAX_K 16
+#define DEFAULT_REPLACER ReplacerType::LRU_K
+#define FLUSHER_INTERVAL_MS 10
+#define FLUSHER_LOW_WATERMARK 0.1
+#define FLUSHER_HIGH_WATERMARK 0.25
+#define EVICTION_WRITE_RETRIES 8
+#define READAHEAD_STREAMS 8
+#define READAHEAD_MIN_PAGES 4
+#define EXTENT_PAGES 64
+#define MMAP_CHUNK_SIZE (1ULL << 30)
+#define OPTIMISTIC_READ_RETRIES 4
+#define METRICS_STRIPES 64
+#define LATENCY_HISTOGRAM_BUCKETS 40
+#define NUM_PAGE_SIZE_CLASSES 3
+#define PAGE_SIZE_CLASS_SHIFT 28
 
 using frame_id_t = int32_t;
 using page_id_t = int32_t;
 using row_id_t = int32_t;
-using idx_t = std::size_t;
\ No newline at end of file
+using idx_t = std::size_t;
+using size_class_t = uint8_t;
+
+/*
+ * Pages come in several size classes, all multiples of PAGE_SIZE. Class 0 is PAGE_SIZE, for metadata
+ * and small segments. The size class of a page is stored in bits [PAGE_SIZE_CLASS_SHIFT, 31) of its page_id.
+ */
+constexpr idx_t PAGE_SIZE_CLASSES[NUM_PAGE_SIZE_CLASSES] = {PAGE_SIZE, 64 * 1024, 256 * 1024};
+
+inline size_class_t GetPageSizeClass(page_id_t page_id) {
+    return static_cast<uint32_t>(page_id) >> PAGE_SIZE_CLASS_SHIFT;
+}
+
+inline idx_t GetPageSize(page_id_t page_id) {
+    return PAGE_SIZE_CLASSES[GetPageSizeClass(page_id)];
+}
+
+/* Smallest size class holding size bytes, or NUM_PAGE_SIZE_CLASSES if size is too large for any class. */
+inline size_class_t GetSizeClassFor(idx_t size) {
+    size_class_t size_class = 0;
+    while (size_class < NUM_PAGE_SIZE_CLASSES && PAGE_SIZE_CLASSES[size_class] < size)
+        size_class++;
+    return size_class;
+}
@@ -1,40 +1,244 @@
 #include "common.h"
 #include "filesystem"
-#include "fstream"
+#include <condition_variable>
+#include <optional>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
+#include <shared_mutex>
+#include <sys/types.h>
 
 #pragma once
 
+/*
+ * On-disk layout, in PAGE_SIZE blocks. Block 0 holds the header. The page directory maps a page to its first
+ * block through a radix tree of directory pages: the header holds the roots, pointing to level-1 pages, which
+ * point to leaf pages holding the block numbers (0: not allocated). The free-space map has a bit per block,
+ * in bitmap pages at the start of each group of BLOCKS_PER_GROUP blocks (block 1 for group 0).
+ * Directory and bitmap pages are allocated like data, and only read when first needed, so opening a database
+ * reads the header alone.
+ *
+ * Metadata pages are written as they change, with no ordering between them, so the file's metadata is only
+ * consistent after a clean shutdown, or a Sync() with no allocation or deletion since. A crash at any other
+ * time may leave directory entries and free-space bits that disagree.
+ */
+constexpr char DB_MAGIC[8] = {'C', 'Y', 'G', 'N', 'E', 'T', 'D', 'B'};
+constexpr uint32_t DB_VERSION = 1;
+constexpr size_t DIRECTORY_FANOUT = PAGE_SIZE / sizeof(uint32_t);
+constexpr size_t DIRECTORY_ROOTS = (size_t(1) << PAGE_SIZE_CLASS_SHIFT) / (DIRECTORY_FANOUT * DIRECTORY_FANOUT);
+constexpr uint64_t BLOCKS_PER_GROUP = PAGE_SIZE * 8;
+
+struct DBHeader {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t page_size_;
+    uint64_t next_block_;  /* First block never allocated. A page of a larger size class takes several blocks. */
+    uint64_t num_pages_;
+    uint32_t next_page_ids_[NUM_PAGE_SIZE_CLASSES];  /* Past the highest page id allocated, within each class. */
+    uint32_t roots_[NUM_PAGE_SIZE_CLASSES][DIRECTORY_ROOTS];
+};
+
+static_assert(sizeof(DBHeader) <= PAGE_SIZE, "the header must fit in one block");
+static_assert(MMAP_CHUNK_SIZE % (BLOCKS_PER_GROUP * PAGE_SIZE) == 0, "a page must not span mapped chunks");
+
+class DiskManager;
+
+/*
+ * A page's file offset, pinned for I/O submitted on DiskManager::GetFd(): deleting the page waits until the
+ * pin is released, so its blocks are not handed to another page while the I/O is in flight. Releasing the
+ * pin (or destroying it) unpins the page.
+ */
+class PinnedPage {
+    private:
+        DiskManager* disk_manager_;
+        page_id_t page_id_;
+        size_t offset_;
+
+    public:
+        PinnedPage(): disk_manager_(nullptr), page_id_(INVALID_PAGE_ID), offset_(0) {}
+        PinnedPage(DiskManager* disk_manager, page_id_t page_id, size_t offset):
+            disk_manager_(disk_manager), page_id_(page_id), offset_(offset) {}
+
+        PinnedPage(const PinnedPage&) = delete;
+        PinnedPage& operator=(const PinnedPage&) = delete;
+
+        PinnedPage(PinnedPage&& that);
+        PinnedPage& operator=(PinnedPage&& that);
+
+        ~PinnedPage() { Release(); }
+
+        size_t GetOffset() const { return offset_; }
+        void Release();
+};
+
+/*
+ * Pages are read and written with positional I/O on one file descriptor, so I/O workers transfer pages
+ * concurrently. Only allocating, deleting and growing the file serialize.
+ */
 class DiskManager {
     private:
+        /*
+         * Cache of the page directory, filled as pages are looked up. I/O on a page holds its shard's latch
+         * shared, so the page cannot be deleted, and its blocks handed to another page, while it is transferred.
+         * I/O submitted without the latch pins the page instead, in pins_: deleting a pinned page waits.
+         * Pins are only taken while holding latch_, and counted under pins_latch_.
+         */
+        struct DirectoryShard {
+            std::shared_mutex latch_;
+            std::unordered_map<page_id_t, size_t> pages_; /* maps page_ids to offsets */
+            std::mutex pins_latch_;
+            std::condition_variable pins_cv_;
+            std::unordered_map<page_id_t, size_t> pins_;
+        };
+
         std::filesystem::path db_path_;
-        std::fstream db_io_;
-        std::unordered_map<page_id_t, size_t> pages_; /* maps page_ids to offsets */
-        std::vector<size_t> free_slots_;
-        size_t db_capacity_;
-        std::mutex db_io_latch_;
+        int db_fd_;
+        bool direct_io_;  /* File opened with O_DIRECT: transfers bypass the OS page cache. */
+        DirectoryShard directory_[NUM_PAGE_DIRECTORY_SHARDS];
+        size_t db_capacity_; /* in PAGE_SIZE blocks */
         const idx_t page_size_;
 
+        /* Guards the header, the directory and bitmap pages, and the file size. Taken after a shard latch. */
+        std::mutex meta_latch_;
+        std::unordered_map<uint64_t, char*> meta_pages_;  /* Header, directory and bitmap pages read so far. */
+        std::unordered_set<uint64_t> unwritten_meta_pages_;  /* Whose last write failed. Sync() retries them. */
+        DBHeader* header_;
+        uint64_t free_cursor_[NUM_PAGE_SIZE_CLASSES];  /* No free run for the class starts before this block. */
+
+        /* Read-only mappings of the file, MMAP_CHUNK_SIZE bytes each, made when a page in them is first mapped. */
+        std::mutex map_latch_;
+        std::unordered_map<uint64_t, char*> mappings_;
+
+        DirectoryShard& GetShard(page_id_t page_id) {
+            return directory_[static_cast<uint32_t>(page_id) % NUM_PAGE_DIRECTORY_SHARDS];
+        }
+
+        /* Offset of the page, caching its directory entry. Caller holds the shard's latch shared, through lock. */
+        std::optional<size_t> FindPage(DirectoryShard& shard, page_id_t page_id,
+            std::shared_lock<std::shared_mutex>& lock);
+
+        static uint64_t BitmapBlock(uint64_t group) { return group == 0 ? 1 : group * BLOCKS_PER_GROUP; }
+
+        /* The rest need meta_latch_. fresh pages are zeroed instead of read. */
+        char* GetMetaPage(uint64_t block, bool fresh);
+        void WriteMetaPage(uint64_t block);
+
+        /* The page's leaf entry, and the leaf's block. Missing directory pages are created if create is set. */
+        uint32_t* DirectoryEntry(page_id_t page_id, bool create, uint64_t* leaf_block);
+        std::optional<uint64_t> LookupBlock(page_id_t page_id);
+
+        /* Takes num_blocks consecutive free blocks, reusing freed ones before growing the file. */
+        uint64_t AllocateBlocks(size_t num_blocks, size_class_t size_class);
+        std::optional<uint64_t> FindFreeRun(size_t num_blocks, size_class_t size_class);
+        void MarkBlocks(uint64_t first, size_t num_blocks, bool used);
+        void EnsureCapacity(uint64_t num_blocks);
+
+        /*
+         * Zeroes blocks that may hold a freed page's data, reserving file system space for them. Returns false
+         * if some block could not be zeroed.
+         */
+        bool ZeroBlocks(uint64_t first, size_t num_blocks);
+
+        /* Drops a pin taken by PinPage, waking up a DeletePage of the page. */
+        void UnpinPage(page_id_t page_id);
+        friend class PinnedPage;
+
+        /* Locks the shards of the pages shared, in shard order. Latches held together are always taken in that order. */
+        std::vector<std::shared_lock<std::shared_mutex>> LockShards(const std::vector<page_id_t>& page_ids);
+
+        /* A page to transfer, at its file offset. */
+        struct PageIO {
+            size_t offset_;
+            size_t len_;
+            char* data_;
+        };
+
+        /* Transfers the pages, sorted by offset, merging runs of adjacent pages. Caller must hold their shards. */
+        size_t TransferVectored(std::vector<PageIO>& pages, bool write);
+
+        /* Transfers one page at offset. Returns the bytes transferred, or -1 on error. */
+        ssize_t TransferPage(char* data, size_t len, size_t offset, bool write);
+
+        /* Direct I/O needs buffers aligned to DIRECT_IO_ALIGNMENT. Others go through an aligned copy. */
+        bool NeedsBounce(const char* data) {
+            return direct_io_ && reinterpret_cast<uintptr_t>(data) % DIRECT_IO_ALIGNMENT != 0;
+        }
+
     public:
-        DiskManager(const std::filesystem::path &db_path, idx_t page_size);
+        /*
+         * With direct_io, the file is opened with O_DIRECT, so pages are cached once, in the buffer pool, rather
+         * than in the OS page cache as well. Falls back to buffered I/O where the file system does not support it.
+         * Only a new or empty file is formatted: throws std::runtime_error, and leaves the file as it is, if it
+         * holds anything but a database.
+         */
+        DiskManager(const std::filesystem::path &db_path, idx_t page_size, bool direct_io = false);
 
-        ~DiskManager() = default;
+        ~DiskManager();
 
+        /* Allocates the page on disk, and records it in the page directory. */
         void AllocatePage(page_id_t next_page_id);
+
+        /*
+         * Allocates num_pages consecutive pages of first_page_id's size class as an extent: one run of blocks,
+         * in page id order, so the pages are read back with sequential, coalesced I/O. The pages read as zeroes.
+         * Pages already allocated keep their blocks. An extent too large for a block group is split across groups.
+         * Returns false if the blocks could not be zeroed: the pages of that group are not allocated, those of
+         * earlier groups are.
+         */
+        bool AllocatePages(page_id_t first_page_id, size_t num_pages);
         
+        /* Throw std::runtime_error if the page could not be transferred in full. */
         void WritePage(page_id_t, const char* data);
         
         void ReadPage(page_id_t page_id, char* data);
 
-        inline std::unordered_map<page_id_t, size_t>& GetPages() {
-            return pages_;
-        }
+        /*
+         * Read or write several pages. Pages that are adjacent in the file are transferred with one preadv/pwritev.
+         * Returns the number of I/Os issued. Throw std::runtime_error if any page could not be transferred in full.
+         */
+        size_t ReadPages(const std::vector<page_id_t>& page_ids, const std::vector<char*>& data);
+        size_t WritePages(const std::vector<page_id_t>& page_ids, const std::vector<const char*>& data);
+
+        /*
+         * Makes the pages written so far durable, with one fdatasync. Writes are not synced on their own: they
+         * reach the OS, and only a sync makes them survive a crash. Returns false if the sync failed, or if
+         * metadata whose write failed still cannot be written.
+         */
+        bool Sync();
+
+        /* Number of pages allocated on disk. */
+        size_t GetNumPages();
+
+        /* Past the highest page id of the size class ever allocated on disk, for numbering new pages. */
+        page_id_t GetNextPageId(size_class_t size_class);
 
         void DeletePage(page_id_t);
 
         bool CheckPageExists(page_id_t);
 
+        /*
+         * The page's data in a read-only, shared mapping of the file, or nullptr if the page is not allocated.
+         * Reads are served from the OS page cache, and see what was last written to the page. The data stays
+         * mapped as long as the disk manager lives, but only reads as the page while the page is neither
+         * deleted nor written to: use it for pages that no longer change.
+         */
+        const char* MapPage(page_id_t page_id);
+
+        /* File offset of the page, or nullopt if it is not allocated. */
+        std::optional<size_t> GetPageOffset(page_id_t page_id);
+
+        /* The page's file offset, pinned until the PinnedPage is released. nullopt if it is not allocated. */
+        std::optional<PinnedPage> PinPage(page_id_t page_id);
+
+        /*
+         * For I/O submitted on GetFd() instead of through ReadPage/WritePage. The I/O has to hold a PinnedPage
+         * of the page until it completes, and writes have to allocate the page first. With direct I/O, their
+         * buffers have to be aligned to DIRECT_IO_ALIGNMENT, as the frames are.
+         */
+        int GetFd() { return db_fd_; }
+
+        bool IsDirectIO() { return direct_io_; }
+
         idx_t GetPageSize() { return page_size_; }
 };
\ No newline at end of file
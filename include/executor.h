@@ -0,0 +1,58 @@
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "task.h"
+
+#pragma once
+
+/*
+ * A few threads that run coroutines. A coroutine that awaits I/O gives its thread back, and is posted here
+ * again once the I/O completes, so thousands of fetches can be outstanding on a handful of threads.
+ */
+class Executor {
+    private:
+        std::vector<std::thread> threads_;
+        std::deque<std::coroutine_handle<>> ready_;
+        size_t num_tasks_;  /* Spawned tasks not finished yet. */
+        bool stop_;
+        std::mutex latch_;
+        std::condition_variable ready_cv_;
+        std::condition_variable idle_cv_;
+
+        void Run();
+        void FinishTask();
+
+        static task_detail::Detached RunSpawned(Executor* executor, Task<void> task);
+
+    public:
+        explicit Executor(size_t num_threads);
+
+        /* Waits for the spawned tasks to finish, then stops the threads. */
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        /* Resumes the coroutine on one of the threads. */
+        void Post(std::coroutine_handle<> handle);
+
+        /* Runs the task on one of the threads. Exceptions escaping it terminate the process. */
+        void Spawn(Task<void> task);
+
+        /* Blocks until all spawned tasks have finished. */
+        void WaitIdle();
+
+        /* Awaitable that moves the awaiting coroutine onto one of the threads. */
+        auto Schedule() {
+            struct Awaiter {
+                Executor* executor_;
+                bool await_ready() noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> handle) { executor_->Post(handle); }
+                void await_resume() noexcept {}
+            };
+            return Awaiter{this};
+        }
+};
@@ -0,0 +1,113 @@
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "common.h"
+
+#pragma once
+
+/*
+ * Pin count, evictable, dirty and reference bits of a frame, packed into one atomic word, so pinning and
+ * unpinning a resident page is a single atomic operation, without taking any lock.
+ *
+ * EVICTABLE is set while the frame holds a page that may be pinned. Eviction claims a frame by clearing it
+ * while the pin count is 0. From then on TryPin fails, and the evicting thread owns the frame until it is
+ * published again for another page. REFERENCED is set by point accesses that hit, and read lazily by the
+ * replacer when it looks for a victim.
+ */
+class FrameStateWord {
+    public:
+        static constexpr uint64_t PIN_COUNT_MASK = (uint64_t(1) << 32) - 1;
+        static constexpr uint64_t EVICTABLE = uint64_t(1) << 32;
+        static constexpr uint64_t DIRTY = uint64_t(1) << 33;
+        static constexpr uint64_t REFERENCED = uint64_t(1) << 34;
+
+        FrameStateWord(): word_(0) {}
+
+        /*
+         * Makes a frame that was just mapped to a page evictable, holding pin_count pins. Only the thread that
+         * took the frame off a free list, or claimed it, may call this.
+         */
+        void Publish(size_t pin_count) { word_.fetch_add(EVICTABLE + pin_count, std::memory_order_release); }
+
+        /* Pins the frame, unless it is free or claimed. A point access also sets the reference bit. */
+        bool TryPin(bool reference) {
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            uint64_t desired;
+            do {
+                if (!(word & EVICTABLE))
+                    return false;
+                desired = (word + 1) | (reference ? REFERENCED : 0);
+            } while (!word_.compare_exchange_weak(word, desired, std::memory_order_acquire, std::memory_order_relaxed));
+            return true;
+        }
+
+        void Unpin() { word_.fetch_sub(1, std::memory_order_release); }
+
+        /* Claims an unpinned evictable frame, clearing its reference bit. Returns false if it is pinned, free or claimed. */
+        bool TryClaim() {
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            do {
+                if (!(word & EVICTABLE) || (word & PIN_COUNT_MASK) != 0)
+                    return false;
+            } while (!word_.compare_exchange_weak(word, word & ~(EVICTABLE | REFERENCED), std::memory_order_acquire,
+                std::memory_order_relaxed));
+            return true;
+        }
+
+        /* Gives a claimed frame back, e.g. if its page could not be written back. */
+        void Unclaim() { word_.fetch_or(EVICTABLE, std::memory_order_release); }
+
+        /* Clears the reference bit. Returns whether it was set. */
+        bool ClearReferenced() {
+            if (!(word_.load(std::memory_order_relaxed) & REFERENCED))
+                return false;
+            return word_.fetch_and(~REFERENCED, std::memory_order_relaxed) & REFERENCED;
+        }
+
+        void SetReferenced() { word_.fetch_or(REFERENCED, std::memory_order_relaxed); }
+
+        /* Sets or clears the dirty bit. Returns the previous value. */
+        bool SetDirty(bool dirty) {
+            uint64_t old = dirty ? word_.fetch_or(DIRTY) : word_.fetch_and(~DIRTY);
+            return old & DIRTY;
+        }
+
+        size_t GetPinCount() const { return word_.load() & PIN_COUNT_MASK; }
+        bool IsEvictable() const { return word_.load() & EVICTABLE; }
+        bool IsDirty() const { return word_.load() & DIRTY; }
+        bool IsReferenced() const { return word_.load() & REFERENCED; }
+
+        /* Evictable and unpinned, i.e. TryClaim would succeed. */
+        bool IsClaimable() const {
+            uint64_t word = word_.load();
+            return (word & EVICTABLE) && (word & PIN_COUNT_MASK) == 0;
+        }
+
+    private:
+        std::atomic<uint64_t> word_;
+};
+
+/* Gives a replacer the state words of the frames it manages, indexed by frame_id_t. */
+class FrameStateTable {
+    public:
+        virtual ~FrameStateTable() = default;
+        virtual FrameStateWord& GetFrameState(frame_id_t frame_id) = 0;
+};
+
+/* State words owned by the table, for using a replacer on its own (tests, benchmarks). */
+class FrameStateArray: public FrameStateTable {
+    public:
+        explicit FrameStateArray(size_t num_frames): states_(new FrameStateWord[num_frames]) {}
+
+        FrameStateWord& GetFrameState(frame_id_t frame_id) override { return states_[frame_id]; }
+
+        /* The frame now holds a page, unpinned. */
+        void Publish(frame_id_t frame_id) { states_[frame_id].Publish(0); }
+
+        /* Pins the frame. A hit (reference) also sets its reference bit. */
+        bool Pin(frame_id_t frame_id, bool reference = false) { return states_[frame_id].TryPin(reference); }
+        void Unpin(frame_id_t frame_id) { states_[frame_id].Unpin(); }
+
+    private:
+        std::unique_ptr<FrameStateWord[]> states_;
+};
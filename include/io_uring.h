@@ -0,0 +1,94 @@
+#include <cstdint>
+#include <sys/uio.h>
+#include <vector>
+#include "common.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define CYGNET_HAS_IO_URING 1
+#else
+#define CYGNET_HAS_IO_URING 0
+#endif
+
+#pragma once
+
+/*
+ * Minimal io_uring wrapper on top of the raw system calls, so there is no dependency on liburing.
+ * Only one thread may use a ring at a time, except RegisterBuffers, which callers have to serialize with
+ * submissions themselves.
+ *
+ * A ring that could not be set up (old kernel, seccomp, no kernel headers) reports !IsOpen(), and callers
+ * fall back to synchronous I/O.
+ */
+class IOUring {
+    public:
+        struct Completion {
+            uint64_t user_data_;
+            int32_t res_;  /* Bytes transferred, or -errno. */
+        };
+
+        explicit IOUring(unsigned entries);
+
+        ~IOUring();
+
+        IOUring(const IOUring&) = delete;
+        IOUring& operator=(const IOUring&) = delete;
+
+        bool IsOpen() const { return ring_fd_ >= 0; }
+
+        /*
+         * Queues a read or write of len bytes at offset of fd. buf_index is the registered buffer holding data,
+         * or -1 if it is not in one. Returns false if the submission queue is full.
+         */
+        bool PrepareRead(int fd, char* data, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data);
+        bool PrepareWrite(int fd, const char* data, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data);
+
+        /* Vectored read or write into/from iovcnt buffers, starting at offset. iovs must stay valid until completion. */
+        bool PrepareReadv(int fd, const iovec* iovs, unsigned iovcnt, uint64_t offset, uint64_t user_data);
+        bool PrepareWritev(int fd, const iovec* iovs, unsigned iovcnt, uint64_t offset, uint64_t user_data);
+
+        /* Hands the queued entries to the kernel. Returns the number submitted, or -errno. */
+        int Submit();
+
+        /* Sleeps until at least one completion is available. Returns 0, or -errno. */
+        int WaitCompletion();
+
+        /* Pops up to max completions without blocking. Returns how many were popped. */
+        size_t PopCompletions(Completion* out, size_t max);
+
+        /*
+         * Registers the buffers with the kernel, replacing the ones registered before, so I/O into them skips
+         * pinning and mapping the user pages. Registering pins (and commits) their memory.
+         */
+        bool RegisterBuffers(const std::vector<iovec>& buffers);
+        void UnregisterBuffers();
+
+    private:
+        int ring_fd_;
+        unsigned sq_entries_;
+        unsigned cq_entries_;
+        unsigned sq_pending_;  /* Queued by Prepare*, not yet submitted. */
+        bool buffers_registered_;
+
+        void* sq_ring_;
+        size_t sq_ring_size_;
+        void* cq_ring_;
+        size_t cq_ring_size_;
+        void* sqes_mem_;
+        size_t sqes_size_;
+
+        unsigned* sq_head_;
+        unsigned* sq_tail_;
+        unsigned* sq_mask_;
+        unsigned* sq_array_;
+        unsigned* cq_head_;
+        unsigned* cq_tail_;
+        unsigned* cq_mask_;
+#if CYGNET_HAS_IO_URING
+        io_uring_sqe* sqes_;
+        io_uring_cqe* cqes_;
+
+        bool Prepare(uint8_t opcode, int fd, uint64_t addr, uint32_t len, uint64_t offset, int buf_index,
+            uint64_t user_data);
+#endif
+};
@@ -1,59 +1,110 @@
-#include <list>
-#include <mutex>
+#include <array>
+#include <unordered_map>
 #include <vector>
 #include <optional>
 #include "common.h"
+#include "metrics.h"
+#include "replacer.h"
 
 #pragma once
 
 /*
  * For every page in the cache, we track last k access times.
  * Evict the page with the largest difference in current time and kth previous access time.
+ *
+ * Access times come from a logical clock, so the backward k-distances of two frames only change
+ * order when one of them is accessed. The last k access times are kept in a ring inside the node.
  */
 class LRUKNode {
     public:
-        LRUKNode(frame_id_t frame_id, size_t k): fid_(frame_id), k_(k), is_evictable_(true) {}
+        LRUKNode(frame_id_t frame_id, size_t k): fid_(frame_id), page_id_(INVALID_PAGE_ID), k_(k), history_size_(0),
+            history_head_(0), heap_index_(NOT_IN_HEAP) {}
 
-        void RecordAccess();
+        void RecordAccess(size_t timestamp);
 
-        std::list<size_t>& GetTimes() { return times_; }
+        /*
+         * Eviction order. Frames with fewer than k accesses (infinite backward k-distance) go first, by their
+         * earliest access, then frames by their kth previous access. Ties are broken by frame id.
+         */
+        bool EvictsBefore(const LRUKNode& that) const;
 
-        bool GetEvictable() { return is_evictable_; }
+        frame_id_t GetFrameId() { return fid_; }
 
-        void SetEvictable() { is_evictable_ = true; }
+        /* Page whose accesses are in the history, INVALID_PAGE_ID if none. */
+        page_id_t GetPageId() { return page_id_; }
 
-        void SetNotEvictable() { is_evictable_ = false; }
+        void SetPageId(page_id_t page_id) { page_id_ = page_id; }
 
-        frame_id_t GetFrameId() { return fid_; }
+        void Evict() { page_id_ = INVALID_PAGE_ID; history_size_ = 0; history_head_ = 0; }
+
+        /* Takes over the access history of the page's evicted node. */
+        void RestoreHistory(const LRUKNode& evicted);
+
+        bool HasHistory() { return history_size_ > 0; }
 
-        void Evict();
+        static constexpr size_t NOT_IN_HEAP = SIZE_MAX;
 
     private:
-        std::list<size_t> times_;
-        const frame_id_t fid_;
+        /* Oldest access still in the history: the kth previous access once the ring is full. */
+        size_t OldestAccess() const { return history_size_ == 0 ? 0 : history_[history_head_]; }
+
+        std::array<size_t, LRUK_MAX_K> history_;
+        frame_id_t fid_;
+        page_id_t page_id_;
         size_t k_;
-        bool is_evictable_;
-};
+        size_t history_size_;
+        size_t history_head_;  /* Index of the oldest access in the ring. */
 
-class LRUKReplacer {
     public:
-        LRUKReplacer(size_t num_frames, size_t k);
-        
-        ~LRUKReplacer() = default;
-
-        std::optional<frame_id_t> Evict();
+        /* Position in the replacer's heap, NOT_IN_HEAP if the frame is not tracked. */
+        size_t heap_index_;
+};
 
-        void RecordAccess(frame_id_t frame_id);
+/*
+ * Tracked frames are kept in a binary min-heap ordered by LRUKNode::EvictsBefore, which is indexed by
+ * the nodes' heap positions. RecordAccess and Remove are O(log n). Evict is O(log n), plus O(log n) for
+ * every pinned or referenced frame it passes over.
+ *
+ * Hits on resident pages only set the frame's reference bit. Evict records them when it finds the bit set,
+ * as a single access at that time, so pages hit since the last eviction only approximately keep their order.
+ *
+ * The history of an evicted page is kept, for as many evicted pages as the replacer's capacity, and is given
+ * back to the page when it is read in again. Otherwise a page evicted just before being re-read would look
+ * brand new, with an infinite backward k-distance. Only evictions, Resize and re-reads of evicted pages allocate.
+ *
+ * Scan and bulk load accesses are not recorded. A page they read in has no history, and is evicted first.
+ */
+class LRUKReplacer: public Replacer {
+    public:
+        /* If metrics is set, contended acquisitions of the replacer lock are timed. */
+        LRUKReplacer(size_t num_frames, size_t k, FrameStateTable* frames, Metrics* metrics = nullptr);
 
-        void SetEvictable(frame_id_t frame_id);
+        ~LRUKReplacer() = default;
 
-        void SetNotEvictable(frame_id_t frame_id);
+    protected:
+        std::optional<frame_id_t> EvictLocked() override;
+        void RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) override;
+        void RemoveLocked(frame_id_t frame_id) override;
+        void ResizeLocked(size_t num_frames) override;
+        size_t SizeLocked() override;
 
-        void Remove(frame_id_t frame_id);
-    
     private:
-        std::mutex lock_;
         size_t num_frames_;
         size_t k_;
+        size_t current_timestamp_;
         std::vector<LRUKNode> lru_nodes_;
-};
\ No newline at end of file
+        std::vector<frame_id_t> heap_;
+        std::vector<frame_id_t> skipped_;  /* Pinned frames taken off the heap by Evict, and put back after it. */
+
+        /* Histories of recently evicted pages, and their eviction order. */
+        std::unordered_map<page_id_t, LRUKNode> evicted_;
+        GhostList evicted_order_;
+
+        /* Heap maintenance. Caller must hold the replacer lock. */
+        bool HeapLess(size_t i, size_t j) { return lru_nodes_[heap_[i]].EvictsBefore(lru_nodes_[heap_[j]]); }
+        void HeapSwap(size_t i, size_t j);
+        void SiftUp(size_t i);
+        void SiftDown(size_t i);
+        void HeapInsert(frame_id_t frame_id);
+        void HeapErase(frame_id_t frame_id);
+};
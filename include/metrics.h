@@ -0,0 +1,104 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "common.h"
+
+#pragma once
+
+enum class Metric: uint8_t {
+    HITS,                   /* Fetches of a page already mapped to a frame. */
+    MISSES,                 /* Fetches that had to read the page from disk. */
+    CLEAN_EVICTIONS,        /* Frames reused by evicting a clean page. */
+    DIRTY_EVICTIONS,        /* Frames reused by evicting a page that had to be written back first. */
+    SYNC_FLUSHES,           /* Write-backs done by eviction, i.e. on the fetching thread. */
+    SYNC_FLUSH_WAIT_NS,     /* Time fetching threads spent waiting for those write-backs. */
+    BACKGROUND_FLUSHES,     /* Pages written by the background flusher. */
+    PREFETCHES,             /* Pages read by Prefetch or readahead. */
+    SHARD_LATCH_WAITS,      /* Contended acquisitions of a page table shard latch. */
+    SHARD_LATCH_WAIT_NS,
+    REPLACER_LOCK_WAITS,    /* Contended acquisitions of a replacer lock. */
+    REPLACER_LOCK_WAIT_NS,
+    COALESCED_PAGES,        /* Disk reads and writes merged into one vectored I/O with an adjacent page's. */
+    SYNC_BARRIERS,          /* Callers waiting for their writes to become durable. */
+    SYNCS,                  /* fdatasync calls made for them. Many barriers share one sync. */
+    MAPPED_READS,           /* Pages read through the file mapping, bypassing the pool. */
+    NUM_METRICS
+};
+
+enum class LatencyHistogram: uint8_t { DISK_READ, DISK_WRITE, NUM_HISTOGRAMS };
+
+constexpr size_t NUM_METRICS = static_cast<size_t>(Metric::NUM_METRICS);
+constexpr size_t NUM_HISTOGRAMS = static_cast<size_t>(LatencyHistogram::NUM_HISTOGRAMS);
+
+/* Bucket i counts latencies in [2^i, 2^(i+1)) ns. Bucket 0 also counts 0 ns, and the last bucket everything above. */
+struct HistogramSnapshot {
+    size_t buckets_[LATENCY_HISTOGRAM_BUCKETS];
+
+    size_t Count() const;
+
+    /* Upper bound, in ns, of the bucket holding the p-th percentile (0 < p <= 100). Returns 0 if empty. */
+    uint64_t Percentile(double p) const;
+};
+
+struct MetricsSnapshot {
+    size_t metrics_[NUM_METRICS];
+    HistogramSnapshot histograms_[NUM_HISTOGRAMS];
+
+    size_t Get(Metric metric) const { return metrics_[static_cast<size_t>(metric)]; }
+    const HistogramSnapshot& Get(LatencyHistogram histogram) const { return histograms_[static_cast<size_t>(histogram)]; }
+
+    /* Fraction of fetches that were hits, or 0 if there were none. */
+    double HitRatio() const;
+};
+
+/*
+ * Counters and latency histograms, updated on hot paths and aggregated only when read.
+ * Every thread updates its own stripe, padded to a cache line, so updates never contend or bounce cache lines.
+ * Threads beyond METRICS_STRIPES share stripes, which stays correct since all updates are atomic.
+ */
+class Metrics {
+    private:
+        struct alignas(64) Stripe {
+            std::atomic<size_t> metrics_[NUM_METRICS];
+            std::atomic<size_t> histograms_[NUM_HISTOGRAMS][LATENCY_HISTOGRAM_BUCKETS];
+        };
+
+        std::unique_ptr<Stripe[]> stripes_;
+
+        Stripe& LocalStripe();
+
+    public:
+        Metrics();
+
+        void Add(Metric metric, size_t value = 1) {
+            LocalStripe().metrics_[static_cast<size_t>(metric)].fetch_add(value, std::memory_order_relaxed);
+        }
+
+        void Record(LatencyHistogram histogram, uint64_t latency_ns);
+
+        MetricsSnapshot Snapshot();
+
+        static uint64_t NowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+};
+
+/*
+ * Locks mutex. Only if the mutex is contended is the wait timed and counted, so uncontended
+ * acquisitions cost no more than a try_lock. metrics may be nullptr.
+ */
+template <typename Mutex>
+void LockTimed(Mutex& mutex, Metrics* metrics, Metric waits, Metric wait_ns) {
+    if (mutex.try_lock())
+        return;
+    if (metrics == nullptr) {
+        mutex.lock();
+        return;
+    }
+    uint64_t start = Metrics::NowNs();
+    mutex.lock();
+    metrics->Add(waits);
+    metrics->Add(wait_ns, Metrics::NowNs() - start);
+}
@@ -1,16 +1,20 @@
 #include "background_scheduler.h"
 #include "common.h"
+#include <coroutine>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <shared_mutex>
+#include <vector>
 #include "buffer_manager.h"
-#include "lru_k_replacer.h"
+#include "executor.h"
 
 #pragma once
 
 /* 
  * GuardedPageReaders(Writers) operate on the assumption that the page is already mapped to a frame
- * (i.e. in memory) by the buffer manager.
+ * (i.e. in memory) and pinned by the buffer manager. The guard takes over that pin, and releases it
+ * with a single atomic update of the frame's state word, without taking any latch.
  * ReadPage() & WritePage() therefore operate on pages in memory.
  * Only FlushPage() uses the disk manager to write to disk.
  */
@@ -23,17 +27,13 @@ class GuardedPageReader {
         bool is_pinned_ = false;
         
         page_id_t page_id_;
-        std::shared_ptr<std::mutex> bpm_latch_;
-        std::shared_ptr<Frame> frame_;
+        Frame* frame_;
         std::shared_ptr<Background_Scheduler> background_scheduler_;
-        std::shared_ptr<LRUKReplacer> lru_replacer_;
 
     public:
         GuardedPageReader(
             page_id_t page_id,
-            std::shared_ptr<Frame> frame,
-            std::shared_ptr<std::mutex> bpm_latch,
-            std::shared_ptr<LRUKReplacer> lru_replacer,
+            Frame* frame,
             std::shared_ptr<Background_Scheduler> background_scheduler
         );
 
@@ -50,6 +50,72 @@ class GuardedPageReader {
 };
 
 
+/*
+ * Read guards on a set of distinct pages, pinned together by BufferManager::GetGuardedPageReaders.
+ * Drop() releases all pins together.
+ */
+class GuardedPageReaderSet {
+    private:
+        std::vector<page_id_t> page_ids_;
+        std::vector<Frame*> frames_;
+        std::vector<std::shared_lock<std::shared_mutex>> rlocks_;
+
+        /* If the set is holding pins to its frames. */
+        bool is_pinned_ = false;
+
+    public:
+        GuardedPageReaderSet(std::vector<page_id_t> page_ids, std::vector<Frame*> frames);
+
+        ~GuardedPageReaderSet();
+
+        GuardedPageReaderSet(const GuardedPageReaderSet&) = delete;
+        GuardedPageReaderSet& operator=(const GuardedPageReaderSet&) = delete;
+
+        GuardedPageReaderSet(GuardedPageReaderSet&& that) noexcept;
+        GuardedPageReaderSet& operator=(GuardedPageReaderSet&& that) noexcept;
+
+        size_t Size() const { return page_ids_.size(); }
+        page_id_t GetPageId(size_t i) const { return page_ids_[i]; }
+
+        /* Data of the i-th page, in the order the pages were requested. */
+        const char* GetData(size_t i) const;
+        void Drop();
+
+        /* Unpins frames. Also used by the buffer manager to back out of a batch. */
+        static void UnpinFrames(const std::vector<Frame*>& frames);
+};
+
+
+/*
+ * Seqlock style reader. Takes no pin or lock, so hot pages can be read by many threads without any of
+ * them writing to shared memory. The frame may be modified, or even reused for another page, while it is
+ * being read: what was read from GetData() may only be used once Validate() returns true.
+ *
+ *   do { ...read from reader.GetData()... } while (!reader.Validate() && reader.Restart());
+ *
+ * A reader can be kept and restarted for later reads of the same page, as long as the buffer manager
+ * outlives it. Once Restart() fails, get a new reader (or a GuardedPageReader) from the buffer manager.
+ */
+class OptimisticPageReader {
+    private:
+        page_id_t page_id_;
+        Frame* frame_;
+        uint64_t version_;
+
+    public:
+        OptimisticPageReader(page_id_t page_id, Frame* frame);
+
+        page_id_t GetPageId() const { return page_id_; }
+        const char* GetData() const { return frame_->GetData(); }
+
+        /* Starts a new read. Returns false if the frame no longer holds the page, or the page is being written to. */
+        bool Restart();
+
+        /* Returns true if the page was not modified or evicted since Restart(). */
+        bool Validate() const;
+};
+
+
 class GuardedPageWriter {
     private:
         /* Writer lock on frame. */
@@ -59,17 +125,13 @@ class GuardedPageWriter {
         bool is_pinned_ = false;
 
         page_id_t page_id_;
-        std::shared_ptr<std::mutex> bpm_latch_;
-        std::shared_ptr<Frame> frame_;
+        Frame* frame_;
         std::shared_ptr<Background_Scheduler> background_scheduler_;
-        std::shared_ptr<LRUKReplacer> lru_replacer_;
     
     public:
         GuardedPageWriter(
             page_id_t page_id,
-            std::shared_ptr<Frame> frame,
-            std::shared_ptr<std::mutex> bpm_latch,
-            std::shared_ptr<LRUKReplacer> lru_replacer,
+            Frame* frame,
             std::shared_ptr<Background_Scheduler> background_scheduler
         );
 
@@ -83,7 +145,37 @@ class GuardedPageWriter {
 
         const char* GetData();
         char* GetDataMut();
-        void FlushPage();
+        /* Writes the page to disk, and waits for it. Returns false if the write failed. */
+        bool FlushPage();
         void Drop();
         const page_id_t GetPageId() const;
-};
\ No newline at end of file
+};
+
+/*
+ * Returned by BufferManager::FetchRead. Awaiting it pins the page and yields a GuardedPageReader, or nullopt
+ * if the page does not exist or could not be read. A miss's read request lives in the awaitable, i.e. in the awaiting coroutine's
+ * frame, and completes through a callback: no promise, future or shared state is allocated per fetch.
+ */
+class PageReadAwaitable {
+    private:
+        BufferManager* bpm_;
+        page_id_t page_id_;
+        Executor* executor_;
+        AccessHint hint_;
+        Frame* frame_;      /* Pinned frame, nullptr if the page does not exist or our read of it failed. */
+        bool must_read_;    /* A miss: the frame is ours to read the page into. */
+        std::coroutine_handle<> waiter_;
+        std::optional<Request> request_;
+
+        void OnRead(bool ok);
+
+    public:
+        PageReadAwaitable(BufferManager* bpm, page_id_t page_id, Executor* executor, AccessHint hint);
+
+        PageReadAwaitable(const PageReadAwaitable&) = delete;
+        PageReadAwaitable& operator=(const PageReadAwaitable&) = delete;
+
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> waiter);
+        std::optional<GuardedPageReader> await_resume();
+};
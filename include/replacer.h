@@ -0,0 +1,160 @@
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "frame_state.h"
+#include "metrics.h"
+
+#pragma once
+
+enum class ReplacerType: uint8_t { LRU_K, CLOCK, TWO_Q, ARC };
+
+/*
+ * How a page is about to be used. A SCAN or BULK_LOAD access does not make a resident page any hotter, and a
+ * page read in by one goes to the cold end of the replacer, to be evicted first. Pages only touched by
+ * such accesses are not remembered once evicted. A large scan then cycles through a few frames, instead of
+ * pushing every hot page out of the pool.
+ */
+enum class AccessHint: uint8_t { POINT, SCAN, BULK_LOAD };
+
+class FrameList;
+
+/*
+ * Replacement policy of the buffer pool. The replacer tracks the frames holding pages, from the access that
+ * mapped the page to the frame (RecordAccess) until the frame is evicted or removed.
+ *
+ * Pins, unpins and hits on resident pages do not go through the replacer: they only update the frame's state
+ * word (see FrameStateWord). Evict() reads the state words of its candidates in policy order. Pinned frames
+ * are skipped, referenced frames have their bit cleared and are taken as hits the replacer had not seen yet,
+ * and the first frame that is neither is claimed, so no two callers get the same victim.
+ *
+ * Accesses are recorded with the page held by the frame, so policies can remember pages that were
+ * evicted recently (e.g. 2Q's A1out, ARC's ghost lists) and recognise them when they are read back.
+ *
+ * The public methods take the replacer lock, and call the policy's *Locked hooks.
+ */
+class Replacer {
+    public:
+        /* frames must outlive the replacer. If metrics is set, contended acquisitions of the replacer lock are timed. */
+        Replacer(size_t capacity, FrameStateTable* frames, Metrics* metrics):
+            capacity_(capacity), frames_(frames), metrics_(metrics) {}
+
+        virtual ~Replacer() = default;
+
+        /* Claims a victim frame. Its page stays mapped, and the caller unmaps it. */
+        std::optional<frame_id_t> Evict();
+
+        /*
+         * Records an access to the page held by a frame. Called when a page is mapped to the frame, where it
+         * starts tracking the frame, and for accesses the policy should see before the next Evict.
+         */
+        void RecordAccess(frame_id_t frame_id, page_id_t page_id, AccessHint hint = AccessHint::POINT);
+
+        /* The frame's page was deleted. Forgets the page, without remembering it as evicted. */
+        void Remove(frame_id_t frame_id);
+
+        /* Grows the replacer to track num_frames frames. */
+        void Resize(size_t num_frames);
+
+        /*
+         * Number of frames the policy manages, which sizes its lists and how many evicted pages it remembers.
+         * Defaults to the number of frames. Differs when replacers of several size classes share frame ids.
+         */
+        void SetCapacity(size_t capacity);
+
+        /* Number of tracked frames that could be claimed right now. Reads every state word, so only for tests and diagnostics. */
+        size_t Size();
+
+    protected:
+        /* Called with the replacer lock held. */
+        virtual std::optional<frame_id_t> EvictLocked() = 0;
+        virtual void RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) = 0;
+        virtual void RemoveLocked(frame_id_t frame_id) = 0;
+        virtual void ResizeLocked(size_t num_frames) = 0;
+        virtual size_t SizeLocked() = 0;
+
+        FrameStateWord& State(frame_id_t frame_id) { return frames_->GetFrameState(frame_id); }
+
+        /*
+         * Walks list from its back, and claims the first frame that is neither pinned nor referenced.
+         * Referenced frames are passed to on_hit once their bit is cleared, which may move them to another
+         * list, or to the front of this one. Returns INVALID_FRAME_ID if no frame could be claimed.
+         */
+        template <typename OnHit>
+        frame_id_t ClaimFromBack(const FrameList& list, OnHit on_hit);
+
+        /* Number of frames in list that could be claimed right now. */
+        size_t CountClaimable(const FrameList& list);
+
+        size_t capacity_;
+
+    private:
+        FrameStateTable* frames_;
+        std::mutex lock_;
+        Metrics* metrics_;
+
+        void Lock() { LockTimed(lock_, metrics_, Metric::REPLACER_LOCK_WAITS, Metric::REPLACER_LOCK_WAIT_NS); }
+};
+
+/* Creates a replacer for num_frames frames. k is only used by LRU-K. */
+std::shared_ptr<Replacer> MakeReplacer(ReplacerType type, size_t num_frames, size_t k, FrameStateTable* frames,
+    Metrics* metrics = nullptr);
+
+/* Doubly linked list of frames, threaded through per-frame links. A frame is in at most one FrameList. */
+class FrameList {
+    private:
+        frame_id_t head_;  /* Most recently inserted. */
+        frame_id_t tail_;
+        size_t size_;
+        std::vector<frame_id_t>& prev_;
+        std::vector<frame_id_t>& next_;
+
+    public:
+        /* prev and next are shared by all lists of a replacer, and indexed by frame_id_t. */
+        FrameList(std::vector<frame_id_t>& prev, std::vector<frame_id_t>& next):
+            head_(INVALID_FRAME_ID), tail_(INVALID_FRAME_ID), size_(0), prev_(prev), next_(next) {}
+
+        void PushFront(frame_id_t frame_id);
+        void PushBack(frame_id_t frame_id);
+        void Erase(frame_id_t frame_id);
+
+        frame_id_t Front() const { return head_; }
+        frame_id_t Back() const { return tail_; }
+        frame_id_t Prev(frame_id_t frame_id) const { return prev_[frame_id]; }
+        size_t Size() const { return size_; }
+};
+
+/* Page ids of recently evicted pages, most recent first, with O(1) lookup. */
+class GhostList {
+    private:
+        std::list<page_id_t> order_;
+        std::unordered_map<page_id_t, std::list<page_id_t>::iterator> index_;
+
+    public:
+        bool Contains(page_id_t page_id) const { return index_.find(page_id) != index_.end(); }
+        void PushFront(page_id_t page_id);
+        bool Erase(page_id_t page_id);
+
+        /* Removes and returns the oldest page id. The list must not be empty. */
+        page_id_t PopBack();
+
+        size_t Size() const { return order_.size(); }
+};
+
+template <typename OnHit>
+frame_id_t Replacer::ClaimFromBack(const FrameList& list, OnHit on_hit) {
+    frame_id_t frame_id = list.Back();
+    while (frame_id != INVALID_FRAME_ID) {
+        frame_id_t prev = list.Prev(frame_id);
+        FrameStateWord& state = State(frame_id);
+        if (state.ClearReferenced())
+            on_hit(frame_id);
+        else if (state.TryClaim())
+            return frame_id;
+        frame_id = prev;
+    }
+    return INVALID_FRAME_ID;
+}
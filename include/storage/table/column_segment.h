@@ -7,6 +7,35 @@
 
 enum class ColumnSegmentType: uint8_t { TRANSIENT, PERSISTENT };
 
+/*
+ * Pages for a column's segments, taken from extents of EXTENT_PAGES pages that are contiguous on disk.
+ * Consecutive segments of the column get consecutive pages, so a scan of the column reads the file
+ * sequentially, in a few large I/Os, instead of one page here and there.
+ */
+class SegmentExtent {
+    private:
+        std::shared_ptr<BufferManager> buffer_manager_;
+        size_class_t size_class_ = 0;
+        page_id_t next_page_id_ = INVALID_PAGE_ID;
+        idx_t remaining_ = 0;
+
+        /* Deletes the pages of the extent not handed out. */
+        void Release();
+
+    public:
+        SegmentExtent(std::shared_ptr<BufferManager> buffer_manager);
+        ~SegmentExtent();
+
+        SegmentExtent(const SegmentExtent&) = delete;
+        SegmentExtent& operator=(const SegmentExtent&) = delete;
+
+        /*
+         * Next page of the size class, allocating a new extent when the current one is used up. Returns
+         * INVALID_PAGE_ID if the extent could not be allocated.
+         */
+        page_id_t NextPage(size_class_t size_class);
+};
+
 class ColumnSegment: public SegmentBase {
     public:
         std::shared_ptr<BufferManager> buffer_manager_;
@@ -21,12 +50,19 @@ class ColumnSegment: public SegmentBase {
             size_t count, page_id_t page_id, size_t offset, ColumnSegmentType segment_type, size_t segment_size
         );
 
+        /* With an extent, the segment's page is taken from it. Otherwise the segment gets a page of its own. */
         static std::unique_ptr<ColumnSegment> CreateTransientSegment(
-            std::shared_ptr<BufferManager> buffer_manager, row_id_t start, idx_t count
+            std::shared_ptr<BufferManager> buffer_manager, row_id_t start, idx_t count, SegmentExtent* extent = nullptr
         );
 
-        void ConvertToPersistent();
+        /*
+         * Writes the segment's page back and marks the segment persistent: read-only from then on. Scans of a
+         * persistent segment read its page through the file mapping, so they take no frame from the pool.
+         * Returns false, leaving the segment transient, if the page could not be written.
+         */
+        bool ConvertToPersistent();
 
+        /* Appends to a persistent segment are refused: InitAppend leaves no write guard, and Append adds nothing. */
         void InitAppend(ColumnAppendState &append_state);
         size_t Append(ColumnAppendState &append_state, std::vector<std::string> &data);
         void FinalizeAppend(ColumnAppendState &append_state);
@@ -32,7 +32,7 @@ struct UncompressedStringStorage {
 
         static idx_t RemainingSpace(ColumnAppendState &append_state, ColumnSegment &segment);
 
-        static std::unique_ptr<GuardedPageReader> InitScan(ColumnSegment &segment);
+        static std::unique_ptr<GuardedPageReader> InitScan(ColumnSegment &segment, AccessHint access_hint);
 
         static idx_t Scan(ColumnScanState &scan_state, ColumnSegment &segment,
             std::vector<std::string> &result, idx_t count);
@@ -0,0 +1,154 @@
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#pragma once
+
+template <typename T>
+class Task;
+
+namespace task_detail {
+
+/* Resumes whoever awaits the task once it finishes, without growing the stack (symmetric transfer). */
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        std::coroutine_handle<> continuation = handle.promise().continuation_;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr error_;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error_ = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise: PromiseBase {
+    std::optional<T> value_;
+
+    Task<T> get_return_object();
+    void return_value(T value) { value_.emplace(std::move(value)); }
+
+    T Result() {
+        if (error_)
+            std::rethrow_exception(error_);
+        return std::move(value_.value());
+    }
+};
+
+template <>
+struct Promise<void>: PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+
+    void Result() {
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+};
+
+/* Started suspended and destroys itself when done. Used to run a task from outside any coroutine. */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return Detached{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+}  // namespace task_detail
+
+/*
+ * Lazily started coroutine returning a T. It runs when first awaited, and resumes the awaiting coroutine
+ * when it finishes, on whichever thread it finished on. Exceptions propagate to the awaiter.
+ */
+template <typename T = void>
+class Task {
+    public:
+        using promise_type = task_detail::Promise<T>;
+
+        explicit Task(std::coroutine_handle<promise_type> handle): handle_(handle) {}
+
+        Task(Task&& that) noexcept: handle_(std::exchange(that.handle_, nullptr)) {}
+
+        Task& operator=(Task&& that) noexcept {
+            if (&that != this) {
+                if (handle_)
+                    handle_.destroy();
+                handle_ = std::exchange(that.handle_, nullptr);
+            }
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task() {
+            if (handle_)
+                handle_.destroy();
+        }
+
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+            handle_.promise().continuation_ = awaiter;
+            return handle_;
+        }
+
+        T await_resume() { return handle_.promise().Result(); }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+};
+
+namespace task_detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+template <typename T>
+Detached RunAndSignal(Task<T>& task, std::promise<T>& done) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            done.set_value();
+        } else {
+            done.set_value(co_await task);
+        }
+    } catch (...) {
+        done.set_exception(std::current_exception());
+    }
+}
+
+}  // namespace task_detail
+
+/* Runs the task on the calling thread until it first suspends, and blocks until it finishes. */
+template <typename T>
+T SyncWait(Task<T> task) {
+    std::promise<T> done;
+    std::future<T> result = done.get_future();
+    task_detail::RunAndSignal(task, done).handle_.resume();
+    return result.get();
+}
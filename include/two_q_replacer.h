@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <optional>
+#include <vector>
+#include "common.h"
+#include "metrics.h"
+#include "replacer.h"
+
+#pragma once
+
+/*
+ * Full 2Q (Johnson and Shasha). Pages read in for the first time enter A1in, a FIFO. Pages evicted from
+ * A1in are remembered in A1out, and only go to Am, an LRU list, when they are read in again while in
+ * A1out. A page touched by a single scan therefore never displaces the hot pages in Am.
+ * A1in holds about a quarter of the capacity, and A1out remembers half as many pages.
+ *
+ * Pages read in by a scan or bulk load go to the old end of A1in, and are not remembered in A1out.
+ *
+ * Pinned frames stay in their list, and are skipped by Evict. Hits on resident pages only set the frame's reference
+ * bit, and are applied when Evict comes across the frame.
+ */
+class TwoQReplacer: public Replacer {
+    public:
+        TwoQReplacer(size_t num_frames, FrameStateTable* frames, Metrics* metrics = nullptr);
+
+        ~TwoQReplacer() = default;
+
+    protected:
+        std::optional<frame_id_t> EvictLocked() override;
+        void RecordAccessLocked(frame_id_t frame_id, page_id_t page_id, AccessHint hint) override;
+        void RemoveLocked(frame_id_t frame_id) override;
+        void ResizeLocked(size_t num_frames) override;
+        size_t SizeLocked() override { return CountClaimable(a1in_) + CountClaimable(am_); }
+
+    private:
+        enum class Queue: uint8_t { NONE, A1IN, AM };
+
+        size_t num_frames_;
+        std::vector<page_id_t> page_ids_;
+        std::vector<Queue> queues_;
+        std::vector<bool> cold_;  /* Page was only accessed by scans or bulk loads. */
+        std::vector<frame_id_t> prev_;
+        std::vector<frame_id_t> next_;
+        FrameList a1in_;
+        FrameList am_;
+        GhostList a1out_;
+
+        size_t MaxA1In() { return std::max(capacity_ / 4, size_t(1)); }
+        size_t MaxA1Out() { return std::max(capacity_ / 2, size_t(1)); }
+
+        /* Applies a hit on a tracked frame. */
+        void Hit(frame_id_t frame_id);
+
+        void Unlink(frame_id_t frame_id);
+};
@@ -0,0 +1,387 @@
+#include "background_scheduler.h"
+#include "blocking_queue.h"
+#include "common.h"
+#include "disk_manager.h"
+#include "metrics.h"
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+std::filesystem::path db_path(DB_PATH);
+
+/* Push blocks while the queue is full, until a consumer pops. */
+TEST(PriorityBlockingQueueTest, BoundedPushTest) {
+    PriorityBlockingQueue<int> queue(2, {0});
+    ASSERT_TRUE(queue.Push(0, 0));
+    ASSERT_TRUE(queue.Push(1, 0));
+
+    std::atomic<bool> pushed = false;
+    std::thread producer([&] {
+        queue.Push(2, 0);
+        pushed = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(pushed);
+
+    EXPECT_EQ(queue.Pop(), 0);
+    producer.join();
+    EXPECT_TRUE(pushed);
+    EXPECT_EQ(queue.Pop(), 1);
+    EXPECT_EQ(queue.Pop(), 2);
+}
+
+/* After Close, queued items are still popped, then Pop returns nullopt and Push fails. */
+TEST(PriorityBlockingQueueTest, CloseTest) {
+    PriorityBlockingQueue<int> queue(4, {0});
+    queue.Push(7, 0);
+
+    /* A consumer sleeping on an empty queue is woken up by Close. */
+    PriorityBlockingQueue<int> empty(4, {0});
+    std::thread consumer([&] { EXPECT_FALSE(empty.Pop().has_value()); });
+    empty.Close();
+    consumer.join();
+
+    queue.Close();
+    EXPECT_FALSE(queue.Push(8, 0));
+    EXPECT_EQ(queue.Pop(), 7);
+    EXPECT_FALSE(queue.Pop().has_value());
+}
+
+/* Higher classes are popped first, each class in push order. */
+TEST(PriorityBlockingQueueTest, PriorityOrderTest) {
+    const uint64_t hour_ns = 3600ULL * 1000000000;
+    PriorityBlockingQueue<int> queue(8, {0, hour_ns, hour_ns});
+    queue.Push(20, 2);
+    queue.Push(10, 1);
+    queue.Push(21, 2);
+    queue.Push(0, 0);
+    queue.Push(11, 1);
+
+    for (int expected : {0, 10, 11, 20, 21})
+        EXPECT_EQ(queue.Pop(), expected);
+    EXPECT_EQ(queue.Size(), 0);
+}
+
+/* A lower class item is popped ahead of higher class ones once it has waited its class's delay, or is past an explicit deadline. */
+TEST(PriorityBlockingQueueTest, DeadlineTest) {
+    const uint64_t delay_ns = 20 * 1000000;
+    PriorityBlockingQueue<int> queue(8, {0, delay_ns});
+    queue.Push(10, 1);
+    std::this_thread::sleep_for(std::chrono::nanoseconds(2 * delay_ns));
+    queue.Push(0, 0);
+    EXPECT_EQ(queue.Pop(), 10);
+    EXPECT_EQ(queue.Pop(), 0);
+
+    uint64_t now = PriorityBlockingQueue<int>::NowNs();
+    queue.Push(1, 0);
+    queue.Push(11, 1, now - 1);
+    queue.Push(12, 1);
+    EXPECT_EQ(queue.Pop(), 11);
+    EXPECT_EQ(queue.Pop(), 1);
+    EXPECT_EQ(queue.Pop(), 12);
+}
+
+/* TryPopIf takes only a matching item of the class, and leaves the others queued in order. */
+TEST(PriorityBlockingQueueTest, TryPopIfTest) {
+    const uint64_t hour_ns = 3600ULL * 1000000000;
+    PriorityBlockingQueue<int> queue(8, {0, hour_ns});
+    queue.Push(0, 0);
+    queue.Push(10, 1);
+    queue.Push(1, 0);
+    queue.Push(11, 1);
+
+    EXPECT_EQ(queue.TryPopIf(1, [](int item) { return item % 2 == 0; }), 10);
+    EXPECT_EQ(queue.TryPopIf(1, [](int item) { return item == 0; }), std::nullopt);
+    EXPECT_EQ(queue.Size(), 3);
+    for (int expected : {0, 1, 11})
+        EXPECT_EQ(queue.Pop(), expected);
+}
+
+/* Several client threads write and read back distinct pages. */
+static void ConcurrentReadWrite(IOBackend backend) {
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    const size_t num_clients = 8;
+    const size_t pages_per_client = 64;
+    {
+        Background_Scheduler scheduler(&disk_manager, nullptr, 4, 16, backend);
+        ASSERT_EQ(scheduler.GetNumThreads(), scheduler.GetBackend() == IOBackend::IO_URING ? 1 : 4);
+
+        std::vector<std::thread> clients;
+        for (size_t c = 0; c < num_clients; c++) {
+            clients.emplace_back([&, c] {
+                std::vector<std::vector<char>> data(pages_per_client, std::vector<char>(PAGE_SIZE));
+                std::vector<std::shared_ptr<Request>> reqs;
+                for (size_t i = 0; i < pages_per_client; i++) {
+                    page_id_t page_id = c * pages_per_client + i;
+                    snprintf(data[i].data(), PAGE_SIZE, "page %d", page_id);
+                    reqs.push_back(std::make_shared<Request>(false, page_id, (const char*)data[i].data()));
+                    scheduler.Schedule(reqs.back());
+                }
+                for (auto& req : reqs)
+                    EXPECT_TRUE(req->promise_->get_future().get());
+
+                std::vector<char> buf(PAGE_SIZE);
+                for (size_t i = 0; i < pages_per_client; i++) {
+                    auto req = std::make_shared<Request>(true, page_id_t(c * pages_per_client + i), buf.data());
+                    scheduler.Schedule(req);
+                    EXPECT_TRUE(req->promise_->get_future().get());
+                    EXPECT_EQ(memcmp(buf.data(), data[i].data(), PAGE_SIZE), 0);
+                }
+            });
+        }
+        for (auto& client : clients)
+            client.join();
+    }
+    std::filesystem::remove(db_path);
+}
+
+TEST(BackgroundSchedulerTest, ConcurrentReadWriteTest) {
+    ConcurrentReadWrite(IOBackend::THREAD_POOL);
+}
+
+/* Same through io_uring, or through the thread pool if the kernel does not allow io_uring. */
+TEST(BackgroundSchedulerTest, IOUringReadWriteTest) {
+    ConcurrentReadWrite(IOBackend::IO_URING);
+}
+
+/* Requests into and out of registered buffers use fixed buffer I/O, the others plain I/O. */
+TEST(BackgroundSchedulerTest, RegisteredBuffersTest) {
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    {
+        Background_Scheduler scheduler(&disk_manager, nullptr, 1, 16, IOBackend::IO_URING);
+        if (scheduler.GetBackend() != IOBackend::IO_URING)
+            GTEST_SKIP() << "io_uring is unavailable";
+
+        const page_id_t num_pages = 8;
+        alignas(PAGE_SIZE) static char registered[num_pages * PAGE_SIZE];
+        std::vector<iovec> buffers{iovec{registered, sizeof(registered)}};
+        if (!scheduler.RegisterBuffers(buffers))
+            GTEST_SKIP() << "buffers cannot be registered";
+
+        char unregistered[PAGE_SIZE];
+        for (page_id_t page_id = 0; page_id < num_pages; page_id++) {
+            char* data = page_id % 2 == 0 ? registered + page_id * PAGE_SIZE : unregistered;
+            memset(data, 'a' + page_id, PAGE_SIZE);
+            auto req = std::make_shared<Request>(false, page_id, (const char*)data);
+            scheduler.Schedule(req);
+            ASSERT_TRUE(req->promise_->get_future().get());
+        }
+
+        memset(registered, 0, sizeof(registered));
+        for (page_id_t page_id = 0; page_id < num_pages; page_id++) {
+            auto req = std::make_shared<Request>(true, page_id, registered + page_id * PAGE_SIZE);
+            scheduler.Schedule(req);
+            ASSERT_TRUE(req->promise_->get_future().get());
+            for (size_t i = 0; i < PAGE_SIZE; i++)
+                ASSERT_EQ(registered[page_id * PAGE_SIZE + i], 'a' + page_id);
+        }
+    }
+    std::filesystem::remove(db_path);
+}
+
+/*
+ * A request's callback holds up the only worker while requests for adjacent pages queue behind it. They are
+ * then served together, with vectored I/O, and each still gets its own page.
+ */
+static void CoalesceAdjacentPages(IOBackend backend) {
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    Metrics metrics;
+    const page_id_t num_pages = 64;
+    std::vector<char> data(num_pages * PAGE_SIZE);
+    for (page_id_t page_id = 0; page_id < num_pages; page_id++)
+        snprintf(data.data() + page_id * PAGE_SIZE, PAGE_SIZE, "page %d", page_id);
+    {
+        Background_Scheduler scheduler(&disk_manager, &metrics, 1, 256, backend);
+        char blocker_data[PAGE_SIZE] = {0};
+        for (bool read : {false, true}) {
+            std::promise<void> release;
+            std::shared_future<void> released = release.get_future().share();
+
+            /* Of the highest class, so the requests below cannot overtake it. */
+            auto blocker = std::make_shared<Request>(false, num_pages, (const char*)blocker_data,
+                IOPriority::FOREGROUND_READ);
+            blocker->on_complete_ = [released](bool) { released.wait(); };
+            scheduler.Schedule(blocker);
+
+            if (read)
+                memset(data.data(), 0, data.size());
+            std::vector<std::shared_ptr<Request>> reqs;
+            for (page_id_t page_id = 0; page_id < num_pages; page_id++) {
+                char* page = data.data() + page_id * PAGE_SIZE;
+                reqs.push_back(read ? std::make_shared<Request>(true, page_id, page) :
+                    std::make_shared<Request>(false, page_id, (const char*)page));
+                scheduler.Schedule(reqs.back());
+            }
+            release.set_value();
+            for (auto& req : reqs)
+                ASSERT_TRUE(req->promise_->get_future().get());
+            ASSERT_TRUE(blocker->promise_->get_future().get());
+        }
+    }
+    for (page_id_t page_id = 0; page_id < num_pages; page_id++)
+        EXPECT_STREQ(data.data() + page_id * PAGE_SIZE, ("page " + std::to_string(page_id)).c_str());
+    EXPECT_GT(metrics.Snapshot().Get(Metric::COALESCED_PAGES), 0);
+    std::filesystem::remove(db_path);
+}
+
+TEST(BackgroundSchedulerTest, CoalesceTest) {
+    CoalesceAdjacentPages(IOBackend::THREAD_POOL);
+}
+
+TEST(BackgroundSchedulerTest, IOUringCoalesceTest) {
+    CoalesceAdjacentPages(IOBackend::IO_URING);
+}
+
+/*
+ * A worker batches only requests for adjacent pages. Requests for other pages stay queued for the other worker,
+ * which serves them all while the first one is held up by a request's callback.
+ */
+TEST(BackgroundSchedulerTest, CoalesceOnlyAdjacentTest) {
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    char data[PAGE_SIZE] = {0};
+    for (page_id_t page_id = 0; page_id < 64; page_id++)
+        disk_manager.WritePage(page_id, data);
+    std::vector<std::vector<char>> bufs(64, std::vector<char>(PAGE_SIZE));
+    {
+        Background_Scheduler scheduler(&disk_manager, nullptr, 2, 64);
+
+        /* Park both workers, so the requests below are all queued before either pops one. */
+        std::promise<void> go;
+        std::shared_future<void> going = go.get_future().share();
+        std::atomic<size_t> parked = 0;
+        for (page_id_t page_id : {40, 50}) {
+            auto gate = std::make_shared<Request>(true, page_id, bufs[page_id].data());
+            gate->on_complete_ = [&parked, going](bool) { parked++; going.wait(); };
+            scheduler.Schedule(gate);
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (parked < 2 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+        if (parked < 2) {
+            go.set_value();
+            FAIL() << "one worker took both gates";
+        }
+
+        std::atomic<size_t> served = 0;
+        std::promise<bool> all_served;
+        auto holder = std::make_shared<Request>(true, 20, bufs[20].data());
+        holder->on_complete_ = [&](bool) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (served < 8 && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::yield();
+            all_served.set_value(served == 8);
+        };
+        scheduler.Schedule(holder);
+        for (page_id_t page_id = 0; page_id < 16; page_id += 2) {
+            auto req = std::make_shared<Request>(true, page_id, bufs[page_id].data());
+            req->on_complete_ = [&served](bool) { served++; };
+            scheduler.Schedule(req);
+        }
+        go.set_value();
+        EXPECT_TRUE(all_served.get_future().get());
+    }
+    std::filesystem::remove(db_path);
+}
+
+/*
+ * Foreground reads queued behind prefetches and flushes are served before them. Requests are only batched
+ * with requests of their own class: adjacent foreground reads are merged, and do not wait for the others.
+ */
+TEST(BackgroundSchedulerTest, PriorityTest) {
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    Metrics metrics;
+    std::vector<char> data(PAGE_SIZE);
+    for (page_id_t page_id = 0; page_id < 16; page_id++)
+        disk_manager.WritePage(page_id, data.data());
+    /* Only the worker appends to the order, which is read once the scheduler is gone. */
+    std::vector<page_id_t> order;
+    std::vector<std::vector<char>> bufs(16, std::vector<char>(PAGE_SIZE));
+    {
+        Background_Scheduler scheduler(&disk_manager, &metrics, 1, 64);
+        std::promise<void> release;
+        std::shared_future<void> released = release.get_future().share();
+        auto blocker = std::make_shared<Request>(true, 0, data.data());
+        blocker->on_complete_ = [released](bool) { released.wait(); };
+        scheduler.Schedule(blocker);
+
+        std::vector<std::shared_ptr<Request>> reqs;
+        for (page_id_t page_id = 1; page_id < 16; page_id++) {
+            IOPriority priority = page_id >= 13 ? IOPriority::FOREGROUND_READ :
+                page_id % 2 == 0 ? IOPriority::PREFETCH : IOPriority::BACKGROUND_FLUSH;
+            reqs.push_back(std::make_shared<Request>(true, page_id, bufs[page_id].data(), priority));
+            reqs.back()->on_complete_ = [&order, page_id](bool) { order.push_back(page_id); };
+            scheduler.Schedule(reqs.back());
+        }
+        release.set_value();
+    }
+    ASSERT_EQ(order.size(), 15);
+    for (size_t i = 0; i < 3; i++)
+        EXPECT_GE(order[i], 13);
+    for (size_t i = 3; i < 9; i++)
+        EXPECT_EQ(order[i] % 2, 1);
+    for (size_t i = 9; i < 15; i++)
+        EXPECT_EQ(order[i] % 2, 0);
+    EXPECT_EQ(metrics.Snapshot().Get(Metric::COALESCED_PAGES), 2);
+    std::filesystem::remove(db_path);
+}
+
+/* Requests still queued when the scheduler is destroyed are served, not dropped. */
+TEST(BackgroundSchedulerTest, DrainOnDestroyTest) {
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    char data[PAGE_SIZE] = "drained";
+    std::atomic<size_t> completed = 0;
+    {
+        Background_Scheduler scheduler(&disk_manager, nullptr, 2, 64);
+        for (page_id_t page_id = 0; page_id < 32; page_id++) {
+            auto req = std::make_shared<Request>(false, page_id, (const char*)data);
+            req->on_complete_ = [&](bool ok) { if (ok) completed++; };
+            scheduler.Schedule(req);
+        }
+    }
+    EXPECT_EQ(completed, 32);
+    std::filesystem::remove(db_path);
+}
+
+/* Barriers requested at once share fdatasyncs, and every one of them is answered. */
+TEST(BackgroundSchedulerTest, SyncBarrierTest) {
+    std::filesystem::remove(db_path);
+    DiskManager disk_manager(db_path, PAGE_SIZE);
+    Metrics metrics;
+    {
+        Background_Scheduler scheduler(&disk_manager, &metrics, 2, 64);
+        std::vector<std::thread> threads;
+        std::atomic<size_t> durable = 0;
+        for (size_t t = 0; t < 8; t++) {
+            threads.emplace_back([&, t] {
+                char data[PAGE_SIZE] = "synced";
+                for (page_id_t i = 0; i < 16; i++) {
+                    auto req = std::make_shared<Request>(false, page_id_t(t * 16 + i), (const char*)data);
+                    scheduler.Schedule(req);
+                    req->promise_->get_future().get();
+                    if (scheduler.SyncBarrier().get())
+                        durable++;
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        EXPECT_EQ(durable, 8 * 16);
+
+        /* A barrier requested with no writes is answered too. */
+        EXPECT_TRUE(scheduler.SyncBarrier().get());
+    }
+    MetricsSnapshot snapshot = metrics.Snapshot();
+    EXPECT_EQ(snapshot.Get(Metric::SYNC_BARRIERS), 8 * 16 + 1);
+    EXPECT_GE(snapshot.Get(Metric::SYNCS), 1);
+    EXPECT_LE(snapshot.Get(Metric::SYNCS), snapshot.Get(Metric::SYNC_BARRIERS));
+    std::filesystem::remove(db_path);
+}
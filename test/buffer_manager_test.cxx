@@ -3,6 +3,13 @@
 #include "disk_manager.h"
 #include "buffer_manager.h"
 #include "page_guard.h"
+#include "executor.h"
+#include "task.h"
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <future>
+#include <sys/resource.h>
 #include <thread>
 
 std::filesystem::path db_path(DB_PATH);
@@ -451,4 +458,858 @@ TEST(BufferPoolManagerTest, EvictableTest) {
       readers[i].join();
     }
   }
-}
\ No newline at end of file
+}
+
+TEST(BufferPoolManagerTest, ShardedConcurrentTest) {
+  // Threads work on disjoint pages that hash to different shards, while the pool is too small to hold them all.
+  const size_t num_threads = 8;
+  const size_t pages_per_thread = 16;
+  const size_t rounds = 5;
+
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(NUM_BUFFER_FRAMES * 2, disk_manager.get(), K_DIST, 4);
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      std::vector<page_id_t> pids;
+      for (size_t i = 0; i < pages_per_thread; i++) {
+        auto pid = bpm->NewPage();
+        ASSERT_NE(pid, INVALID_PAGE_ID);
+        pids.push_back(pid);
+      }
+
+      for (size_t r = 0; r < rounds; r++) {
+        for (auto pid : pids) {
+          auto guard = bpm->GetGuardedPageWriter(pid);
+          CopyString(guard.GetDataMut(), std::to_string(pid) + "_" + std::to_string(r));
+        }
+        for (auto pid : pids) {
+          auto guard = bpm->GetGuardedPageReader(pid);
+          EXPECT_STREQ(guard.GetData(), (std::to_string(pid) + "_" + std::to_string(r)).c_str());
+        }
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, SingleFlightLoadTest) {
+  // Many threads miss on the same page at once. They should all wait for the one read and see its data.
+  const size_t num_readers = 8;
+  const size_t rounds = 100;
+
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(2, disk_manager.get(), K_DIST);
+
+  const auto pid = bpm->NewPage();
+  {
+    auto guard = bpm->GetGuardedPageWriter(pid);
+    CopyString(guard.GetDataMut(), "cold");
+  }
+
+  for (size_t i = 0; i < rounds; i++) {
+    // Push the page out of the pool by pinning two other pages, so the readers below all miss.
+    {
+      auto guard0 = bpm->GetGuardedPageReader(bpm->NewPage());
+      auto guard1 = bpm->GetGuardedPageReader(bpm->NewPage());
+      ASSERT_FALSE(bpm->GetPinCount(pid).has_value());
+    }
+
+    auto before = bpm->GetMetrics();
+    std::atomic<bool> start = false;
+    std::vector<std::thread> readers;
+    for (size_t j = 0; j < num_readers; j++) {
+      readers.emplace_back([&]() {
+        while (!start.load()) {
+        }
+        auto guard_opt = bpm->GetGuardedPageReaderNoCheck(pid);
+        ASSERT_TRUE(guard_opt.has_value());
+        EXPECT_STREQ(guard_opt.value().GetData(), "cold");
+      });
+    }
+    start.store(true);
+
+    for (auto &reader : readers) {
+      reader.join();
+    }
+    ASSERT_EQ(0, bpm->GetPinCount(pid));
+
+    // Only one of the readers went to disk.
+    auto after = bpm->GetMetrics();
+    EXPECT_EQ(1, after.Get(Metric::MISSES) - before.Get(Metric::MISSES));
+    EXPECT_EQ(1, after.Get(LatencyHistogram::DISK_READ).Count() -
+                 before.Get(LatencyHistogram::DISK_READ).Count());
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, FrameArenaTest) {
+  // Frames are carved out of one page aligned arena, with or without transparent huge pages.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+
+  for (bool use_huge_pages : {false, true}) {
+    auto bpm = std::make_shared<BufferManager>(NUM_BUFFER_FRAMES, disk_manager.get(), K_DIST,
+      NUM_PAGE_TABLE_SHARDS, use_huge_pages);
+
+    std::vector<GuardedPageReader> guards;
+    std::vector<uintptr_t> addresses;
+    for (size_t i = 0; i < NUM_BUFFER_FRAMES; i++) {
+      guards.push_back(bpm->GetGuardedPageReader(bpm->NewPage()));
+      auto address = reinterpret_cast<uintptr_t>(guards.back().GetData());
+      EXPECT_EQ(0, address % PAGE_SIZE);
+      addresses.push_back(address);
+    }
+
+    std::sort(addresses.begin(), addresses.end());
+    EXPECT_EQ(addresses.back() - addresses.front(), (NUM_BUFFER_FRAMES - 1) * PAGE_SIZE);
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, BackgroundFlushTest) {
+  // Once the pool is mostly dirty, the flusher should clean it, so eviction rarely has to write synchronously.
+  const size_t num_frames = 64;
+
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(num_frames, disk_manager.get(), K_DIST);
+
+  std::vector<page_id_t> pids;
+  for (size_t i = 0; i < num_frames; i++) {
+    pids.push_back(bpm->NewPage());
+    auto guard = bpm->GetGuardedPageWriter(pids.back());
+    CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+  }
+
+  // Wait for the flusher to bring the pool below the low watermark.
+  for (size_t i = 0; i < 200 && bpm->GetFlushStats().background_flushes < num_frames * (1 - FLUSHER_LOW_WATERMARK); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_GE(bpm->GetFlushStats().background_flushes, num_frames * (1 - FLUSHER_LOW_WATERMARK));
+
+  // Reading the pages back evicts them all. Only the pages the flusher left dirty need a synchronous write.
+  for (size_t i = 0; i < num_frames; i++) {
+    pids.push_back(bpm->NewPage());
+  }
+  for (auto pid : pids) {
+    auto guard = bpm->GetGuardedPageReader(pid);
+    if (pid < static_cast<page_id_t>(num_frames)) {
+      EXPECT_STREQ(guard.GetData(), std::to_string(pid).c_str());
+    }
+  }
+
+  auto stats = bpm->GetFlushStats();
+  EXPECT_GE(stats.evictions, num_frames);
+  EXPECT_LE(stats.sync_flushes, stats.evictions / 2);
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, PrefetchTest) {
+  const size_t num_pages = 32;
+
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  std::vector<page_id_t> pids;
+  {
+    auto bpm = std::make_shared<BufferManager>(num_pages, disk_manager.get(), K_DIST);
+    for (size_t i = 0; i < num_pages; i++) {
+      pids.push_back(bpm->NewPage());
+      auto guard = bpm->GetGuardedPageWriter(pids.back());
+      CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+      guard.FlushPage();
+    }
+  }
+
+  // A fresh pool over the same disk starts cold. Prefetch loads the pages without pinning them.
+  {
+    auto bpm = std::make_shared<BufferManager>(num_pages, disk_manager.get(), K_DIST);
+    bpm->Prefetch(pids);
+    for (size_t i = 0; i < 200 && bpm->GetFlushStats().prefetches < num_pages; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(num_pages, bpm->GetFlushStats().prefetches);
+
+    for (auto pid : pids) {
+      ASSERT_EQ(0, bpm->GetPinCount(pid));
+      auto guard = bpm->GetGuardedPageReader(pid);
+      EXPECT_STREQ(guard.GetData(), std::to_string(pid).c_str());
+    }
+  }
+
+  // With readahead, a sequential scan prefetches the pages ahead of it.
+  {
+    auto bpm = std::make_shared<BufferManager>(num_pages, disk_manager.get(), K_DIST);
+    bpm->SetReadahead(8);
+    for (auto pid : pids) {
+      auto guard = bpm->GetGuardedPageReader(pid);
+      EXPECT_STREQ(guard.GetData(), std::to_string(pid).c_str());
+    }
+    EXPECT_GT(bpm->GetFlushStats().prefetches, 0);
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, BatchReadTest) {
+  const size_t num_frames = 8;
+
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(num_frames, disk_manager.get(), K_DIST);
+
+  std::vector<page_id_t> pids;
+  for (size_t i = 0; i < 2 * num_frames; i++) {
+    pids.push_back(bpm->NewPage());
+    auto guard = bpm->GetGuardedPageWriter(pids.back());
+    CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+  }
+
+  // The last pages are resident and the first ones were evicted, so the batch mixes hits and misses.
+  std::vector<page_id_t> batch(pids.begin() + num_frames / 2, pids.begin() + num_frames / 2 + num_frames);
+  {
+    auto guards = bpm->GetGuardedPageReaders(batch);
+    ASSERT_EQ(batch.size(), guards.Size());
+    for (size_t i = 0; i < guards.Size(); i++) {
+      EXPECT_EQ(batch[i], guards.GetPageId(i));
+      EXPECT_STREQ(guards.GetData(i), std::to_string(batch[i]).c_str());
+      EXPECT_EQ(1, bpm->GetPinCount(batch[i]));
+    }
+
+    // Every frame is pinned, so no other page can be read in.
+    EXPECT_FALSE(bpm->GetGuardedPageReadersNoCheck({pids[0]}).has_value());
+  }
+  for (auto pid : batch) {
+    EXPECT_EQ(0, bpm->GetPinCount(pid));
+  }
+
+  // A batch larger than the pool fails without leaving anything pinned.
+  EXPECT_FALSE(bpm->GetGuardedPageReadersNoCheck(pids).has_value());
+  for (auto pid : pids) {
+    auto pin_count = bpm->GetPinCount(pid);
+    EXPECT_TRUE(!pin_count.has_value() || pin_count.value() == 0);
+  }
+
+  // A page that does not exist fails the batch.
+  EXPECT_FALSE(bpm->GetGuardedPageReadersNoCheck({pids[0], 1000}).has_value());
+  EXPECT_TRUE(bpm->GetGuardedPageReadersNoCheck({pids[0], pids[1]}).has_value());
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, OptimisticReadTest) {
+  const size_t num_frames = 4;
+
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(num_frames, disk_manager.get(), K_DIST);
+
+  page_id_t pid = bpm->NewPage();
+  {
+    auto guard = bpm->GetGuardedPageWriter(pid);
+    CopyString(guard.GetDataMut(), "before");
+  }
+
+  auto reader_opt = bpm->GetOptimisticPageReader(pid);
+  ASSERT_TRUE(reader_opt.has_value());
+  auto reader = reader_opt.value();
+  EXPECT_STREQ("before", reader.GetData());
+  EXPECT_TRUE(reader.Validate());
+  EXPECT_EQ(0, bpm->GetPinCount(pid));
+
+  // A write invalidates the read, and blocks new optimistic readers while the writer guard is held.
+  {
+    auto guard = bpm->GetGuardedPageWriter(pid);
+    EXPECT_FALSE(bpm->GetOptimisticPageReader(pid).has_value());
+    EXPECT_FALSE(reader.Restart());
+    CopyString(guard.GetDataMut(), "after");
+  }
+  EXPECT_FALSE(reader.Validate());
+  ASSERT_TRUE(reader.Restart());
+  EXPECT_STREQ("after", reader.GetData());
+  EXPECT_TRUE(reader.Validate());
+
+  // Concurrent writers fill the page with one character. Every validated read must see a single character.
+  std::atomic<bool> stop = false;
+  std::thread writer([&]() {
+    for (char c = 'a'; !stop.load(); c = c == 'z' ? 'a' : c + 1) {
+      auto guard = bpm->GetGuardedPageWriter(pid);
+      std::memset(guard.GetDataMut(), c, PAGE_SIZE - 1);
+    }
+  });
+  std::vector<std::thread> readers;
+  std::atomic<size_t> torn_reads = 0;
+  for (size_t t = 0; t < 4; t++) {
+    readers.emplace_back([&]() {
+      char buf[PAGE_SIZE];
+      for (size_t i = 0; i < 2000; i++) {
+        ASSERT_TRUE(bpm->ReadPageOptimistic(pid, [&](const char *data) { std::memcpy(buf, data, PAGE_SIZE); }));
+        if (std::count(buf, buf + PAGE_SIZE - 1, buf[0]) != PAGE_SIZE - 1) {
+          torn_reads.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (auto &thread : readers) {
+    thread.join();
+  }
+  stop.store(true);
+  writer.join();
+  EXPECT_EQ(0, torn_reads.load());
+
+  // Once the page is evicted, the reader can no longer be restarted. Pin the other pages, so the page is the only victim.
+  {
+    std::vector<GuardedPageWriter> guards;
+    for (size_t i = 0; i < num_frames; i++) {
+      guards.push_back(bpm->GetGuardedPageWriter(bpm->NewPage()));
+    }
+  }
+  EXPECT_FALSE(reader.Restart());
+  EXPECT_FALSE(bpm->GetOptimisticPageReader(pid).has_value());
+  std::string data;
+  ASSERT_TRUE(bpm->ReadPageOptimistic(pid, [&](const char *page) { data = std::string(page, 1); }));
+  EXPECT_EQ(1, data.size());
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, SizeClassTest) {
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(std::vector<size_t>{2, 2, 2}, disk_manager.get(), K_DIST);
+
+  // Fill pages of every size class end to end, twice as many as there are frames.
+  std::vector<page_id_t> pids;
+  for (size_class_t size_class = 0; size_class < NUM_PAGE_SIZE_CLASSES; size_class++) {
+    for (size_t i = 0; i < 4; i++) {
+      page_id_t pid = bpm->NewPage(size_class);
+      ASSERT_NE(INVALID_PAGE_ID, pid);
+      ASSERT_EQ(size_class, GetPageSizeClass(pid));
+      auto guard = bpm->GetGuardedPageWriter(pid);
+      std::memset(guard.GetDataMut(), 'a' + i, PAGE_SIZE_CLASSES[size_class]);
+      pids.push_back(pid);
+    }
+  }
+
+  // Every page reads back whole, even after being evicted by pages of its own class.
+  for (size_t i = 0; i < pids.size(); i++) {
+    idx_t page_size = GetPageSize(pids[i]);
+    auto guard = bpm->GetGuardedPageReader(pids[i]);
+    EXPECT_EQ(page_size, std::count(guard.GetData(), guard.GetData() + page_size, 'a' + i % 4));
+  }
+
+  // Pinning every large frame leaves no room for another large page, but small pages are unaffected.
+  {
+    auto guard1 = bpm->GetGuardedPageReader(pids[8]);
+    auto guard2 = bpm->GetGuardedPageReader(pids[9]);
+    EXPECT_EQ(INVALID_PAGE_ID, bpm->NewPage(2));
+    EXPECT_NE(INVALID_PAGE_ID, bpm->NewPage(0));
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, ResizeTest) {
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(4, disk_manager.get(), K_DIST);
+
+  std::vector<page_id_t> pids;
+  for (size_t i = 0; i < 4; i++) {
+    pids.push_back(bpm->NewPage());
+    auto guard = bpm->GetGuardedPageWriter(pids.back());
+    CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+  }
+
+  {
+    // Shrinking evicts unpinned pages, but cannot reclaim the frame of a pinned page.
+    auto guard = bpm->GetGuardedPageReader(pids[0]);
+    EXPECT_EQ(0, bpm->Resize(1));
+    EXPECT_EQ(1, bpm->Resize(0));
+    EXPECT_EQ(1, bpm->GetNumFrames());
+    EXPECT_STREQ(guard.GetData(), std::to_string(pids[0]).c_str());
+  }
+  EXPECT_EQ(0, bpm->Resize(0));
+  EXPECT_EQ(0, bpm->GetNumFrames());
+  EXPECT_EQ(INVALID_PAGE_ID, bpm->NewPage());
+
+  // Growing reuses the retired frames, and adds new ones. Evicted pages were written back.
+  EXPECT_EQ(0, bpm->Resize(8));
+  EXPECT_EQ(8, bpm->GetNumFrames());
+  for (auto pid : pids) {
+    auto guard = bpm->GetGuardedPageReader(pid);
+    EXPECT_STREQ(guard.GetData(), std::to_string(pid).c_str());
+  }
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_NE(INVALID_PAGE_ID, bpm->NewPage());
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, MetricsTest) {
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(2, disk_manager.get(), K_DIST);
+  bpm->SetFlusherWatermarks(1, 1);
+
+  // The third page evicts a dirty page, and reading it back is a miss.
+  std::vector<page_id_t> pids;
+  for (size_t i = 0; i < 3; i++) {
+    pids.push_back(bpm->NewPage());
+    auto guard = bpm->GetGuardedPageWriter(pids.back());
+    CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+  }
+  {
+    auto guard = bpm->GetGuardedPageReader(pids[0]);
+    EXPECT_STREQ(guard.GetData(), std::to_string(pids[0]).c_str());
+  }
+
+  auto metrics = bpm->GetMetrics();
+  EXPECT_GE(metrics.Get(Metric::MISSES), 1);
+  EXPECT_GE(metrics.Get(Metric::DIRTY_EVICTIONS), 1);
+  EXPECT_EQ(metrics.Get(Metric::SYNC_FLUSHES), bpm->GetFlushStats().sync_flushes);
+  EXPECT_GE(metrics.Get(LatencyHistogram::DISK_READ).Count(), 1);
+  EXPECT_GE(metrics.Get(LatencyHistogram::DISK_WRITE).Count(), 1);
+  EXPECT_GT(metrics.Get(LatencyHistogram::DISK_READ).Percentile(99), 0);
+
+  // Counters updated by many threads add up once aggregated.
+  size_t hits = metrics.Get(Metric::HITS);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; t++) {
+    threads.emplace_back([&]() {
+      for (size_t i = 0; i < 1000; i++) {
+        auto guard = bpm->GetGuardedPageReader(pids[0]);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  metrics = bpm->GetMetrics();
+  EXPECT_EQ(hits + 4000, metrics.Get(Metric::HITS));
+  EXPECT_GT(metrics.HitRatio(), 0.9);
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, ReplacerPolicyTest) {
+  for (ReplacerType type : {ReplacerType::LRU_K, ReplacerType::CLOCK, ReplacerType::TWO_Q, ReplacerType::ARC}) {
+    std::filesystem::remove(db_path);
+    auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+    auto bpm = std::make_shared<BufferManager>(4, disk_manager.get(), K_DIST, NUM_PAGE_TABLE_SHARDS, false, type);
+
+    // Write three times as many pages as there are frames, keeping one pinned throughout.
+    std::vector<page_id_t> pids;
+    for (size_t i = 0; i < 12; i++) {
+      pids.push_back(bpm->NewPage());
+      auto guard = bpm->GetGuardedPageWriter(pids.back());
+      CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+    }
+    auto pinned = bpm->GetGuardedPageReader(pids[0]);
+
+    // Every page reads back, twice over, while the pinned page stays in its frame.
+    for (size_t round = 0; round < 2; round++) {
+      for (page_id_t pid : pids) {
+        auto guard = bpm->GetGuardedPageReader(pid);
+        EXPECT_STREQ(guard.GetData(), std::to_string(pid).c_str());
+      }
+    }
+    EXPECT_STREQ(pinned.GetData(), std::to_string(pids[0]).c_str());
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, ScanResistanceTest) {
+  for (ReplacerType type : {ReplacerType::LRU_K, ReplacerType::CLOCK, ReplacerType::TWO_Q, ReplacerType::ARC}) {
+    std::filesystem::remove(db_path);
+    auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+    auto bpm = std::make_shared<BufferManager>(8, disk_manager.get(), K_DIST, NUM_PAGE_TABLE_SHARDS, false, type);
+
+    // A few hot pages, then a bulk load of many more pages than there are frames.
+    std::vector<page_id_t> hot_pids;
+    for (size_t i = 0; i < 4; i++) {
+      hot_pids.push_back(bpm->NewPage());
+    }
+    std::vector<page_id_t> cold_pids;
+    for (size_t i = 0; i < 32; i++) {
+      cold_pids.push_back(bpm->NewPage(0, AccessHint::BULK_LOAD));
+      ASSERT_NE(INVALID_PAGE_ID, cold_pids.back());
+    }
+    for (size_t round = 0; round < 2; round++) {
+      for (page_id_t pid : hot_pids) {
+        auto guard = bpm->GetGuardedPageReader(pid);
+      }
+    }
+
+    // A full scan only recycles the frames of the pages it reads in, so the hot pages stay resident.
+    for (page_id_t pid : cold_pids) {
+      auto guard = bpm->GetGuardedPageReader(pid, AccessHint::SCAN);
+    }
+    size_t misses = bpm->GetMetrics().Get(Metric::MISSES);
+    for (page_id_t pid : hot_pids) {
+      auto guard = bpm->GetGuardedPageReader(pid);
+    }
+    EXPECT_EQ(misses, bpm->GetMetrics().Get(Metric::MISSES)) << "replacer " << static_cast<int>(type);
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, LockFreePinTest) {
+  // Readers pin and unpin a few hot pages without the replacer lock, while a writer keeps evicting pages
+  // by creating new ones. Pins must never be lost, and evicted hot pages must read back intact.
+  const size_t num_readers = 4;
+  const size_t rounds = 2000;
+
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(8, disk_manager.get(), K_DIST);
+
+  std::vector<page_id_t> hot_pids;
+  for (size_t i = 0; i < 2; i++) {
+    hot_pids.push_back(bpm->NewPage());
+    auto guard = bpm->GetGuardedPageWriter(hot_pids.back());
+    CopyString(guard.GetDataMut(), std::to_string(hot_pids.back()));
+  }
+
+  std::vector<std::thread> readers;
+  for (size_t t = 0; t < num_readers; t++) {
+    readers.emplace_back([&, t]() {
+      for (size_t r = 0; r < rounds; r++) {
+        page_id_t pid = hot_pids[(r + t) % hot_pids.size()];
+        auto guard = bpm->GetGuardedPageReader(pid);
+        EXPECT_STREQ(guard.GetData(), std::to_string(pid).c_str());
+      }
+    });
+  }
+  std::thread writer([&]() {
+    for (size_t i = 0; i < 200; i++) {
+      page_id_t pid = bpm->NewPage();
+      ASSERT_NE(INVALID_PAGE_ID, pid);
+      auto guard = bpm->GetGuardedPageWriter(pid);
+      CopyString(guard.GetDataMut(), std::to_string(pid));
+    }
+  });
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  writer.join();
+
+  for (page_id_t pid : hot_pids) {
+    auto pin_count = bpm->GetPinCount(pid);
+    EXPECT_TRUE(!pin_count.has_value() || pin_count.value() == 0);
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, IOUringBackendTest) {
+  // Evictions write back and misses read into frames registered with the io_uring. Falls back to the thread
+  // pool where io_uring is unavailable, and then must behave the same.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(4, disk_manager.get(), K_DIST, NUM_PAGE_TABLE_SHARDS, false,
+    DEFAULT_REPLACER, NUM_BACKGROUND_THREADS, IOBackend::IO_URING);
+
+  std::vector<page_id_t> pids;
+  for (size_t i = 0; i < 16; i++) {
+    pids.push_back(bpm->NewPage());
+    auto guard = bpm->GetGuardedPageWriter(pids.back());
+    CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+  }
+
+  // Retired frames get fresh memory when reused, so the frames are registered again.
+  EXPECT_EQ(0, bpm->Resize(2));
+  EXPECT_EQ(0, bpm->Resize(6));
+  for (size_t r = 0; r < 2; r++) {
+    for (auto pid : pids) {
+      auto guard = bpm->GetGuardedPageReader(pid);
+      EXPECT_STREQ(guard.GetData(), std::to_string(pid).c_str());
+    }
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, AsyncFetchTest) {
+  // Many more coroutines than executor threads fetch pages through a pool smaller than the pages, so most
+  // fetches suspend on a read, and some on another fetch's read of the same page. Each coroutine pins at most
+  // one frame at a time, so the pool never runs out.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(256, disk_manager.get(), K_DIST);
+
+  std::vector<page_id_t> pids;
+  for (size_t i = 0; i < 512; i++) {
+    pids.push_back(bpm->NewPage());
+    auto guard = bpm->GetGuardedPageWriter(pids.back());
+    CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+  }
+
+  std::atomic<size_t> mismatches = 0;
+  std::atomic<size_t> fetched = 0;
+  {
+    Executor executor(2);
+    auto fetch = [&](size_t first) -> Task<void> {
+      for (size_t i = 0; i < 8; i++) {
+        page_id_t pid = pids[(first * 37 + i * 101) % pids.size()];
+        std::optional<GuardedPageReader> guard = co_await bpm->FetchRead(pid, executor);
+        if (!guard.has_value() || std::to_string(pid) != guard->GetData())
+          mismatches++;
+        fetched++;
+      }
+    };
+    for (size_t i = 0; i < 200; i++)
+      executor.Spawn(fetch(i));
+    executor.WaitIdle();
+  }
+  EXPECT_EQ(0, mismatches.load());
+  EXPECT_EQ(200 * 8, fetched.load());
+
+  // A task can be awaited from outside any coroutine. A page that does not exist yields no guard.
+  Executor executor(1);
+  auto read = [&](page_id_t pid) -> Task<std::string> {
+    co_await executor.Schedule();
+    std::optional<GuardedPageReader> guard = co_await bpm->FetchRead(pid, executor);
+    co_return guard.has_value() ? std::string(guard->GetData()) : std::string("missing");
+  };
+  EXPECT_EQ(std::to_string(pids[5]), SyncWait(read(pids[5])));
+  EXPECT_EQ("missing", SyncWait(read(pids.back() + 1000)));
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, CheckpointTest) {
+  // Checkpoints run while writers dirty pages and a small pool evicts them. Each checkpoint writes back the
+  // pages dirty when it started, and concurrent ones share fdatasyncs.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(32, disk_manager.get(), K_DIST);
+
+  std::vector<page_id_t> pids;
+  for (size_t i = 0; i < 64; i++)
+    pids.push_back(bpm->NewPage());
+
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> writers;
+  for (size_t t = 0; t < 2; t++) {
+    writers.emplace_back([&, t] {
+      for (size_t i = 0; !stop.load(); i++) {
+        page_id_t pid = pids[(t * 31 + i * 7) % pids.size()];
+        auto guard = bpm->GetGuardedPageWriter(pid);
+        CopyString(guard.GetDataMut(), std::to_string(pid));
+      }
+    });
+  }
+  std::vector<std::thread> checkpointers;
+  std::atomic<size_t> durable = 0;
+  for (size_t t = 0; t < 4; t++) {
+    checkpointers.emplace_back([&] {
+      for (size_t i = 0; i < 10; i++)
+        durable += bpm->Checkpoint().get();
+    });
+  }
+  for (auto &thread : checkpointers)
+    thread.join();
+  stop = true;
+  for (auto &thread : writers)
+    thread.join();
+  EXPECT_EQ(40, durable.load());
+
+  // With no writers left, a checkpoint leaves no dirty page behind, and the pages read back from disk.
+  EXPECT_TRUE(bpm->Checkpoint().get());
+  MetricsSnapshot metrics = bpm->GetMetrics();
+  EXPECT_GE(metrics.Get(Metric::SYNCS), 1);
+  EXPECT_LE(metrics.Get(Metric::SYNCS), 41);
+  std::vector<char> buf(PAGE_SIZE);
+  for (auto pid : pids) {
+    auto guard = bpm->GetGuardedPageReader(pid);
+    disk_manager->ReadPage(pid, buf.data());
+    EXPECT_STREQ(buf.data(), guard.GetData());
+  }
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, CheckpointWriteFailureTest) {
+  // A page whose write fails stays dirty, and the checkpoint reports the failure instead of durability.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(NUM_BUFFER_FRAMES, disk_manager.get(), K_DIST);
+
+  const auto pid = bpm->NewPage();
+  {
+    auto guard = bpm->GetGuardedPageWriter(pid);
+    CopyString(guard.GetDataMut(), "durable");
+  }
+
+  // Cap the file at its current size, so writing the new page past its end fails with EFBIG.
+  struct rlimit old_limit;
+  ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &old_limit));
+  auto old_handler = signal(SIGXFSZ, SIG_IGN);
+  struct rlimit limit = old_limit;
+  limit.rlim_cur = std::filesystem::file_size(db_path);
+  ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+  bool ok = bpm->Checkpoint().get();
+  setrlimit(RLIMIT_FSIZE, &old_limit);
+  signal(SIGXFSZ, old_handler);
+  EXPECT_FALSE(ok);
+
+  // The page was left dirty, so the next checkpoint writes it.
+  EXPECT_TRUE(bpm->Checkpoint().get());
+  std::vector<char> buf(PAGE_SIZE);
+  disk_manager->ReadPage(pid, buf.data());
+  EXPECT_STREQ(buf.data(), "durable");
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, NewPagesExhaustedTest) {
+  // An extent that would run past the last id of its size class is refused, without using up ids.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  const page_id_t class_pages = page_id_t(1) << PAGE_SIZE_CLASS_SHIFT;
+  disk_manager->AllocatePage(class_pages - 10);
+  auto bpm = std::make_shared<BufferManager>(NUM_BUFFER_FRAMES, disk_manager.get(), K_DIST);
+
+  EXPECT_EQ(INVALID_PAGE_ID, bpm->NewPages(9));
+  EXPECT_EQ(class_pages - 9, bpm->NewPages(8));
+  EXPECT_EQ(INVALID_PAGE_ID, bpm->NewPages(1));
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, EvictionWriteFailureTest) {
+  // When every victim's write-back fails, looking for a frame gives up instead of retrying them forever.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(2, disk_manager.get(), K_DIST);
+  for (int i = 0; i < 2; i++) {
+    ASSERT_NE(INVALID_PAGE_ID, bpm->NewPage());
+  }
+
+  // Cap the file at its current size, so writing the new pages past its end fails with EFBIG.
+  struct rlimit old_limit;
+  ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &old_limit));
+  auto old_handler = signal(SIGXFSZ, SIG_IGN);
+  struct rlimit limit = old_limit;
+  limit.rlim_cur = std::filesystem::file_size(db_path);
+  ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+  auto new_page = std::async(std::launch::async, [&] { return bpm->NewPage(); });
+  bool returned = new_page.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+
+  // Lift the cap either way, so a livelocked NewPage gets its frame and the test ends.
+  setrlimit(RLIMIT_FSIZE, &old_limit);
+  signal(SIGXFSZ, old_handler);
+  EXPECT_TRUE(returned);
+  EXPECT_EQ(INVALID_PAGE_ID, new_page.get());
+
+  // The dirty pages stayed in the pool, and can be evicted once their writes succeed.
+  EXPECT_NE(INVALID_PAGE_ID, bpm->NewPage());
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, CheckpointLatchedPageTest) {
+  // A checkpoint waiting for a writer's latch must not hold an I/O pin the writer waits for while it looks
+  // for a frame. The threads are detached, so a deadlock fails the test rather than hanging it.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(1, disk_manager.get(), K_DIST);
+  const auto pid = bpm->NewPage();
+
+  std::promise<void> latched;
+  std::promise<void> go;
+  std::packaged_task<page_id_t()> writer([bpm, pid, &latched, go = go.get_future()]() mutable {
+    auto guard = bpm->GetGuardedPageWriter(pid);
+    latched.set_value();
+    go.wait();
+    // The only frame is pinned by our guard, so no frame can be found.
+    return bpm->NewPage();
+  });
+  auto new_page = writer.get_future();
+  std::thread(std::move(writer)).detach();
+  latched.get_future().wait();
+
+  std::packaged_task<bool()> checkpoint([bpm] { return bpm->Checkpoint().get(); });
+  auto durable = checkpoint.get_future();
+  std::thread(std::move(checkpoint)).detach();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  go.set_value();
+
+  ASSERT_EQ(std::future_status::ready, new_page.wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(INVALID_PAGE_ID, new_page.get());
+  ASSERT_EQ(std::future_status::ready, durable.wait_for(std::chrono::seconds(5)));
+  EXPECT_TRUE(durable.get());
+
+  remove(db_path);
+}
+
+TEST(BufferPoolManagerTest, ReadFailureTest) {
+  // A page whose read fails is not left mapped: every fetch path reports the failure, and a later fetch
+  // reads the page again.
+  std::filesystem::remove(db_path);
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  std::vector<page_id_t> pids;
+  {
+    auto bpm = std::make_shared<BufferManager>(4, disk_manager.get(), K_DIST);
+    for (int i = 0; i < 2; i++) {
+      pids.push_back(bpm->NewPage());
+      auto guard = bpm->GetGuardedPageWriter(pids.back());
+      CopyString(guard.GetDataMut(), std::to_string(pids.back()));
+    }
+    ASSERT_TRUE(bpm->Checkpoint().get());
+  }
+
+  // Cut the pages off the end of the file, so reading them comes up short.
+  std::string contents(std::filesystem::file_size(db_path), 0);
+  std::ifstream(db_path, std::ios::binary).read(contents.data(), contents.size());
+  std::filesystem::resize_file(db_path, 2 * PAGE_SIZE);
+
+  auto bpm = std::make_shared<BufferManager>(4, disk_manager.get(), K_DIST);
+  EXPECT_FALSE(bpm->GetGuardedPageReaderNoCheck(pids[0]).has_value());
+  EXPECT_FALSE(bpm->GetPinCount(pids[0]).has_value());
+  EXPECT_FALSE(bpm->GetGuardedPageReadersNoCheck(pids).has_value());
+  EXPECT_FALSE(bpm->GetPinCount(pids[1]).has_value());
+
+  Executor executor(1);
+  auto read = [&](page_id_t pid) -> Task<bool> {
+    co_await executor.Schedule();
+    std::optional<GuardedPageReader> guard = co_await bpm->FetchRead(pid, executor);
+    co_return guard.has_value();
+  };
+  EXPECT_FALSE(SyncWait(read(pids[0])));
+  EXPECT_FALSE(bpm->GetPinCount(pids[0]).has_value());
+
+  bpm->Prefetch(pids);
+  for (int i = 0; i < 5000 && (bpm->GetPinCount(pids[0]).has_value() || bpm->GetPinCount(pids[1]).has_value()); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_FALSE(bpm->GetPinCount(pids[0]).has_value());
+  EXPECT_FALSE(bpm->GetPinCount(pids[1]).has_value());
+  EXPECT_EQ(0, bpm->GetMetrics().Get(Metric::PREFETCHES));
+
+  // Once the file is whole again, the pages are read, into frames the failed loads gave back.
+  std::ofstream(db_path, std::ios::binary).write(contents.data(), contents.size());
+  for (page_id_t pid : pids) {
+    auto guard = bpm->GetGuardedPageReaderNoCheck(pid);
+    ASSERT_TRUE(guard.has_value());
+    EXPECT_STREQ(std::to_string(pid).c_str(), guard->GetData());
+  }
+  EXPECT_TRUE(bpm->GetGuardedPageReadersNoCheck(pids).has_value());
+
+  remove(db_path);
+}
@@ -12,6 +12,8 @@
 #include "append_state.h"
 #include "column_segment.h"
 #include "common.h"
+#include <csignal>
+#include <sys/resource.h>
 
 std::filesystem::path db_path(DB_PATH);
 
@@ -46,3 +48,157 @@ TEST(ColumnSegmentTest, VeryBasicTest) {
   }
 }
 
+TEST(ColumnSegmentTest, LargeSegmentTest) {
+  std::filesystem::remove(db_path);
+
+  // A segment larger than PAGE_SIZE is backed by a single page of a larger size class.
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(std::vector<size_t>{1, 0, 1}, disk_manager.get(), K_DIST);
+
+  idx_t segment_size = PAGE_SIZE_CLASSES[NUM_PAGE_SIZE_CLASSES - 1];
+  auto column_segment = ColumnSegment::CreateTransientSegment(bpm, 0, segment_size);
+  EXPECT_EQ(NUM_PAGE_SIZE_CLASSES - 1, GetPageSizeClass(column_segment->page_id_));
+
+  std::vector<std::string> data;
+  for (int i = 0; i < 4096; i++) {
+    data.push_back(std::string(32, 'a' + i % 26));
+  }
+  auto append_state = ColumnAppendState();
+  column_segment->InitAppend(append_state);
+  ASSERT_EQ(data.size(), column_segment->Append(append_state, data));
+  column_segment->FinalizeAppend(append_state);
+
+  std::vector<std::string> result(data.size());
+  auto scan_state = ColumnScanState();
+  column_segment->InitScan(scan_state);
+  ASSERT_EQ(data.size(), column_segment->Scan(scan_state, result, data.size()));
+  scan_state.read_guard.reset();
+  EXPECT_EQ(data, result);
+
+  remove(db_path);
+}
+
+TEST(ColumnSegmentTest, ExtentTest) {
+  std::filesystem::remove(db_path);
+
+  // Segments created through an extent get consecutive pages, adjacent on disk.
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(NUM_BUFFER_FRAMES, disk_manager.get(), K_DIST);
+
+  std::vector<std::unique_ptr<ColumnSegment>> segments;
+  {
+    SegmentExtent extent(bpm);
+    for (int i = 0; i < EXTENT_PAGES + 2; i++) {
+      segments.push_back(ColumnSegment::CreateTransientSegment(bpm, i, PAGE_SIZE, &extent));
+    }
+  }
+  for (int i = 1; i < EXTENT_PAGES; i++) {
+    EXPECT_EQ(segments[0]->page_id_ + i, segments[i]->page_id_);
+    EXPECT_EQ(disk_manager->GetPageOffset(segments[0]->page_id_).value() + i * PAGE_SIZE,
+              disk_manager->GetPageOffset(segments[i]->page_id_).value());
+  }
+
+  // The pages of the second extent that were not used are given back.
+  EXPECT_EQ(EXTENT_PAGES + 2, disk_manager->GetNumPages());
+
+  std::vector<std::string> data{"a", "b", "c"};
+  auto append_state = ColumnAppendState();
+  segments.back()->InitAppend(append_state);
+  segments.back()->Append(append_state, data);
+  segments.back()->FinalizeAppend(append_state);
+
+  std::vector<std::string> result(data.size());
+  auto scan_state = ColumnScanState();
+  segments.back()->InitScan(scan_state);
+  segments.back()->Scan(scan_state, result, data.size());
+  scan_state.read_guard.reset();
+  EXPECT_EQ(data, result);
+
+  remove(db_path);
+}
+
+TEST(ColumnSegmentTest, PersistentScanTest) {
+  std::filesystem::remove(db_path);
+
+  // Scans of a persistent segment read its page through the file mapping, without taking a frame.
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(NUM_BUFFER_FRAMES, disk_manager.get(), K_DIST);
+
+  auto column_segment = ColumnSegment::CreateTransientSegment(bpm, 0, disk_manager->GetPageSize());
+  std::vector<std::string> data{"persistent", "segments", "are", "mapped"};
+  auto append_state = ColumnAppendState();
+  column_segment->InitAppend(append_state);
+  column_segment->Append(append_state, data);
+  column_segment->FinalizeAppend(append_state);
+  ASSERT_TRUE(column_segment->ConvertToPersistent());
+  ASSERT_EQ(ColumnSegmentType::PERSISTENT, column_segment->segment_type_);
+
+  // The segment is read-only from now on.
+  std::vector<std::string> more{"rejected"};
+  column_segment->InitAppend(append_state);
+  EXPECT_EQ(nullptr, append_state.write_guard);
+  EXPECT_EQ(0, column_segment->Append(append_state, more));
+  column_segment->FinalizeAppend(append_state);
+  EXPECT_EQ(data.size(), column_segment->count.load());
+
+  // Push the page out of the pool: the mapped scan must not read it back in.
+  for (int i = 0; i < 2 * NUM_BUFFER_FRAMES; i++) {
+    bpm->GetGuardedPageWriter(bpm->NewPage());
+  }
+  ASSERT_FALSE(bpm->GetPinCount(column_segment->page_id_).has_value());
+
+  std::vector<std::string> result(data.size());
+  auto scan_state = ColumnScanState();
+  column_segment->InitScan(scan_state);
+  ASSERT_NE(nullptr, scan_state.mapped_data);
+  EXPECT_EQ(nullptr, scan_state.read_guard);
+  ASSERT_EQ(data.size(), column_segment->Scan(scan_state, result, data.size()));
+  EXPECT_EQ(data, result);
+  EXPECT_FALSE(bpm->GetPinCount(column_segment->page_id_).has_value());
+  EXPECT_EQ(1, bpm->GetMetrics().Get(Metric::MAPPED_READS));
+
+  // The pool path reads the same data.
+  std::vector<std::string> pooled(data.size());
+  auto pool_scan_state = ColumnScanState();
+  pool_scan_state.use_mapping = false;
+  column_segment->InitScan(pool_scan_state);
+  EXPECT_EQ(nullptr, pool_scan_state.mapped_data);
+  column_segment->Scan(pool_scan_state, pooled, data.size());
+  pool_scan_state.read_guard.reset();
+  EXPECT_EQ(data, pooled);
+
+  remove(db_path);
+}
+
+TEST(ColumnSegmentTest, PersistentFlushFailureTest) {
+  std::filesystem::remove(db_path);
+
+  // A segment whose page could not be written stays transient, so scans keep reading it from the pool.
+  auto disk_manager = std::make_shared<DiskManager>(db_path, PAGE_SIZE);
+  auto bpm = std::make_shared<BufferManager>(NUM_BUFFER_FRAMES, disk_manager.get(), K_DIST);
+
+  auto column_segment = ColumnSegment::CreateTransientSegment(bpm, 0, disk_manager->GetPageSize());
+  std::vector<std::string> data{"not", "yet", "durable"};
+  auto append_state = ColumnAppendState();
+  column_segment->InitAppend(append_state);
+  column_segment->Append(append_state, data);
+  column_segment->FinalizeAppend(append_state);
+
+  // Cap the file below the segment's page, so writing it fails with EFBIG.
+  struct rlimit old_limit;
+  ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &old_limit));
+  auto old_handler = signal(SIGXFSZ, SIG_IGN);
+  struct rlimit limit = old_limit;
+  limit.rlim_cur = PAGE_SIZE;
+  ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+  bool ok = column_segment->ConvertToPersistent();
+  setrlimit(RLIMIT_FSIZE, &old_limit);
+  signal(SIGXFSZ, old_handler);
+  EXPECT_FALSE(ok);
+  EXPECT_EQ(ColumnSegmentType::TRANSIENT, column_segment->segment_type_);
+
+  EXPECT_TRUE(column_segment->ConvertToPersistent());
+  EXPECT_EQ(ColumnSegmentType::PERSISTENT, column_segment->segment_type_);
+
+  remove(db_path);
+}
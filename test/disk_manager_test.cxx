@@ -1,40 +1,57 @@
 #include "common.h"
 #include "disk_manager.h"
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <future>
 #include <gtest/gtest.h>
 #include <memory>
-
-std::filesystem::path db_path(DB_PATH);
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
 
 class DiskManagerTest: public testing::Test {
     protected:
+        std::filesystem::path db_path_;
         std::unique_ptr<DiskManager> dm_;
 
+        /* Each test gets a file of its own, so tests can run in parallel. */
+        void SetUp() override {
+            const testing::TestInfo* info = testing::UnitTest::GetInstance()->current_test_info();
+            db_path_ = std::filesystem::temp_directory_path() /
+                (std::string("cygnet_") + info->test_suite_name() + "_" + info->name());
+            std::filesystem::remove(db_path_);
+        }
+
+        void TearDown() override {
+            dm_.reset();
+            std::filesystem::remove(db_path_);
+        }
+
         void CreateDB() {
-            std::filesystem::remove(db_path);
-            dm_ = std::make_unique<DiskManager>(db_path, PAGE_SIZE);
+            std::filesystem::remove(db_path_);
+            dm_ = std::make_unique<DiskManager>(db_path_, PAGE_SIZE);
         }
 
         void OpenDB() {
-            dm_ = std::make_unique<DiskManager>(db_path, PAGE_SIZE);
+            dm_ = std::make_unique<DiskManager>(db_path_, PAGE_SIZE);
         }
 };
 
-/* tests that db file is created and is preallocated the default number of pages */
+/* tests that db file is created with its header and first bitmap page, and grows by doubling */
 TEST_F(DiskManagerTest, DISABLED_CreateDBTest) {
     CreateDB();
-    EXPECT_EQ(std::filesystem::file_size(db_path), DEFAULT_DB_PAGES * PAGE_SIZE);
+    EXPECT_EQ(std::filesystem::file_size(db_path_), 2 * PAGE_SIZE);
 
-    /* Allocate pages until the db file doubles */
-    const std::unordered_map<page_id_t, size_t>& pages = dm_->GetPages();
-    for (int i=0; i< (DEFAULT_DB_PAGES + 1); i++) {
+    /* Allocate pages. The file holds the header, the bitmap, two directory pages and the pages. */
+    for (int i=0; i< (DEFAULT_DB_PAGES + 16); i++) {
         dm_->AllocatePage(i);
-        ASSERT_EQ(pages.size(), i+1);
-        if (i < DEFAULT_DB_PAGES)
-            ASSERT_EQ(std::filesystem::file_size(db_path), DEFAULT_DB_PAGES * PAGE_SIZE);
-        else
-            ASSERT_EQ(std::filesystem::file_size(db_path), 2 * DEFAULT_DB_PAGES * PAGE_SIZE);;
+        ASSERT_EQ(dm_->GetNumPages(), i+1);
+        size_t file_size = std::filesystem::file_size(db_path_);
+        ASSERT_GE(file_size, (i + 5) * PAGE_SIZE);
+        ASSERT_EQ(file_size & (file_size - 1), 0);
     }
-    remove(db_path);
 }
 
 TEST_F(DiskManagerTest, DISABLED_ReadWriteTest) {
@@ -47,10 +64,264 @@ TEST_F(DiskManagerTest, DISABLED_ReadWriteTest) {
     dm_->WritePage(0, data);
     dm_->ReadPage(0, buf);
     ASSERT_EQ(memcmp(data, buf, sizeof(data)), 0);
-    remove(db_path);
 }
 
+/* threads write, read back and delete their own pages at once, while the file grows and slots are reused */
+TEST_F(DiskManagerTest, ConcurrentReadWriteTest) {
+    CreateDB();
+
+    const int num_threads = 8;
+    const int pages_per_thread = 64;
+    std::vector<int> mismatches(num_threads, 0);
+    std::vector<std::thread> threads;
+    for (int t=0; t<num_threads; t++) {
+        threads.emplace_back([&, t] {
+            char data[PAGE_SIZE];
+            char buf[PAGE_SIZE];
+            for (int round=0; round<4; round++) {
+                for (int i=0; i<pages_per_thread; i++) {
+                    page_id_t page_id = t * pages_per_thread + i;
+                    memset(data, 0, PAGE_SIZE);
+                    snprintf(data, PAGE_SIZE, "%d:%d", page_id, round);
+                    dm_->WritePage(page_id, data);
+                }
+
+                std::vector<page_id_t> page_ids;
+                std::vector<char*> bufs;
+                std::vector<std::string> batch(pages_per_thread / 2, std::string(PAGE_SIZE, 0));
+                for (int i=0; i<pages_per_thread; i++) {
+                    page_id_t page_id = t * pages_per_thread + i;
+                    std::string expected = std::to_string(page_id) + ":" + std::to_string(round);
+                    if (i % 2 == 0) {
+                        dm_->ReadPage(page_id, buf);
+                        mismatches[t] += expected != buf;
+                    } else {
+                        page_ids.push_back(page_id);
+                        bufs.push_back(batch[i / 2].data());
+                    }
+                }
+                dm_->ReadPages(page_ids, bufs);
+                for (size_t i=0; i<page_ids.size(); i++) {
+                    std::string expected = std::to_string(page_ids[i]) + ":" + std::to_string(round);
+                    mismatches[t] += expected != bufs[i];
+                }
+
+                /* Freed slots go to other threads' pages in the next round. */
+                for (int i=0; i<pages_per_thread; i+=4)
+                    dm_->DeletePage(t * pages_per_thread + i);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (int t=0; t<num_threads; t++)
+        EXPECT_EQ(mismatches[t], 0);
+    EXPECT_EQ(dm_->GetNumPages(), num_threads * pages_per_thread * 3 / 4);
+}
+
+/* direct I/O transfers aligned buffers as they are, and unaligned ones through aligned copies */
+TEST_F(DiskManagerTest, DirectIOTest) {
+    dm_ = std::make_unique<DiskManager>(db_path_, PAGE_SIZE, true);
+
+    std::unique_ptr<char, decltype(&free)> aligned(
+        static_cast<char*>(aligned_alloc(DIRECT_IO_ALIGNMENT, 2 * PAGE_SIZE)), &free);
+    std::vector<char> unaligned(2 * PAGE_SIZE + 1);
+    char* data[2] = {aligned.get(), unaligned.data() + 1};
+    for (int i=0; i<4; i++) {
+        memset(data[i % 2], 0, PAGE_SIZE);
+        snprintf(data[i % 2], PAGE_SIZE, "page %d", i);
+        dm_->WritePage(i, data[i % 2]);
+    }
+
+    for (int i=0; i<4; i++) {
+        memset(data[i % 2], 0, PAGE_SIZE);
+        dm_->ReadPage(i, data[i % 2]);
+        EXPECT_STREQ(data[i % 2], ("page " + std::to_string(i)).c_str());
+    }
+
+    std::vector<char*> bufs = {
+        aligned.get(), aligned.get() + PAGE_SIZE, unaligned.data() + 1, unaligned.data() + 1 + PAGE_SIZE};
+    for (char* buf : bufs)
+        memset(buf, 0, PAGE_SIZE);
+    dm_->ReadPages({3, 2, 1, 0}, bufs);
+    for (int i=0; i<4; i++)
+        EXPECT_STREQ(bufs[i], ("page " + std::to_string(3 - i)).c_str());
+}
+
+/* freed blocks are reused before the file grows, by pages of any size class that fits */
+TEST_F(DiskManagerTest, FreeSpaceTest) {
+    CreateDB();
+
+    const page_id_t large_class = page_id_t(1) << PAGE_SIZE_CLASS_SHIFT;
+    const page_id_t blocks_per_large_page = PAGE_SIZE_CLASSES[1] / PAGE_SIZE;
+    for (page_id_t i=0; i<2 * blocks_per_large_page; i++)
+        dm_->AllocatePage(i);
+    dm_->AllocatePage(large_class);
+    size_t file_size = std::filesystem::file_size(db_path_);
+    size_t large_offset = dm_->GetPageOffset(large_class).value();
+
+    /* A freed large page holds as many small pages. */
+    dm_->DeletePage(large_class);
+    EXPECT_FALSE(dm_->CheckPageExists(large_class));
+    for (page_id_t i=0; i<blocks_per_large_page; i++) {
+        page_id_t page_id = 2 * blocks_per_large_page + i;
+        dm_->AllocatePage(page_id);
+        EXPECT_EQ(dm_->GetPageOffset(page_id).value(), large_offset + i * PAGE_SIZE);
+    }
+
+    /* Adjacent small pages freed make room for a large page. */
+    size_t small_offset = dm_->GetPageOffset(0).value();
+    for (page_id_t i=0; i<blocks_per_large_page; i++)
+        dm_->DeletePage(i);
+    dm_->AllocatePage(large_class + 1);
+    EXPECT_EQ(dm_->GetPageOffset(large_class + 1).value(), small_offset);
+    EXPECT_EQ(std::filesystem::file_size(db_path_), file_size);
+    EXPECT_EQ(dm_->GetNumPages(), 2 * blocks_per_large_page + 1);
+}
+
+/* the page directory and free-space map survive reopening the database */
+TEST_F(DiskManagerTest, ReopenTest) {
+    CreateDB();
+
+    const page_id_t large_class = page_id_t(1) << PAGE_SIZE_CLASS_SHIFT;
+    std::vector<page_id_t> page_ids;
+    for (page_id_t i=0; i<100; i++)
+        page_ids.push_back(i * 37);  /* sparse ids, spread over several directory leaves */
+    page_ids.push_back(large_class + 5);
+    std::vector<char> data(PAGE_SIZE_CLASSES[1]);
+    for (page_id_t page_id : page_ids) {
+        snprintf(data.data(), data.size(), "page %d", page_id);
+        dm_->WritePage(page_id, data.data());
+    }
+    dm_->DeletePage(page_ids[10]);
+    size_t freed_offset = dm_->GetPageOffset(page_ids[11]).value();
+    dm_->DeletePage(page_ids[11]);
+    EXPECT_TRUE(dm_->Sync());
+
+    OpenDB();
+    EXPECT_EQ(dm_->GetNumPages(), page_ids.size() - 2);
+    EXPECT_EQ(dm_->GetNextPageId(0), 99 * 37 + 1);
+    EXPECT_EQ(dm_->GetNextPageId(1), large_class + 6);
+    EXPECT_EQ(dm_->GetNextPageId(2), page_id_t(2) << PAGE_SIZE_CLASS_SHIFT);
+    for (size_t i=0; i<page_ids.size(); i++) {
+        EXPECT_EQ(dm_->CheckPageExists(page_ids[i]), i != 10 && i != 11);
+        if (i == 10 || i == 11)
+            continue;
+        memset(data.data(), 0, data.size());
+        dm_->ReadPage(page_ids[i], data.data());
+        EXPECT_STREQ(data.data(), ("page " + std::to_string(page_ids[i])).c_str());
+    }
+
+    /* Blocks freed before reopening are reused. */
+    size_t file_size = std::filesystem::file_size(db_path_);
+    dm_->AllocatePage(5000);
+    dm_->AllocatePage(5001);
+    EXPECT_EQ(std::filesystem::file_size(db_path_), file_size);
+    EXPECT_TRUE(dm_->GetPageOffset(5000).value() == freed_offset || dm_->GetPageOffset(5001).value() == freed_offset);
+}
+/* an extent's pages take one run of blocks, read back zeroed with one I/O */
+TEST_F(DiskManagerTest, ExtentTest) {
+    CreateDB();
+
+    /* Freed blocks still hold the old pages' data. */
+    std::vector<char> data(PAGE_SIZE, 'x');
+    for (page_id_t i=0; i<EXTENT_PAGES; i++)
+        dm_->WritePage(i, data.data());
+    for (page_id_t i=0; i<EXTENT_PAGES; i++)
+        dm_->DeletePage(i);
+
+    const page_id_t first = 1000;
+    dm_->AllocatePages(first, EXTENT_PAGES);
+    EXPECT_EQ(dm_->GetNumPages(), EXTENT_PAGES);
+    EXPECT_EQ(dm_->GetNextPageId(0), first + EXTENT_PAGES);
+    size_t offset = dm_->GetPageOffset(first).value();
+    std::vector<page_id_t> page_ids;
+    std::vector<std::vector<char>> pages(EXTENT_PAGES, std::vector<char>(PAGE_SIZE, 'y'));
+    std::vector<char*> bufs;
+    for (page_id_t i=0; i<EXTENT_PAGES; i++) {
+        EXPECT_EQ(dm_->GetPageOffset(first + i).value(), offset + i * PAGE_SIZE);
+        page_ids.push_back(first + i);
+        bufs.push_back(pages[i].data());
+    }
+    EXPECT_EQ(dm_->ReadPages(page_ids, bufs), 1);
+    for (auto& page : pages)
+        EXPECT_EQ(std::count(page.begin(), page.end(), 0), PAGE_SIZE);
+
+    /* Pages already allocated keep their blocks, the others still form one run. */
+    dm_->AllocatePage(2000);
+    size_t allocated_offset = dm_->GetPageOffset(2000).value();
+    dm_->AllocatePages(1999, 3);
+    EXPECT_EQ(dm_->GetPageOffset(2000).value(), allocated_offset);
+    EXPECT_EQ(dm_->GetPageOffset(2001).value(), dm_->GetPageOffset(1999).value() + PAGE_SIZE);
+
+    OpenDB();
+    EXPECT_EQ(dm_->GetPageOffset(first + EXTENT_PAGES - 1).value(), offset + (EXTENT_PAGES - 1) * PAGE_SIZE);
+}
 
-/* TODO: tests on free slots allocation */
+/* tests that a file which is not a database is refused, rather than formatted over */
+TEST_F(DiskManagerTest, RefuseInvalidFileTest) {
+    std::string garbage(3 * PAGE_SIZE, 'x');
+    std::ofstream(db_path_, std::ios::binary) << garbage;
+    EXPECT_THROW(OpenDB(), std::runtime_error);
+    EXPECT_EQ(std::filesystem::file_size(db_path_), garbage.size());
 
-/* TODO: tests on existing file */
\ No newline at end of file
+    /* Too short to hold a header and a bitmap. */
+    std::filesystem::resize_file(db_path_, PAGE_SIZE / 2);
+    EXPECT_THROW(OpenDB(), std::runtime_error);
+    EXPECT_EQ(std::filesystem::file_size(db_path_), PAGE_SIZE / 2);
+
+    /* An empty file is formatted. */
+    std::filesystem::resize_file(db_path_, 0);
+    OpenDB();
+    EXPECT_EQ(dm_->GetNumPages(), 0);
+}
+
+/* tests that an extent whose blocks cannot be zeroed is not allocated */
+TEST_F(DiskManagerTest, ExtentZeroFailureTest) {
+    CreateDB();
+    dm_->AllocatePage(0);
+    size_t file_size = std::filesystem::file_size(db_path_);
+    const page_id_t num_pages = file_size / PAGE_SIZE;
+
+    /* Cap the file at its current size, so the file cannot grow to hold the extent. */
+    struct rlimit old_limit;
+    ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &old_limit));
+    auto old_handler = signal(SIGXFSZ, SIG_IGN);
+    struct rlimit limit = old_limit;
+    limit.rlim_cur = file_size;
+    ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+    bool ok = dm_->AllocatePages(1, num_pages);
+    setrlimit(RLIMIT_FSIZE, &old_limit);
+    signal(SIGXFSZ, old_handler);
+    EXPECT_FALSE(ok);
+    EXPECT_EQ(dm_->GetNumPages(), 1);
+    EXPECT_FALSE(dm_->CheckPageExists(1));
+    EXPECT_EQ(dm_->GetNextPageId(0), 1);
+
+    /* The blocks were given back, and the extent can be allocated once the file can grow. */
+    EXPECT_TRUE(dm_->AllocatePages(1, num_pages));
+    EXPECT_EQ(dm_->GetNumPages(), num_pages + 1);
+}
+
+/* tests that deleting a page waits for the I/O that pinned its offset */
+TEST_F(DiskManagerTest, PinPageTest) {
+    CreateDB();
+    dm_->AllocatePage(0);
+    EXPECT_FALSE(dm_->PinPage(1).has_value());
+
+    std::optional<PinnedPage> pin = dm_->PinPage(0);
+    ASSERT_TRUE(pin.has_value());
+    EXPECT_EQ(pin->GetOffset(), dm_->GetPageOffset(0).value());
+    std::future<void> deleted = std::async(std::launch::async, [this] { dm_->DeletePage(0); });
+    EXPECT_EQ(deleted.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+    EXPECT_TRUE(dm_->CheckPageExists(0));
+
+    /* The offset stays with the page until the pin is released, even if the pin is moved. */
+    PinnedPage moved = std::move(pin.value());
+    pin.reset();
+    EXPECT_EQ(deleted.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+    moved.Release();
+    deleted.get();
+    EXPECT_FALSE(dm_->CheckPageExists(0));
+}
@@ -0,0 +1,94 @@
+#include "gtest/gtest.h"
+#include "common.h"
+#include "frame_state.h"
+#include "lru_k_replacer.h"
+
+TEST(LRUKReplacerTest, EvictionOrderTest) {
+  FrameStateArray frames(6);
+  LRUKReplacer replacer(6, 2, &frames);
+
+  // Frames 0-4 are accessed once, then frames 0-3 again. Frame 4 has infinite backward k-distance.
+  for (frame_id_t i = 0; i < 5; i++) {
+    frames.Publish(i);
+    replacer.RecordAccess(i, i);
+  }
+  for (frame_id_t i = 0; i < 4; i++) {
+    replacer.RecordAccess(i, i);
+  }
+  // Frame 1 is accessed again, so its kth previous access is now the most recent of all.
+  replacer.RecordAccess(1, 1);
+  EXPECT_EQ(5, replacer.Size());
+
+  // Frame 5 holds no page, and pinned frames are skipped.
+  frames.Pin(2);
+  EXPECT_EQ(4, replacer.Size());
+  EXPECT_EQ(4, replacer.Evict());
+  EXPECT_EQ(0, replacer.Evict());
+  EXPECT_EQ(3, replacer.Evict());
+  EXPECT_EQ(1, replacer.Evict());
+  EXPECT_FALSE(replacer.Evict().has_value());
+
+  // Evicted frames start over with no history, and go first once they hold a page again.
+  frames.Unpin(2);
+  frames.Publish(0);
+  replacer.RecordAccess(0, 10);
+  EXPECT_EQ(0, replacer.Evict());
+  replacer.Remove(2);
+  EXPECT_EQ(0, replacer.Size());
+}
+
+TEST(LRUKReplacerTest, ResizeTest) {
+  FrameStateArray frames(4);
+  LRUKReplacer replacer(2, 2, &frames);
+  for (frame_id_t i = 0; i < 2; i++) {
+    frames.Publish(i);
+    replacer.RecordAccess(i, i);
+  }
+  replacer.Resize(4);
+
+  // Pages read in by a scan have no history, so they are evicted before frames with fewer than k accesses.
+  for (frame_id_t i = 2; i < 4; i++) {
+    frames.Publish(i);
+    replacer.RecordAccess(i, i, AccessHint::SCAN);
+  }
+  EXPECT_EQ(2, replacer.Evict());
+  EXPECT_EQ(3, replacer.Evict());
+  EXPECT_EQ(0, replacer.Evict());
+  EXPECT_EQ(1, replacer.Evict());
+}
+
+TEST(LRUKReplacerTest, EvictedHistoryTest) {
+  FrameStateArray frames(2);
+  LRUKReplacer replacer(2, 2, &frames);
+
+  // Page 10 is accessed twice, then evicted.
+  frames.Publish(0);
+  replacer.RecordAccess(0, 10);
+  replacer.RecordAccess(0, 10);
+  EXPECT_EQ(0, replacer.Evict());
+
+  // Page 10 is read back in, before page 11 is read for the first time. It gets its history back, so it has
+  // a finite backward k-distance and outlives page 11.
+  frames.Publish(0);
+  replacer.RecordAccess(0, 10);
+  frames.Publish(1);
+  replacer.RecordAccess(1, 11);
+  EXPECT_EQ(1, replacer.Evict());
+  EXPECT_EQ(0, replacer.Evict());
+}
+
+TEST(LRUKReplacerTest, ReferenceBitTest) {
+  FrameStateArray frames(3);
+  LRUKReplacer replacer(3, 1, &frames);
+  for (frame_id_t i = 0; i < 3; i++) {
+    frames.Publish(i);
+    replacer.RecordAccess(i, i);
+  }
+
+  // A hit on frame 0 only sets its reference bit. Evict counts it as an access, so frame 0 now goes last.
+  ASSERT_TRUE(frames.Pin(0, true));
+  frames.Unpin(0);
+  EXPECT_EQ(1, replacer.Evict());
+  EXPECT_EQ(2, replacer.Evict());
+  EXPECT_EQ(0, replacer.Evict());
+}
@@ -0,0 +1,101 @@
+#include <set>
+#include "gtest/gtest.h"
+#include "common.h"
+#include "frame_state.h"
+#include "replacer.h"
+
+TEST(ReplacerTest, AllPoliciesTest) {
+  for (ReplacerType type : {ReplacerType::LRU_K, ReplacerType::CLOCK, ReplacerType::TWO_Q, ReplacerType::ARC}) {
+    FrameStateArray frames(10);
+    std::shared_ptr<Replacer> replacer = MakeReplacer(type, 8, 2, &frames);
+    for (frame_id_t i = 0; i < 8; i++) {
+      frames.Publish(i);
+      replacer->RecordAccess(i, 100 + i);
+    }
+    frames.Pin(3);
+    EXPECT_EQ(7, replacer->Size());
+
+    // Every unpinned frame is evicted exactly once, and the pinned frame never is.
+    std::set<frame_id_t> evicted;
+    for (size_t i = 0; i < 7; i++) {
+      std::optional<frame_id_t> frame_id = replacer->Evict();
+      ASSERT_TRUE(frame_id.has_value());
+      EXPECT_NE(3, frame_id.value());
+      evicted.insert(frame_id.value());
+    }
+    EXPECT_EQ(7, evicted.size());
+    EXPECT_FALSE(replacer->Evict().has_value());
+    EXPECT_EQ(0, replacer->Size());
+
+    // Once unpinned, the frame can be evicted without telling the replacer.
+    frames.Unpin(3);
+    EXPECT_EQ(3, replacer->Evict());
+
+    // Frames added by Resize can be used like any other.
+    replacer->Resize(10);
+    frames.Publish(9);
+    replacer->RecordAccess(9, 109);
+    EXPECT_EQ(9, replacer->Evict());
+  }
+}
+
+TEST(ReplacerTest, ClockTest) {
+  FrameStateArray frames(3);
+  std::shared_ptr<Replacer> replacer = MakeReplacer(ReplacerType::CLOCK, 3, 0, &frames);
+  for (frame_id_t i = 0; i < 3; i++) {
+    frames.Publish(i);
+    replacer->RecordAccess(i, i);
+  }
+
+  // All frames are referenced, so the first sweep only clears their bits.
+  EXPECT_EQ(0, replacer->Evict());
+
+  // Frame 1 is hit, which only sets its reference bit, and gets a second chance.
+  ASSERT_TRUE(frames.Pin(1, true));
+  frames.Unpin(1);
+  EXPECT_EQ(2, replacer->Evict());
+  EXPECT_EQ(1, replacer->Evict());
+}
+
+TEST(ReplacerTest, TwoQScanTest) {
+  // With 4 frames, A1in holds 1 page and A1out remembers 2.
+  FrameStateArray frames(4);
+  std::shared_ptr<Replacer> replacer = MakeReplacer(ReplacerType::TWO_Q, 4, 0, &frames);
+  for (frame_id_t i = 0; i < 4; i++) {
+    frames.Publish(i);
+    replacer->RecordAccess(i, 100 + i);
+  }
+
+  // Page 100 leaves A1in first, and is promoted to Am when it is read back while in A1out.
+  EXPECT_EQ(0, replacer->Evict());
+  frames.Publish(0);
+  replacer->RecordAccess(0, 100);
+
+  // A scan of new pages only cycles through A1in.
+  for (page_id_t page_id = 200; page_id < 210; page_id++) {
+    std::optional<frame_id_t> frame_id = replacer->Evict();
+    ASSERT_TRUE(frame_id.has_value());
+    EXPECT_NE(0, frame_id.value());
+    frames.Publish(frame_id.value());
+    replacer->RecordAccess(frame_id.value(), page_id);
+  }
+}
+
+TEST(ReplacerTest, ARCGhostHitTest) {
+  FrameStateArray frames(2);
+  std::shared_ptr<Replacer> replacer = MakeReplacer(ReplacerType::ARC, 2, 0, &frames);
+  frames.Publish(0);
+  frames.Publish(1);
+  replacer->RecordAccess(0, 1);
+  replacer->RecordAccess(1, 2);
+  replacer->RecordAccess(0, 1);
+
+  // Page 1 was seen twice, so it is in T2, and page 2 in T1 goes first.
+  EXPECT_EQ(1, replacer->Evict());
+
+  // Page 2 is read back while in B1. It goes to T2, as its most recent page, and T1's target grows.
+  frames.Publish(1);
+  replacer->RecordAccess(1, 2);
+  EXPECT_EQ(0, replacer->Evict());
+  EXPECT_EQ(1, replacer->Evict());
+}